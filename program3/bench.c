@@ -0,0 +1,642 @@
+/******************************************************************************
+ ** Filename:    bench.c
+ **
+ ** Description: This program measures how fast smallsh starts and reaps
+ **              commands. It runs a fresh shell for each workload, feeds it
+ **              commands through a pipe, and times the shell's replies:
+ **              the prompt that follows a foreground command, and the
+ **              "background pid is" and "is done" lines of background jobs.
+ **              The workloads are sequential /bin/true commands, background
+ **              sleep 0 jobs, a loop of redirections, lines with nearly
+ **              MAX_ARGS words, and true run inside the shell. Commands are
+ **              named by path where the shell would otherwise run them
+ **              itself, so all but the last measure spawning and reaping.
+ **              One JSON object is printed per workload
+ **              with commands per second, p50/p99 spawn-to-reap latency in
+ **              microseconds, and the shell's peak RSS.
+ **
+ ** Input:       from the command line: type char*
+ **
+ ** Output:      to the console : type char[], double, long
+ ******************************************************************************/
+
+#define _GNU_SOURCE    // for pipe2
+
+#include <errno.h>     // for errno
+#include <fcntl.h>     // for fcntl
+#include <poll.h>      // for poll
+#include <signal.h>    // for signal
+#include <stdio.h>     // for printf
+#include <stdlib.h>    // for malloc, free, qsort
+#include <string.h>    // for strstr, strlen
+#include <sys/wait.h>  // for waitpid
+#include <time.h>      // for clock_gettime
+#include <unistd.h>    // for fork, exec
+
+#define DEFAULT_COUNT  1000 // commands run by each workload
+#define ARG_WORDS       511 // words on a line, just under smallsh's MAX_ARGS
+#define READ_BUFFER   65536 // bytes of shell output read at a time
+#define LINE_BUFFER    4096 // longest shell output line looked at
+
+// define bool as type
+typedef enum { false, true } bool;
+
+// a shell being measured and what it has printed so far
+struct shell
+{
+    pid_t pid;                      // process id of the shell
+    int toShell;                    // write end of the shell's stdin
+    int fromShell;                  // read end of the shell's stdout
+    long numPrompts;                // prompts printed so far
+    bool sawColon;                  // last byte read was a :
+    char line[LINE_BUFFER];         // output line being gathered
+    size_t lineLength;              // bytes in line
+};
+
+// a background job that has been started but not reported done
+struct startTime
+{
+    pid_t pid;                      // process id printed by the shell
+    long long ns;                   // when the shell printed it
+};
+
+// the timings taken for one workload
+struct result
+{
+    long long *latencies;           // spawn-to-reap time of each command
+    long numLatencies;              // entries in latencies
+    struct startTime *starts;       // background jobs waiting to finish
+    size_t numStartSlots;           // size of starts, a power of two
+    long numDone;                   // background jobs reported done
+};
+
+
+
+/******************************************************************************
+ ** Function:          nowNs()
+ ** Description:       This function reads the monotonic clock.
+ ** Parameters:        none
+ ** Pre-Conditions:    none
+ ** Post-Conditions:   returns the time in nanoseconds
+ ******************************************************************************/
+long long nowNs();
+
+
+
+/******************************************************************************
+ ** Function:          startShell()
+ ** Description:       This function starts smallsh in interactive mode with
+ **                    its stdin and stdout connected to pipes, and waits for
+ **                    its first prompt.
+ ** Parameters:        one pointer to const char: path,
+ **                    one pointer to struct shell: sh
+ ** Pre-Conditions:    path names the smallsh binary
+ ** Post-Conditions:   returns 0 with sh describing the running shell, or -1
+ **                    if it could not be started
+ ******************************************************************************/
+int startShell(const char *path, struct shell *sh);
+
+
+
+/******************************************************************************
+ ** Function:          readShell()
+ ** Description:       This function reads whatever the shell has printed,
+ **                    counting prompts and handing each complete line that
+ **                    mentions a background job to noteJob().
+ ** Parameters:        one pointer to struct shell: sh,
+ **                    one pointer to struct result: res
+ ** Pre-Conditions:    the shell's stdout is readable
+ ** Post-Conditions:   returns the bytes read, 0 at end of file, or -1 on error
+ ******************************************************************************/
+int readShell(struct shell *sh, struct result *res);
+
+
+
+/******************************************************************************
+ ** Function:          noteJob()
+ ** Description:       This function records the time a background job was
+ **                    reported started, or, when it is reported done, the
+ **                    time between the two reports.
+ ** Parameters:        one pointer to struct result: res,
+ **                    one pointer to const char: line
+ ** Pre-Conditions:    line is one line of shell output
+ ** Post-Conditions:   res holds the start time or a new latency
+ ******************************************************************************/
+void noteJob(struct result *res, const char *line);
+
+
+
+/******************************************************************************
+ ** Function:          runLockstep()
+ ** Description:       This function sends commands one at a time and waits
+ **                    for the prompt that follows each one, so each latency
+ **                    covers parsing, spawning, and reaping one command.
+ ** Parameters:        one pointer to struct shell: sh,
+ **                    one pointer to struct result: res,
+ **                    two pointers to const char: lines[2],
+ **                    one long: count
+ ** Pre-Conditions:    the shell is waiting at its first prompt. The
+ **                    commands alternate between lines[0] and lines[1]
+ ** Post-Conditions:   returns 0 after count commands, or -1 if the shell
+ **                    stopped answering
+ ******************************************************************************/
+int runLockstep(struct shell *sh, struct result *res, const char *lines[2], long count);
+
+
+
+/******************************************************************************
+ ** Function:          runStream()
+ ** Description:       This function sends commands as fast as the shell
+ **                    takes them and reads its output at the same time, until
+ **                    every background job has been reported done.
+ ** Parameters:        one pointer to struct shell: sh,
+ **                    one pointer to struct result: res,
+ **                    one pointer to const char: line,
+ **                    one long: count
+ ** Pre-Conditions:    line starts a background job
+ ** Post-Conditions:   returns 0 after count jobs finished, or -1 if the
+ **                    shell stopped answering
+ ******************************************************************************/
+int runStream(struct shell *sh, struct result *res, const char *line, long count);
+
+
+
+/******************************************************************************
+ ** Function:          stopShell()
+ ** Description:       This function reads the shell's peak RSS, then has it
+ **                    exit and waits for it.
+ ** Parameters:        one pointer to struct shell: sh
+ ** Pre-Conditions:    the shell is running
+ ** Post-Conditions:   returns the peak RSS in kilobytes, or -1 if unknown
+ ******************************************************************************/
+long stopShell(struct shell *sh);
+
+
+
+/******************************************************************************
+ ** Function:          report()
+ ** Description:       This function prints one workload's results as a JSON
+ **                    object on one line.
+ ** Parameters:        one pointer to const char: name,
+ **                    one long: count,
+ **                    one long long: elapsedNs,
+ **                    one pointer to struct result: res,
+ **                    one long: peakRss
+ ** Pre-Conditions:    res holds the latencies taken
+ ** Post-Conditions:   the latencies are sorted and the results printed
+ ******************************************************************************/
+void report(const char *name, long count, long long elapsedNs, struct result *res, long peakRss);
+
+
+
+/******************************************************************************
+ ** Function:          compareLatency()
+ ** Description:       This function orders latencies for qsort.
+ ** Parameters:        two pointers to const void: a, b
+ ** Pre-Conditions:    a and b point to long long values
+ ** Post-Conditions:   returns less than, equal to, or more than 0
+ ******************************************************************************/
+int compareLatency(const void *a, const void *b);
+
+
+
+int main(int argc, char** argv)
+{
+    // declare variables
+    const char *shellPath = "./smallsh";
+    const char *lines[2];
+    char dir[] = "/tmp/smallshbenchXXXXXX";
+    char *redirectLines[2];
+    char *argLine;
+    struct result res;
+    struct shell sh;
+    long long started;
+    long count = DEFAULT_COUNT;
+    long peakRss;
+    int workload;
+    int result;
+    int i;
+
+    // get the count and shell from the command line
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+        {
+            count = atol(argv[++i]);
+        }
+        else
+        {
+            shellPath = argv[i];
+        }
+    }
+
+    if (count < 1)
+    {
+        fprintf(stderr, "usage: smallshbench [-n count] [smallsh]\n");
+        exit(2);
+    }
+
+    // a shell that dies should show up as an error, not kill the benchmark
+    signal(SIGPIPE, SIG_IGN);
+
+    // build the redirection commands in a scratch directory
+    if (mkdtemp(dir) == NULL)
+    {
+        perror("smallshbench: mkdtemp");
+        exit(1);
+    }
+    asprintf(&redirectLines[0], "/bin/echo hello > %s/out\n", dir);
+    asprintf(&redirectLines[1], "wc -c < %s/out > %s/count\n", dir, dir);
+
+    // build a true command with nearly as many words as a line may hold
+    argLine = malloc(ARG_WORDS * 2 + 16);
+    strcpy(argLine, "/bin/true");
+    for (i = 1; i < ARG_WORDS; i++)
+    {
+        strcat(argLine, " a");
+    }
+    strcat(argLine, "\n");
+
+    res.latencies = malloc(count * sizeof(long long));
+    res.numStartSlots = 1;
+    while (res.numStartSlots < (size_t) count * 2)
+    {
+        res.numStartSlots *= 2;
+    }
+    res.starts = malloc(res.numStartSlots * sizeof(struct startTime));
+
+    for (workload = 0; workload < 5; workload++)
+    {
+        res.numLatencies = 0;
+        res.numDone = 0;
+        memset(res.starts, 0, res.numStartSlots * sizeof(struct startTime));
+
+        if (startShell(shellPath, &sh) == -1)
+        {
+            exit(1);
+        }
+
+        started = nowNs();
+        if (workload == 0)
+        {
+            lines[0] = lines[1] = "/bin/true\n";
+            result = runLockstep(&sh, &res, lines, count);
+        }
+        else if (workload == 1)
+        {
+            result = runStream(&sh, &res, "sleep 0 &\n", count);
+        }
+        else if (workload == 2)
+        {
+            lines[0] = redirectLines[0];
+            lines[1] = redirectLines[1];
+            result = runLockstep(&sh, &res, lines, count);
+        }
+        else if (workload == 3)
+        {
+            lines[0] = lines[1] = argLine;
+            result = runLockstep(&sh, &res, lines, count);
+        }
+        else
+        {
+            // true without arguments runs in the shell, with no process
+            lines[0] = lines[1] = "true\n";
+            result = runLockstep(&sh, &res, lines, count);
+        }
+        started = nowNs() - started;
+
+        peakRss = stopShell(&sh);
+        if (result == -1)
+        {
+            fprintf(stderr, "smallshbench: shell stopped answering\n");
+            exit(1);
+        }
+
+        report((workload == 0) ? "sequential_true" :
+               (workload == 1) ? "background_sleep" :
+               (workload == 2) ? "redirection_loop" :
+               (workload == 3) ? "max_args_line" : "builtin_true",
+               count, started, &res, peakRss);
+    }
+
+    // clean up the scratch directory
+    unlink(strcat(strcpy(argLine, dir), "/out"));
+    unlink(strcat(strcpy(argLine, dir), "/count"));
+    rmdir(dir);
+
+    return 0;
+}
+
+
+
+long long nowNs()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+
+
+int startShell(const char *path, struct shell *sh)
+{
+    int inPipe[2];
+    int outPipe[2];
+
+    if (pipe2(inPipe, O_CLOEXEC) == -1 || pipe2(outPipe, O_CLOEXEC) == -1)
+    {
+        perror("smallshbench: pipe");
+        return -1;
+    }
+
+    fflush(stdout);
+    sh->pid = fork();
+    if (sh->pid == -1)
+    {
+        perror("smallshbench: fork");
+        return -1;
+    }
+
+    if (sh->pid == 0)
+    {
+        // run the shell with prompts on, since they mark each command's end
+        dup2(inPipe[0], 0);
+        dup2(outPipe[1], 1);
+        execl(path, path, "-i", (char *) NULL);
+        perror(path);
+        _exit(127);
+    }
+
+    close(inPipe[0]);
+    close(outPipe[1]);
+    sh->toShell = inPipe[1];
+    sh->fromShell = outPipe[0];
+    sh->numPrompts = 0;
+    sh->sawColon = false;
+    sh->lineLength = 0;
+
+    // wait for the first prompt
+    while (sh->numPrompts == 0)
+    {
+        if (readShell(sh, NULL) <= 0)
+        {
+            fprintf(stderr, "smallshbench: %s did not start\n", path);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+
+int readShell(struct shell *sh, struct result *res)
+{
+    char buffer[READ_BUFFER];
+    ssize_t numRead;
+    ssize_t i;
+
+    do
+    {
+        numRead = read(sh->fromShell, buffer, sizeof(buffer));
+    }
+    while (numRead == -1 && errno == EINTR);
+
+    for (i = 0; i < numRead; i++)
+    {
+        // each ": " is a prompt; commands run here print nothing like it
+        if (sh->sawColon == true && buffer[i] == ' ')
+        {
+            sh->numPrompts++;
+        }
+        sh->sawColon = (buffer[i] == ':');
+
+        if (buffer[i] == '\n')
+        {
+            sh->line[sh->lineLength] = '\0';
+            if (res != NULL)
+            {
+                noteJob(res, sh->line);
+            }
+            sh->lineLength = 0;
+        }
+        else if (sh->lineLength < sizeof(sh->line) - 1)
+        {
+            sh->line[sh->lineLength++] = buffer[i];
+        }
+    }
+
+    return numRead;
+}
+
+
+
+void noteJob(struct result *res, const char *line)
+{
+    const char *text;
+    size_t mask = res->numStartSlots - 1;
+    size_t index;
+    int pid;
+
+    text = strstr(line, "background pid ");
+    if (text == NULL)
+    {
+        return;
+    }
+
+    if (sscanf(text, "background pid is %d", &pid) == 1)
+    {
+        // remember when the job started, hashed by pid
+        index = (pid * 2654435761u) & mask;
+        while (res->starts[index].pid != 0)
+        {
+            index = (index + 1) & mask;
+        }
+        res->starts[index].pid = pid;
+        res->starts[index].ns = nowNs();
+    }
+    else if (sscanf(text, "background pid %d is done", &pid) == 1)
+    {
+        index = (pid * 2654435761u) & mask;
+        while (res->starts[index].pid != 0 && res->starts[index].pid != pid)
+        {
+            index = (index + 1) & mask;
+        }
+
+        if (res->starts[index].pid == pid)
+        {
+            res->latencies[res->numLatencies++] = nowNs() - res->starts[index].ns;
+
+            // mark the slot reused rather than empty so probes continue
+            res->starts[index].pid = -1;
+        }
+        res->numDone++;
+    }
+}
+
+
+
+int runLockstep(struct shell *sh, struct result *res, const char *lines[2], long count)
+{
+    long long sent;
+    size_t length;
+    long target;
+    long i;
+
+    for (i = 0; i < count; i++)
+    {
+        length = strlen(lines[i % 2]);
+        target = sh->numPrompts + 1;
+
+        sent = nowNs();
+        if (write(sh->toShell, lines[i % 2], length) != (ssize_t) length)
+        {
+            return -1;
+        }
+
+        // the next prompt means the command was started and reaped
+        while (sh->numPrompts < target)
+        {
+            if (readShell(sh, res) <= 0)
+            {
+                return -1;
+            }
+        }
+        res->latencies[res->numLatencies++] = nowNs() - sent;
+    }
+
+    return 0;
+}
+
+
+
+int runStream(struct shell *sh, struct result *res, const char *line, long count)
+{
+    struct pollfd fds[2];
+    size_t length = strlen(line);
+    size_t offset = 0;
+    long numSent = 0;
+    ssize_t numWritten;
+
+    fcntl(sh->toShell, F_SETFL, O_NONBLOCK);
+
+    while (res->numDone < count)
+    {
+        fds[0].fd = sh->fromShell;
+        fds[0].events = POLLIN;
+        fds[1].fd = (numSent < count) ? sh->toShell : -1;
+        fds[1].events = POLLOUT;
+
+        if (poll(fds, 2, -1) == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+
+        if (fds[0].revents & (POLLIN|POLLHUP))
+        {
+            if (readShell(sh, res) <= 0)
+            {
+                return -1;
+            }
+        }
+
+        // keep the shell's input full, one command at a time
+        if (fds[1].revents & POLLOUT)
+        {
+            numWritten = write(sh->toShell, line + offset, length - offset);
+            if (numWritten == -1 && errno != EAGAIN)
+            {
+                return -1;
+            }
+            if (numWritten > 0)
+            {
+                offset += numWritten;
+                if (offset == length)
+                {
+                    offset = 0;
+                    numSent++;
+                }
+            }
+        }
+        else if (fds[1].revents & (POLLERR|POLLHUP))
+        {
+            return -1;
+        }
+    }
+
+    fcntl(sh->toShell, F_SETFL, 0);
+    return 0;
+}
+
+
+
+long stopShell(struct shell *sh)
+{
+    char path[64];
+    char text[256];
+    long peakRss = -1;
+    FILE *status;
+
+    // VmHWM is the most memory the shell itself has used
+    snprintf(path, sizeof(path), "/proc/%d/status", sh->pid);
+    status = fopen(path, "r");
+    if (status != NULL)
+    {
+        while (fgets(text, sizeof(text), status) != NULL)
+        {
+            if (sscanf(text, "VmHWM: %ld", &peakRss) == 1)
+            {
+                break;
+            }
+        }
+        fclose(status);
+    }
+
+    // end of input makes the shell exit
+    close(sh->toShell);
+    while (readShell(sh, NULL) > 0)
+    {
+        ;
+    }
+    close(sh->fromShell);
+    waitpid(sh->pid, NULL, 0);
+
+    return peakRss;
+}
+
+
+
+void report(const char *name, long count, long long elapsedNs, struct result *res, long peakRss)
+{
+    double p50 = 0;
+    double p99 = 0;
+
+    if (res->numLatencies > 0)
+    {
+        qsort(res->latencies, res->numLatencies, sizeof(long long), compareLatency);
+        p50 = res->latencies[(res->numLatencies - 1) / 2] / 1000.0;
+        p99 = res->latencies[(res->numLatencies - 1) * 99 / 100] / 1000.0;
+    }
+
+    printf("{\"workload\": \"%s\", \"commands\": %ld, \"seconds\": %.3f, "
+           "\"commands_per_sec\": %.1f, \"p50_us\": %.1f, \"p99_us\": %.1f, "
+           "\"peak_rss_kb\": %ld}\n",
+           name, count, elapsedNs / 1e9, count / (elapsedNs / 1e9),
+           p50, p99, peakRss);
+    fflush(stdout);
+}
+
+
+
+int compareLatency(const void *a, const void *b)
+{
+    long long x = *(const long long *) a;
+    long long y = *(const long long *) b;
+
+    return (x > y) - (x < y);
+}
@@ -0,0 +1,128 @@
+/******************************************************************************
+ ** Filename:    client.c
+ **
+ ** Description: This program is a client of smallsh --listen. It connects
+ **              to the server's Unix socket and sends one request holding
+ **              its working directory and, with -c, the commands to run,
+ **              along with its stdin, stdout and stderr. Without -c the
+ **              server's session reads commands from the client's stdin.
+ **              The session writes to the client's own descriptors, so its
+ **              output is streamed as it runs; the client waits for the
+ **              session's exit status and exits with it.
+ **
+ ** Input:       from the command line: type char*
+ **
+ ** Output:      the exit status of the session : type int
+ ******************************************************************************/
+
+#define _GNU_SOURCE    // for MSG_CMSG_CLOEXEC
+
+#include <errno.h>     // for errno
+#include <limits.h>    // for PATH_MAX
+#include <stdio.h>     // for fprintf
+#include <stdlib.h>    // for exit
+#include <string.h>    // for strlen, memcpy
+#include <sys/socket.h> // for socket, sendmsg
+#include <sys/un.h>    // for struct sockaddr_un
+#include <unistd.h>    // for getcwd, read
+
+#define CLIENT_REQUEST 65536 // largest request smallsh --listen accepts
+
+
+
+int main(int argc, char **argv)
+{
+    union
+    {
+        struct cmsghdr align;
+        char space[CMSG_SPACE(3 * sizeof(int))];
+    } control;
+    struct sockaddr_un address;
+    struct cmsghdr *cm;
+    struct msghdr msg;
+    struct iovec iov;
+    char message[CLIENT_REQUEST];
+    const char *commandText = "";
+    int fds[3] = { 0, 1, 2 };
+    size_t dirLength;
+    size_t textLength;
+    ssize_t length;
+    int status;
+    int fd;
+
+    if (argc == 4 && strcmp(argv[2], "-c") == 0)
+    {
+        commandText = argv[3];
+    }
+    else if (argc != 2)
+    {
+        fprintf(stderr, "usage: smallshclient socket [-c command]\n");
+        exit(2);
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(argv[1]) >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, "smallshclient: socket path is too long\n");
+        exit(2);
+    }
+    strcpy(address.sun_path, argv[1]);
+
+    fd = socket(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC, 0);
+    if (fd == -1 || connect(fd, (struct sockaddr *) &address, sizeof(address)) == -1)
+    {
+        perror("smallshclient: connect");
+        exit(1);
+    }
+
+    // the request is the directory and the commands, each ended by a null
+    if (getcwd(message, PATH_MAX) == NULL)
+    {
+        perror("smallshclient: getcwd");
+        exit(1);
+    }
+    dirLength = strlen(message) + 1;
+    textLength = strlen(commandText) + 1;
+    if (dirLength + textLength > sizeof(message))
+    {
+        fprintf(stderr, "smallshclient: command is too long\n");
+        exit(2);
+    }
+    memcpy(message + dirLength, commandText, textLength);
+
+    // with stdin, stdout and stderr attached
+    iov.iov_base = message;
+    iov.iov_len = dirLength + textLength;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.space;
+    msg.msg_controllen = sizeof(control.space);
+    cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cm), fds, sizeof(fds));
+
+    if (sendmsg(fd, &msg, 0) == -1)
+    {
+        perror("smallshclient: sendmsg");
+        exit(1);
+    }
+
+    // then wait for the session to end
+    do
+    {
+        length = read(fd, &status, sizeof(status));
+    }
+    while (length == -1 && errno == EINTR);
+
+    if (length != sizeof(status))
+    {
+        fprintf(stderr, "smallshclient: no status from the server\n");
+        exit(1);
+    }
+
+    return status;
+}
@@ -5,10 +5,26 @@
  **
  ** Description: This program is a small shell that runs command line
  **              instructions and returns results. It allows redirection of
- **              standard input and standard output and supports both
- **              foreground and background processes. The shell supports three
- **              built in commands: exit, cd, and status. It also supports
- **              comments, which are lines beginning with the # character.
+ **              standard input and standard output, pipelines of commands
+ **              joined by |, lists joined by ; && and ||, if, while and for
+ **              commands, and supports both foreground and background
+ **              processes. The shell supports the built in commands exit,
+ **              cd, status, jobs, fg, bg, hash, times, trace, parallel,
+ **              maxjobs, placement, and timeout, and a cached prefix that
+ **              replays the saved output of a command already run on the
+ **              same input. Each job runs in its own process group, and at
+ **              a terminal Ctrl-Z stops the foreground job. Background jobs
+ **              past the limit set by maxjobs wait in a queue, ordered by
+ **              the value of a nice prefix, until a running one finishes,
+ **              and placement can pin them to CPUs away from the
+ **              foreground. It also supports comments, which are lines
+ **              beginning with the # character, here-documents (<<) and
+ **              here-strings (<<<), and expands $$, $?, $NAME and
+ **              $(command) in words and file name patterns using *, ? and
+ **              [...] in arguments. With --listen it serves local clients
+ **              over a Unix socket, running each client's commands in a
+ **              session of its own. Simple uses of echo, pwd, true, false,
+ **              test, and cat run inside the shell without a new process.
  **
  ** Input:       from the keyboard: type char[]
  **              from files:        type char[]
@@ -16,60 +32,550 @@
  ** Output:      to the console and files : type char[], char*, const char*, int
  ******************************************************************************/
 
+#define _GNU_SOURCE    // for pipe2, splice, tee
+
+#include <ctype.h>     // for isalnum, isdigit
+#include <dirent.h>    // for opendir, readdir, getdents64
 #include <errno.h>     // for errno
-#include <fcntl.h>     // for open
-#include <limits.h>    // for INT_MAX
+#include <fcntl.h>     // for open, splice, tee
+#include <linux/sched.h> // for struct clone_args, CLONE_PARENT
+#include <limits.h>    // for PATH_MAX
+#include <poll.h>      // for poll
+#include <sched.h>     // for sched_setaffinity, cpu_set_t
 #include <signal.h>    // for sigset_t
+#include <spawn.h>     // for posix_spawnp
 #include <stdio.h>     // for fgets
 #include <stdlib.h>    // for getenv, malloc, free
 #include <string.h>    // for strcpy, strcat
+#include <sys/mman.h>  // for mmap, memfd_create
+#include <sys/epoll.h> // for epoll_create1
+#include <sys/pidfd.h> // for pidfd_open, pidfd_send_signal
+#include <sys/resource.h> // for struct rusage
+#include <sys/sendfile.h> // for sendfile
+#include <sys/socket.h> // for socketpair, sendmsg, recvmsg
 #include <sys/stat.h>  // for stat 
+#include <sys/syscall.h> // for SYS_clone3
+#include <sys/time.h>  // for timeradd
+#include <sys/timerfd.h> // for timerfd_create, timerfd_settime
 #include <sys/types.h> // for pid_t
-#include <sys/wait.h>  // for waitpid
+#include <sys/un.h>    // for struct sockaddr_un
+#include <sys/wait.h>  // for waitpid, wait4
+#include <termios.h>   // for tcsetpgrp, tcgetattr
+#include <time.h>      // for clock_gettime
 #include <unistd.h>    // for exec
 
 #define DEBUG             0 // change to 1 for debugging print statements 
 #define MAX_ARGS        512 // maximum arguments accepted on command line
-#define MAX_LENGTH     2048 // maximum length for a command line
-#define MAX_PIDS       1000 // maximum PIDs to track
+#define MAX_STAGES       64 // maximum commands joined in one pipeline
+#define COPY_CHUNK    65536 // bytes moved per splice/tee call
+#define MIN_BUCKETS      64 // initial size of the job and path hash tables
+#define READ_BUFFER   65536 // bytes of input read at a time
+#define MAX_EVENTS       64 // finished children collected per epoll_wait
+#define USAGE_HISTORY    16 // finished jobs listed by the times builtin
+#define LAUNCH_MESSAGE 65536 // largest request sent to the launcher helper
+#define ARENA_BLOCK   65536 // bytes in each block of the parse arena
+#define KILL_GRACE        5 // seconds from SIGTERM to SIGKILL on a timeout
+#define OUTPUT_BLOCK   4096 // least room left for each read of $(command)
+#define TRACE_EVENTS  65536 // events kept by the tracer before it wraps
+#define RESULT_CACHE 67108864 // bytes of saved output kept by cached
+#define CLIENT_REQUEST 65536 // largest request a client of --listen sends
+#define GLOB_DIRS        64 // directory listings kept for file name patterns
 
 // define bool as type
 typedef enum { false, true } bool;
 
+// environment passed to spawned commands
+extern char **environ;
+
+// one stage of a command line; all strings are kept in the parse arena
+struct command
+{
+    int argc;                   // number of arguments in argv
+    char **argv;                // NULL terminated argument array
+    char *inputFile;            // target of < redirection, or NULL
+    char *inputText;            // body of a << or <<< redirection, or NULL
+    char *outputFile;           // target of > redirection, or NULL
+};
+
+// a pipeline after parsing: stages joined by | that run together
+struct pipeline
+{
+    int numStages;                          // number of stages in use
+    struct command *stages;                 // the commands, left to right
+    bool isBackground;                      // true if it ended with &
+    bool hasExpansions;                     // a word has a $ to expand
+};
+
+// kinds of node in a parsed command
+enum nodeType
+{
+    NODE_PIPELINE,              // a pipeline of simple commands
+    NODE_AND,                   // first && second
+    NODE_OR,                    // first || second
+    NODE_IF,                    // if cond; then body; else orElse; fi
+    NODE_WHILE,                 // while cond; do body; done
+    NODE_FOR                    // for name in words; do body; done
+};
+
+// one node of a parsed command; the commands of a list are chained by next
+struct node
+{
+    enum nodeType type;         // what the node does
+    struct node *next;          // next command in the same list
+    struct pipeline *pl;        // NODE_PIPELINE: the pipeline to run
+    struct node *first;         // NODE_AND, NODE_OR: command run first
+    struct node *second;        // NODE_AND, NODE_OR: command that may follow
+    struct node *cond;          // NODE_IF, NODE_WHILE: condition list
+    struct node *body;          // NODE_IF, NODE_WHILE, NODE_FOR: body list
+    struct node *orElse;        // NODE_IF: else list (elif is a nested if)
+    char *name;                 // NODE_FOR: variable set for each word
+    char **words;               // NODE_FOR: words the variable takes
+    int numWords;               // NODE_FOR: number of words
+};
+
+// resources used by the processes of one job, summed from wait4
+struct usage
+{
+    struct timeval userTime;    // user CPU time
+    struct timeval systemTime;  // system CPU time
+    long maxRss;                // largest resident set of a process, in kB
+    long volSwitches;           // voluntary context switches
+    long involSwitches;         // involuntary context switches
+    long long wallNs;           // time from spawn until the last reap
+    int numProcs;               // processes counted
+};
+
+// a time limit on a background job or on the foreground pipeline
+struct deadline
+{
+    long long whenNs;           // monotonic time the next step is due
+    long long graceNs;          // time allowed between SIGTERM and SIGKILL
+    int step;                   // 0 at first, 1 after SIGTERM, 2 after SIGKILL
+    bool isQueued;              // the limit is in the timer heap
+    size_t heapIndex;           // its place in the timer heap
+    struct job *job;            // job it limits, or NULL for the fg pipeline
+};
+
+// one process started by the shell for a background job
+struct process
+{
+    pid_t pid;                  // process ID
+    int pidfd;                  // pidfd for the process, or -1 once reaped
+    int cpu;                    // CPU it was pinned to, or -1
+    int status;                 // wait status once the process is done
+    bool isDone;                // true once the process has been reaped
+    struct job *job;            // job the process belongs to
+    struct process *hashNext;   // next process in the same PID bucket
+};
+
+// one background pipeline, tracked until every process in it is done
+struct job
+{
+    int id;                     // job number, fixed for the life of the job
+    pid_t pgid;                 // process group holding all of the job
+    bool isStopped;             // stopped by Ctrl-Z and not yet continued
+    bool hasModes;              // modes holds the job's terminal settings
+    struct termios modes;       // terminal settings when the job stopped
+    int numProcs;               // number of processes in procs[]
+    int numLive;                // processes not yet reaped
+    struct process *procs;      // one entry per stage that was started
+    char *command;              // command line shown by the jobs builtin
+    long long startNs;          // monotonic time the job was spawned
+    struct usage use;           // resources used by processes reaped so far
+    struct deadline limit;      // time limit set by timeout, if any
+    struct pipeline *pending;   // pipeline to start, while the job is queued
+    int nice;                   // niceness from a nice prefix; lower starts first
+    size_t queueIndex;          // its place in the queue, while it is queued
+    long long timeoutNs;        // time limit to start with the job, if any
+    long long graceNs;          // and the time from SIGTERM to SIGKILL
+    struct job *hashNext;       // next job in the same job number bucket
+    struct job *prev;           // previous job in order of creation
+    struct job *next;           // next job in order of creation
+};
+
+// background jobs, hashed by PID and by job number so that adding,
+// finding and removing a job takes constant time however many there are
+struct jobTable
+{
+    int epollFd;                    // epoll set of every process's pidfd
+    struct process **pidBuckets;    // processes hashed by PID
+    struct job **idBuckets;         // jobs hashed by job number
+    size_t numBuckets;              // size of both bucket arrays
+    size_t numProcs;                // processes in the table
+    size_t numJobs;                 // jobs in the table
+    int nextId;                     // job number for the next job
+    struct job *head;               // oldest job, for listing in order
+    struct job *tail;               // newest job
+    int timerFd;                    // timerfd for the earliest time limit
+    struct deadline **timers;       // time limits, a heap by whenNs
+    size_t numTimers;               // limits in the heap
+    size_t timersSize;              // capacity of timers
+    struct job **queue;             // jobs waiting to start, a heap by nice
+                                    // then job number
+    size_t numQueued;               // jobs in the queue
+    size_t queueSize;               // capacity of queue
+};
+
+
+// the resource use of a finished job
+struct usageRecord
+{
+    int id;                         // job number, or 0 for a foreground job
+    pid_t pid;                      // process id of the last stage
+    char *command;                  // command line of the job
+    struct usage use;               // resources the job used
+};
+
+// recent finished jobs and the totals for all of them
+struct usageHistory
+{
+    struct usageRecord records[USAGE_HISTORY];  // ring of recent jobs
+    long numRecords;                // jobs recorded since the shell started
+    struct usage total;             // sum over every job recorded
+};
+
+// kinds of event recorded by the tracer
+enum traceType
+{
+    TRACE_READ,                 // a line of input was read
+    TRACE_PARSE,                // a command was parsed
+    TRACE_SPAWN,                // posix_spawn or the launcher started a child
+    TRACE_FORK,                 // a copy stage was forked
+    TRACE_EXEC,                 // the spawned child is running its program
+    TRACE_CHILD,                // a child's exit was noticed (its pidfd woke)
+    TRACE_REAP                  // a child was waited for
+};
+
+// one event in the trace; every event is the same size so the log is
+// a flat array
+struct traceEvent
+{
+    long long timeNs;           // monotonic time it happened
+    long long value;            // start time, wait status, or line number
+    int type;                   // enum traceType
+    pid_t pid;                  // child it is about, or 0
+};
+
+// events of this session, in a ring mapped when tracing is first turned on
+struct traceLog
+{
+    struct traceEvent *events;  // ring of TRACE_EVENTS events
+    long numEvents;             // events recorded since it was cleared
+    bool isOn;                  // events are being recorded
+};
+
+// one item of a parallel command
+struct parallelTask
+{
+    pid_t pid;                      // process running the item, or -1
+    int pidfd;                      // pidfd while it runs, or -1
+    int outFd;                      // memfd holding its output for -k, or -1
+    int slot;                       // entry it holds in fgpid[]
+    int status;                     // wait status once it is done
+    bool isDone;                    // true once it has been reaped
+};
+
+// header of a request to the launcher helper; the program path, working
+// directory and arguments follow it as NUL terminated strings
+struct launchRequest
+{
+    int numArgs;                    // number of arguments after the directory
+    int hasInput;                   // a descriptor for stdin is attached
+    int hasOutput;                  // a descriptor for stdout is attached
+    pid_t pgid;                     // process group to join, 0 for a new one,
+                                    // or -1 to stay in the shell's
+    int hasJobSignals;              // restore job control signals to default
+};
+
+// the launcher helper's answer to a request
+struct launchReply
+{
+    pid_t pid;                      // process started, or -1
+    int error;                      // errno if the program could not be run
+};
+
+// how background processes are given CPUs
+enum placePolicy
+{
+    PLACE_NONE,                 // anywhere in the CPUs they may use
+    PLACE_ROUND_ROBIN,          // one CPU each, taking the CPUs in turn
+    PLACE_LEAST_LOADED          // one CPU each, the one with fewest of them
+};
+
+// where spawned processes may run, set by the placement built in
+struct placement
+{
+    enum placePolicy policy;        // how background processes get CPUs
+    bool isOn;                      // any placement is being done
+    cpu_set_t jobCpus;              // CPUs background processes may use
+    cpu_set_t fgCpus;               // CPUs kept for the foreground
+    bool hasFgCpus;                 // fgCpus was given
+    int node;                       // NUMA node the CPUs are taken from
+    bool hasNode;                   // node was given
+    int next;                       // CPU the next search starts from
+    int numPlaced[CPU_SETSIZE];     // live background processes on each CPU
+};
+
+// a client of the server started by --listen
+struct client
+{
+    int fd;                         // the client's connection
+    pid_t pid;                      // session running its commands, or 0
+    int pidfd;                      // pidfd for the session, or -1
+    struct client *prev;            // previous client
+    struct client *next;            // next client
+};
+
+// a command name resolved against PATH
+struct pathEntry
+{
+    char *name;                     // command name as typed
+    char *path;                     // full path of the program
+    char *dir;                      // PATH directory it was found in
+    struct timespec dirTime;        // modification time of dir when found
+    unsigned long hits;             // times the entry has been used
+    struct pathEntry *next;         // next entry in the same bucket
+};
+
+// programs found by searching PATH, hashed by command name
+struct pathCache
+{
+    struct pathEntry **buckets;     // entries hashed by name
+    size_t numBuckets;              // size of the bucket array
+    size_t numEntries;              // entries in the cache
+    char *pathValue;                // PATH the entries were found under
+};
+
+// buffered input that lets the shell wait for a line and for finished
+// children at the same time
+struct lineReader
+{
+    int fd;                         // descriptor lines are read from
+    char *buffer;                   // data read but not yet returned
+    size_t size;                    // capacity of buffer
+    size_t start;                   // first byte not yet returned
+    size_t end;                     // one past the last byte read
+    bool isMapped;                  // buffer is a mapping of a script file
+    bool isComplete;                // nothing is left to read past end
+    char *line;                     // a line pieced together across reads
+    size_t lineSize;                // capacity of line
+};
+
+
+// memory for parsed commands, handed out in large blocks and freed at once
+struct arenaBlock
+{
+    struct arenaBlock *next;    // block used before this one
+    size_t size;                // bytes in data
+    size_t used;                // bytes of data handed out
+    char data[];                // the memory itself
+};
+
+struct arena
+{
+    struct arenaBlock *blocks;  // newest block first
+};
+
+// kinds of token read from the input
+enum tokenType
+{
+    TOKEN_WORD,                 // a word, which may be a keyword
+    TOKEN_NEWLINE,              // end of a line
+    TOKEN_SEMI,                 // ;
+    TOKEN_AND,                  // &&
+    TOKEN_OR,                   // ||
+    TOKEN_PIPE,                 // |
+    TOKEN_LESS,                 // <
+    TOKEN_GREAT,                // >
+    TOKEN_HEREDOC,              // << or <<-
+    TOKEN_HERESTRING,           // <<<
+    TOKEN_AMP,                  // &
+    TOKEN_END                   // end of input
+};
+
+// bytes being written to or read from the script cache
+struct byteBuffer
+{
+    char *data;                     // the bytes
+    size_t length;                  // bytes written, or bytes available
+    size_t size;                    // capacity when writing
+    size_t pos;                     // next byte when reading
+    bool hasError;                  // out of memory, or bad data
+};
+
+// the names in one directory, kept while its mtime stays the same
+struct dirListing
+{
+    dev_t dev;                      // device of the directory
+    ino_t ino;                      // inode of the directory
+    struct timespec mtime;          // when it last changed, at the scan
+    struct byteBuffer names;        // a type byte and a name for each entry
+    struct dirListing *next;        // next listing in the same bucket
+};
+
+// directories read for file name patterns, looked up by device and inode
+struct dirCache
+{
+    struct dirListing *buckets[MIN_BUCKETS];
+    int numListings;                // listings in the buckets
+};
+
+// one saved result in the cache directory, when trimming it to size
+struct resultEntry
+{
+    char name[32];                  // file name in the results directory
+    struct timespec usedAt;         // last run or replayed, from its mtime
+    long long size;                 // bytes in the file
+};
+
+// a here-document whose body is still to be read, after its line
+struct heredoc
+{
+    char *delimiter;                // the line that ends the body
+    char **target;                  // where the body goes
+    struct pipeline *pl;            // pipeline it belongs to, once copied
+    bool isStripped;                // <<- drops leading tabs from each line
+};
+
+// state of the parser: the token it is looking at, and scratch space for
+// the command being built
+struct parser
+{
+    struct lineReader *reader;      // where lines come from
+    struct arena *arena;            // holds the nodes and words parsed
+    bool isInteractive;             // prompt for continuation lines
+    int numLines;                   // lines read for the current command
+    char *p;                        // next character of the line, or NULL
+    bool hasToken;                  // a token was read but not yet used
+    enum tokenType type;            // that token
+    char *word;                     // its text, for TOKEN_WORD
+    size_t length;                  // length of its text
+    bool hasError;                  // an error was reported
+    bool isAtEnd;                   // the input has ended
+    int depth;                      // if, while and for not yet closed
+    char *words[MAX_ARGS + MAX_STAGES]; // argv of the pipeline being parsed
+    struct command stages[MAX_STAGES]; // stages of the pipeline being parsed
+    struct heredoc heredocs[MAX_STAGES]; // here-documents on the current line
+    int numHeredocs;                // entries in heredocs
+    struct byteBuffer body;         // a here-document being read
+};
+
+// state of the expander, kept from one command to the next so that
+// expanding a line needs no new memory once it has warmed up
+struct expander
+{
+    struct arena arena;             // words of the last pipeline expanded
+    char *text;                     // the field being built
+    size_t length;                  // bytes in text
+    size_t size;                    // capacity of text
+    bool hasField;                  // text is a field, even if empty
+    bool isGlobbed;                 // fields are matched against file names
+    char **fields;                  // words finished so far
+    int numFields;                  // entries in fields
+    int fieldsSize;                 // capacity of fields
+    struct byteBuffer output;       // what a $(command) printed
+};
+
 
 // declare global variables
-int completed_cur = 0;
-int cur = 0;                   // index to add next bg process in bgpid[]
 int signalNum = 0;
-pid_t bgpid[MAX_PIDS];         // array of open background process IDs
-pid_t completed_pid[MAX_PIDS]; // array of completed bg process IDs
-pid_t fgpid = INT_MAX;         // running foreground process
+int numFgPids = 0;             // number of entries in fgpid[]
+int fgPidfd[MAX_STAGES];       // pidfds for the entries in fgpid[]
+pid_t fgpid[MAX_STAGES];       // running foreground pipeline
+struct jobTable jobs;          // open background jobs
+struct pathCache pathCache;    // resolved command paths
+struct lineReader inputReader; // buffered commands to run
+struct usageHistory usageHistory; // resources used by finished jobs
+struct traceLog traceLog;      // where the shell's time goes, if tracing
+struct placement placement;    // CPUs for spawned processes, if pinned
+struct usage fgUsage;          // resources used by the last fg pipeline
+struct deadline fgLimit;       // time limit on the fg pipeline, if any
+bool isFgTimedOut = false;     // the last fg pipeline ran out of time
+int launcherFd = -1;           // socket to the launcher helper, if running
+bool isJobControl = false;     // jobs get the terminal and can be stopped
+int ttyFd = -1;                // the terminal, when isJobControl
+pid_t shellPgid;               // the shell's own process group
+pid_t fgPgid = 0;              // process group of the fg job, or 0 if it
+                               // runs in the shell's group
+struct termios shellModes;     // the shell's terminal settings
+pid_t originalPgid = 0;        // group that had the terminal before the shell
+int lastStatus = 0;            // wait status of the last fg command
+pid_t shellPid;                // the value of $$, the same in a $(command)
+int maxJobs = 0;               // background jobs run at once: 0 for no limit,
+                               // or -1 to follow the CPUs and the load
+volatile sig_atomic_t isInterrupted = 0; // SIGINT arrived during a command
+bool isExiting = false;        // the exit command has run
+bool isEnvironChanged = false; // the environment differs from the launcher's
+struct sigaction foreground_act;    // kills the fg pipeline on SIGINT
+struct sigaction restOfTheTime_act; // ignores SIGINT the rest of the time
+struct expander expander;      // expands $ in the words of a command
+struct dirCache dirCache;      // directories matched against patterns
+
+// the commands runPipeline() runs itself rather than as a program; timeout
+// is a prefix on a command that is run, so it is not one of them
+const char *builtins[] = { "exit", "cd", "jobs", "fg", "bg", "hash", "status",
+                           "parallel", "times", "trace", "maxjobs",
+                           "placement", "cached", NULL };
 
 
 
 /******************************************************************************
- ** Function:          bgHandler()
- ** Description:       This function handles SIGCHLD signals. If the signal is
- **                    received from a background child process, its PID is 
- **                    stored in an array so it can be cleaned up at an
- **                    appropriate point later in the program.   
- ** Parameters:        one int: sig,
- **                    one pointer to type siginfo_t: info,
- **                    one pointer to a function: vp  
- ** Pre-Conditions:    a sigaction struct is initialized and this function is
- **                    set as the sa_sigaction value. SA_INFO must be 
- **                    included in sa_flags for the struct. completed_pid[] is
- **                    a global array of type pid_t and completed_cur is a
- **                    global variable of type INT that points to the index
- **                    to write the next PID to. fgpid is a global variable of
- **                    type INT with the PID of the current foreground child
- **                    process (if any) or set to INT_MAX otherwise    
- ** Post-Conditions:   the SIGCHLD signal has been captured and the PID of the
- **                    referring process has been added to completed_pid[] at
- **                    the index with the value of completed_cur 
- **                     
+ ** Function:          reapChildren()
+ ** Description:       This function cleans up every background process that
+ **                    has finished. Each process is watched through its pidfd
+ **                    in the job table's epoll set, so one epoll_wait returns
+ **                    every finished process however many jobs are running,
+ **                    and a PID is never waited on after it could have been
+ **                    reused. When the last process of a background job is
+ **                    reaped, its PID and exit status are printed, and all
+ **                    notices from one call are flushed together.
+ ** Parameters:        none
+ ** Pre-Conditions:    jobs.epollFd holds the pidfd of every background process
+ ** Post-Conditions:   finished children have been reaped, finished jobs
+ **                    removed from the job table, and the number of notices
+ **                    printed is returned
+ ******************************************************************************/
+int reapChildren();
+
+
+
+/******************************************************************************
+ ** Function:          readLine()
+ ** Description:       This function reads one line of input. A line that is
+ **                    all in the reader's buffer is returned in place, with
+ **                    its newline replaced by a NUL; one that spans reads is
+ **                    gathered in a buffer that grows as needed, so lines
+ **                    have no length limit. While it waits it also polls the
+ **                    job table's epoll set of pidfds, so background jobs
+ **                    that finish are reported right away; the prompt is
+ **                    printed again after such notices.
+ ** Parameters:        one pointer to struct lineReader: reader,
+ **                    one pointer to const char: prompt
+ ** Pre-Conditions:    reader was set up by openReader(). prompt is NULL if
+ **                    no prompt is being shown
+ ** Post-Conditions:   returns the NUL terminated line without its newline,
+ **                    valid until the next call, or NULL at end of input
+ ******************************************************************************/
+char *readLine(struct lineReader *reader, const char *prompt);
+
+
+
+/******************************************************************************
+ ** Function:          openReader()
+ ** Description:       This function sets up a reader for the shell's
+ **                    commands. A -c command string is copied into the
+ **                    buffer, and a script file is mapped into memory whole,
+ **                    so neither is read a line at a time. Any other input,
+ **                    such as a terminal or pipe, is read in large blocks.
+ ** Parameters:        one pointer to struct lineReader: reader,
+ **                    one int: fd,
+ **                    one pointer to const char: text
+ ** Pre-Conditions:    fd is the descriptor to read, or -1 if text holds the
+ **                    commands
+ ** Post-Conditions:   returns 0 if the reader is ready, or -1 if memory for
+ **                    it could not be allocated
  ******************************************************************************/
-void bgHandler(int sig, siginfo_t* info, void* vp);
+int openReader(struct lineReader *reader, int fd, const char *text);
 
 
 
@@ -77,565 +583,10247 @@ void bgHandler(int sig, siginfo_t* info, void* vp);
  ** Function:          sigintHandler()
  ** Description:       This function handles interrupt signals (SIGINT/cntl + C)
  **                    that occur while the program is running. If the signal
- **                    occurs while a foreground child process is running, the
- **                    function kills it and sets a flag so that an appropriate
- **                    message can be displayed in the main function. Signals
- **                    from other processes are ignored. 
+ **                    occurs while a foreground pipeline is running, the
+ **                    function kills every process in it (with one kill of
+ **                    its process group when it has one) and sets a flag so
+ **                    that an appropriate message can be displayed in the
+ **                    main function. It also flags the interrupt so that the
+ **                    rest of a list or loop is not run. Signals from other
+ **                    processes are ignored.
  ** Parameters:        none
  ** Pre-Conditions:    a sigaction struct is initialized and this function is
- **                    set as the sa_handler. fgpid and signalNum are global
- **                    variables of type INT  
- ** Post-Conditions:   the SIGINT has been captured and the foreground process
- **                    (if any) has been killed  
+ **                    set as the sa_handler. fgPgid, or else fgPidfd[] and
+ **                    numFgPids, describe the foreground pipeline, and signalNum is a global
+ **                    variable of type INT
+ ** Post-Conditions:   the SIGINT has been captured and the foreground processes
+ **                    (if any) have been killed
  ******************************************************************************/
 void sigintHandler();
 
 
 
-int main(int argc, char** argv)
-{
-    // declare variables
-    bool isBackgroundProcess = false;
-    bool repeat = true;
-    char *args[MAX_ARGS + 1];
-    char input[MAX_LENGTH];
-    char *token;
-    pid_t cpid;
-    int bgExitStatus;
-    int bgStatus; 
-    int exitStatus;
-    int fd;
-    int fd2;
-    int i;
-    int j;
-    int numArgs;
-    int status;
+/******************************************************************************
+ ** Function:          openParser()
+ ** Description:       This function sets up a parser that reads commands
+ **                    from a line reader and keeps what it parses in an
+ **                    arena.
+ ** Parameters:        one pointer to struct parser: ps,
+ **                    one pointer to struct lineReader: reader,
+ **                    one pointer to struct arena: arena,
+ **                    one bool: isInteractive
+ ** Pre-Conditions:    reader was set up by openReader()
+ ** Post-Conditions:   ps is ready for parseCommand()
+ ******************************************************************************/
+void openParser(struct parser *ps, struct lineReader *reader, struct arena *arena, bool isInteractive);
 
-    // create instance of sigaction struct for background processes
-    struct sigaction background_act;
-    background_act.sa_sigaction = bgHandler;     
-    background_act.sa_flags = SA_SIGINFO|SA_RESTART;
-    sigfillset(&(background_act.sa_mask));
-    // set up signal handler for completed child process
-    sigaction(SIGCHLD, &background_act, NULL);
 
-    // create instance of sigaction struct for foreground processes
-    struct sigaction foreground_act;
-    foreground_act.sa_handler = sigintHandler;
-    foreground_act.sa_flags = SA_RESTART;
-    sigfillset(&(foreground_act.sa_mask));
-    sigaction(SIGINT, &foreground_act, NULL); 
 
-    // create sigaction struct to ignore interrupts the rest of the time
-    struct sigaction restOfTheTime_act;
-    restOfTheTime_act.sa_handler = SIG_IGN;
-    restOfTheTime_act.sa_flags = SA_RESTART;
-    sigfillset(&(restOfTheTime_act.sa_mask));
-    sigaction(SIGINT, &restOfTheTime_act, NULL); 
+/******************************************************************************
+ ** Function:          parseCommand()
+ ** Description:       This function parses one complete command: the
+ **                    commands on one line joined by ; && and ||, along with
+ **                    any if, while or for commands that start on it, reading
+ **                    more lines until they are closed. Each line is lexed
+ **                    once; words are copied into the arena and the result is
+ **                    a tree of nodes that can be run any number of times.
+ **                    Operators are separate words as in the original smallsh
+ **                    grammar, except that ; also ends a word. A word starting
+ **                    with # where a command would begin starts a comment.
+ ** Parameters:        one pointer to struct parser: ps
+ ** Pre-Conditions:    ps was set up by openParser()
+ ** Post-Conditions:   returns the list of commands, or NULL for a blank line,
+ **                    a syntax error (ps->hasError, after printing it and
+ **                    dropping the rest of the line) or the end of input
+ **                    (ps->isAtEnd)
+ ******************************************************************************/
+struct node *parseCommand(struct parser *ps);
+
+
+
+/******************************************************************************
+ ** Function:          parseList()
+ ** Description:       This function parses commands separated by ; or
+ **                    newlines. At the top level the list ends with the line;
+ **                    inside if, while and for it ends at the keyword that
+ **                    closes the part being parsed.
+ ** Parameters:        one pointer to struct parser: ps,
+ **                    one bool: isTopLevel
+ ** Pre-Conditions:    ps is at the start of a command
+ ** Post-Conditions:   returns the commands chained by next, or NULL if there
+ **                    were none or an error was reported
+ ******************************************************************************/
+struct node *parseList(struct parser *ps, bool isTopLevel);
+
+
+
+/******************************************************************************
+ ** Function:          parseAndOr()
+ ** Description:       This function parses pipelines joined by && and ||,
+ **                    which group from the left. A newline may follow either
+ **                    operator.
+ ** Parameters:        one pointer to struct parser: ps
+ ** Pre-Conditions:    ps is at the start of a command
+ ** Post-Conditions:   returns the command, or NULL if an error was reported
+ ******************************************************************************/
+struct node *parseAndOr(struct parser *ps);
+
+
+
+/******************************************************************************
+ ** Function:          parsePipeline()
+ ** Description:       This function parses an if, while or for command, or
+ **                    a pipeline of simple commands. A | ends one stage and
+ **                    starts the next. The redirection operators < and > may
+ **                    appear anywhere in a stage and take the following word
+ **                    as their target, and an & at the end of the pipeline
+ **                    runs it in the background; an & anywhere else is an
+ **                    ordinary argument.
+ ** Parameters:        one pointer to struct parser: ps
+ ** Pre-Conditions:    ps is at the start of a command
+ ** Post-Conditions:   returns the command, or NULL if an error was reported
+ ******************************************************************************/
+struct node *parsePipeline(struct parser *ps);
+
+
+
+/******************************************************************************
+ ** Function:          parseIf()
+ ** Description:       This function parses the rest of an if command after
+ **                    its if (or elif) keyword. An elif becomes an if nested
+ **                    in the else part.
+ ** Parameters:        one pointer to struct parser: ps
+ ** Pre-Conditions:    the if or elif keyword has been used
+ ** Post-Conditions:   returns the command, or NULL if an error was reported
+ ******************************************************************************/
+struct node *parseIf(struct parser *ps);
+
+
+
+/******************************************************************************
+ ** Function:          parseLoop()
+ ** Description:       This function parses the rest of a while or for
+ **                    command after its keyword.
+ ** Parameters:        one pointer to struct parser: ps,
+ **                    one enum nodeType: type
+ ** Pre-Conditions:    the while or for keyword has been used and type is
+ **                    NODE_WHILE or NODE_FOR to match
+ ** Post-Conditions:   returns the command, or NULL if an error was reported
+ ******************************************************************************/
+struct node *parseLoop(struct parser *ps, enum nodeType type);
+
+
+
+/******************************************************************************
+ ** Function:          peekToken()
+ ** Description:       This function returns the next token without using it
+ **                    up, reading another line when the current one is done.
+ **                    Lines after the first line of a command are prompted
+ **                    for with > when the shell is interactive.
+ ** Parameters:        one pointer to struct parser: ps
+ ** Pre-Conditions:    ps was set up by openParser()
+ ** Post-Conditions:   returns the token type; ps->word and ps->length give
+ **                    the text of a word
+ ******************************************************************************/
+enum tokenType peekToken(struct parser *ps);
+
+
+
+/******************************************************************************
+ ** Function:          takeToken()
+ ** Description:       This function uses up the token peekToken() returned.
+ ** Parameters:        one pointer to struct parser: ps
+ ** Pre-Conditions:    peekToken() was called
+ ** Post-Conditions:   the next peekToken() moves on to the following token
+ ******************************************************************************/
+void takeToken(struct parser *ps);
+
+
+
+/******************************************************************************
+ ** Function:          isKeyword()
+ ** Description:       This function checks whether the next token is the
+ **                    given word.
+ ** Parameters:        one pointer to struct parser: ps,
+ **                    one pointer to const char: keyword
+ ** Pre-Conditions:    ps was set up by openParser()
+ ** Post-Conditions:   returns true if the next token is that word
+ ******************************************************************************/
+bool isKeyword(struct parser *ps, const char *keyword);
+
+
+
+/******************************************************************************
+ ** Function:          isCloser()
+ ** Description:       This function checks whether the next token is one of
+ **                    the words that end part of an if, while or for: then,
+ **                    else, elif, fi, do and done.
+ ** Parameters:        one pointer to struct parser: ps
+ ** Pre-Conditions:    ps was set up by openParser()
+ ** Post-Conditions:   returns true if it is
+ ******************************************************************************/
+bool isCloser(struct parser *ps);
+
+
+
+/******************************************************************************
+ ** Function:          expectKeyword()
+ ** Description:       This function uses up the keyword that must come next,
+ **                    after checking that the part it closes was not empty.
+ ** Parameters:        one pointer to struct parser: ps,
+ **                    one pointer to const char: keyword,
+ **                    one pointer to struct node: part
+ ** Pre-Conditions:    part is the list just parsed
+ ** Post-Conditions:   returns 0, or -1 after reporting a syntax error
+ ******************************************************************************/
+int expectKeyword(struct parser *ps, const char *keyword, struct node *part);
+
+
+
+/******************************************************************************
+ ** Function:          parseError()
+ ** Description:       This function reports a parse error, unless one has
+ **                    already been reported for the current command. With
+ **                    no message it names the token the error was found at.
+ ** Parameters:        one pointer to struct parser: ps,
+ **                    one pointer to const char: message
+ ** Pre-Conditions:    message is NULL for a syntax error at the next token
+ ** Post-Conditions:   ps->hasError is true
+ ******************************************************************************/
+void parseError(struct parser *ps, const char *message);
+
+
+
+/******************************************************************************
+ ** Function:          readHeredocs()
+ ** Description:       This function reads the bodies of the here-documents
+ **                    started on the line just parsed, from the lines that
+ **                    follow it, each up to a line holding only its
+ **                    delimiter.
+ ** Parameters:        one pointer to struct parser: ps
+ ** Pre-Conditions:    the line with the << on it is used up
+ ** Post-Conditions:   each body is in the arena where its command will find
+ **                    it, and no here-documents are waiting
+ ******************************************************************************/
+void readHeredocs(struct parser *ps);
+
+
+
+/******************************************************************************
+ ** Function:          parseSimple()
+ ** Description:       This function parses a pipeline of simple commands,
+ **                    with the same rules and messages the shell has always
+ **                    used for one line, and copies it into the arena.
+ ** Parameters:        one pointer to struct parser: ps
+ ** Pre-Conditions:    the next token starts a simple command
+ ** Post-Conditions:   returns the pipeline node, or NULL if an error was
+ **                    reported
+ ******************************************************************************/
+struct node *parseSimple(struct parser *ps);
+
+
+
+/******************************************************************************
+ ** Function:          addWord()
+ ** Description:       This function copies a word into the arena and adds it
+ **                    to the arguments of a stage being parsed.
+ ** Parameters:        one pointer to struct parser: ps,
+ **                    one pointer to struct command: stage,
+ **                    one pointer to const char: text,
+ **                    one size_t: length
+ ** Pre-Conditions:    stage->argv has room for another word
+ ** Post-Conditions:   returns 0, or -1 after reporting an error
+ ******************************************************************************/
+int addWord(struct parser *ps, struct command *stage, const char *text, size_t length);
+
+
+
+/******************************************************************************
+ ** Function:          newNode()
+ ** Description:       This function makes an empty node in the arena.
+ ** Parameters:        one pointer to struct parser: ps,
+ **                    one enum nodeType: type
+ ** Pre-Conditions:    none
+ ** Post-Conditions:   returns the node, or NULL after reporting an error
+ ******************************************************************************/
+struct node *newNode(struct parser *ps, enum nodeType type);
+
+
+
+/******************************************************************************
+ ** Function:          arenaAlloc()
+ ** Description:       This function hands out memory from an arena, adding a
+ **                    new block when the current one is full.
+ ** Parameters:        one pointer to struct arena: arena,
+ **                    one size_t: size
+ ** Pre-Conditions:    arena has been zeroed or cleared
+ ** Post-Conditions:   returns zeroed memory aligned for any type, or NULL if
+ **                    memory ran out
+ ******************************************************************************/
+void *arenaAlloc(struct arena *arena, size_t size);
+
+
+
+/******************************************************************************
+ ** Function:          arenaString()
+ ** Description:       This function copies a string into an arena.
+ ** Parameters:        one pointer to struct arena: arena,
+ **                    one pointer to const char: text,
+ **                    one size_t: length
+ ** Pre-Conditions:    text has at least length characters
+ ** Post-Conditions:   returns the NUL terminated copy, or NULL
+ ******************************************************************************/
+char *arenaString(struct arena *arena, const char *text, size_t length);
+
+
+
+/******************************************************************************
+ ** Function:          clearArena()
+ ** Description:       This function releases everything handed out by an
+ **                    arena, keeping its first block for reuse.
+ ** Parameters:        one pointer to struct arena: arena
+ ** Pre-Conditions:    nothing in the arena is still in use
+ ** Post-Conditions:   the arena is empty
+ ******************************************************************************/
+void clearArena(struct arena *arena);
+
+
+
+/******************************************************************************
+ ** Function:          needsExpansion()
+ ** Description:       This function checks whether any word or file name of
+ **                    a pipeline has a $ in it, or any word a file name
+ **                    pattern, so that pipelines without one skip expansion
+ **                    altogether when they are run.
+ ** Parameters:        one pointer to struct pipeline: pl
+ ** Pre-Conditions:    pl was parsed or read from the script cache
+ ** Post-Conditions:   returns true if the pipeline has something to expand
+ ******************************************************************************/
+bool needsExpansion(struct pipeline *pl);
+
+
+
+/******************************************************************************
+ ** Function:          expandPipeline()
+ ** Description:       This function expands $$, $?, $NAME and $(command) in
+ **                    every word of a pipeline, filling in a copy of it so
+ **                    the parsed one can be run again. Expansions in words
+ **                    are split into separate arguments at blanks, and one
+ **                    that comes to nothing leaves no argument; file names
+ **                    and here-documents are not split. The words live in the expander's arena
+ **                    until the next pipeline is expanded.
+ ** Parameters:        one pointer to struct pipeline: pl,
+ **                    one pointer to struct pipeline: expanded,
+ **                    one pointer to struct command: stages
+ ** Pre-Conditions:    stages has room for pl->numStages commands
+ ** Post-Conditions:   returns 0 with expanded filled in, or -1 after printing
+ **                    an error
+ ******************************************************************************/
+int expandPipeline(struct pipeline *pl, struct pipeline *expanded, struct command *stages);
+
+
+
+/******************************************************************************
+ ** Function:          expandWords()
+ ** Description:       This function expands a list of words into the
+ **                    arguments they become, which may be more or fewer than
+ **                    the words themselves.
+ ** Parameters:        one pointer to struct arena: arena,
+ **                    one pointer to pointer to char: words,
+ **                    one pointer to int: numWords
+ ** Pre-Conditions:    words has *numWords entries
+ ** Post-Conditions:   returns the arguments, ending with NULL, with their
+ **                    number in *numWords; words itself if none of them has
+ **                    a $ or a pattern. Returns NULL if out of memory or
+ **                    interrupted
+ ******************************************************************************/
+char **expandWords(struct arena *arena, char **words, int *numWords);
+
+
+
+/******************************************************************************
+ ** Function:          expandWord()
+ ** Description:       This function expands one word in a single pass from
+ **                    left to right, adding the arguments it becomes to
+ **                    expander.fields. A word with no $ is added as it is,
+ **                    without being copied. When split, each field with a
+ **                    pattern in it is replaced by the file names it
+ **                    matches.
+ ** Parameters:        one pointer to struct arena: arena,
+ **                    one pointer to const char: word,
+ **                    one bool: isSplit
+ ** Pre-Conditions:    the caller has set expander.numFields
+ ** Post-Conditions:   returns 0, or -1 if out of memory; the new fields are
+ **                    allocated from arena. Without isSplit the word always
+ **                    adds exactly one field
+ ******************************************************************************/
+int expandWord(struct arena *arena, const char *word, bool isSplit);
+
+
+
+/******************************************************************************
+ ** Function:          addText()
+ ** Description:       This function adds text to the field being built. Text
+ **                    that came from an expansion may be split at blanks,
+ **                    ending the field at each run of them.
+ ** Parameters:        one pointer to struct arena: arena,
+ **                    one pointer to const char: text,
+ **                    one size_t: length,
+ **                    one bool: isSplit
+ ** Pre-Conditions:    none
+ ** Post-Conditions:   returns 0, or -1 if out of memory
+ ******************************************************************************/
+int addText(struct arena *arena, const char *text, size_t length, bool isSplit);
+
+
+
+/******************************************************************************
+ ** Function:          endField()
+ ** Description:       This function copies the field being built into the
+ **                    arena and adds it to expander.fields.
+ ** Parameters:        one pointer to struct arena: arena
+ ** Pre-Conditions:    expander.text holds the field
+ ** Post-Conditions:   returns 0, or -1 if out of memory; the field is empty
+ **                    again
+ ******************************************************************************/
+int endField(struct arena *arena);
+
+
+
+/******************************************************************************
+ ** Function:          addField()
+ ** Description:       This function adds one finished word to
+ **                    expander.fields, growing it as needed. The array is
+ **                    kept from one command to the next.
+ ** Parameters:        one pointer to char: field
+ ** Pre-Conditions:    field stays valid as long as the fields are used
+ ** Post-Conditions:   returns 0, or -1 if out of memory
+ ******************************************************************************/
+int addField(char *field);
+
+
+
+/******************************************************************************
+ ** Function:          hasPattern()
+ ** Description:       This function checks whether a word has a *, ? or [ in
+ **                    it, and so may be a file name pattern.
+ ** Parameters:        one pointer to const char: text
+ ** Pre-Conditions:    text is a string
+ ** Post-Conditions:   returns true if the word should be matched against
+ **                    file names
+ ******************************************************************************/
+bool hasPattern(const char *text);
+
+
+
+/******************************************************************************
+ ** Function:          globField()
+ ** Description:       This function adds the file names a pattern matches to
+ **                    expander.fields, sorted by byte value as the C locale
+ **                    would. A pattern is matched one component between
+ **                    slashes at a time, so only the directories on the way
+ **                    to a match are read. A pattern that matches nothing is
+ **                    added as it is, as other shells do.
+ ** Parameters:        one pointer to struct arena: arena,
+ **                    one pointer to char: pattern
+ ** Pre-Conditions:    pattern stays valid as long as the fields are used
+ ** Post-Conditions:   returns 0, or -1 if out of memory; the names are
+ **                    allocated from arena
+ ******************************************************************************/
+int globField(struct arena *arena, char *pattern);
+
+
+
+/******************************************************************************
+ ** Function:          globPath()
+ ** Description:       This function matches the rest of a pattern below the
+ **                    directory in path, adding each whole match to
+ **                    expander.fields. A component without a pattern in it
+ **                    is taken as it is, and only the last one is checked
+ **                    for existence. Names beginning with . match only a
+ **                    component that begins with one too.
+ ** Parameters:        one pointer to struct arena: arena,
+ **                    one pointer to char: path,
+ **                    one size_t: length,
+ **                    one pointer to const char: rest
+ ** Pre-Conditions:    path has room for PATH_MAX bytes and holds length of
+ **                    them, ending in a / unless empty
+ ** Post-Conditions:   returns 0, or -1 if out of memory
+ ******************************************************************************/
+int globPath(struct arena *arena, char *path, size_t length, const char *rest);
+
+
+
+/******************************************************************************
+ ** Function:          matchName()
+ ** Description:       This function matches one name against one component
+ **                    of a pattern. A mismatch after a * goes back only to
+ **                    the last *, letting it take one more character, which
+ **                    is enough for patterns within a component and keeps
+ **                    the time linear in both lengths for each *, with no
+ **                    backtracking through earlier ones.
+ ** Parameters:        one pointer to const char: pattern,
+ **                    one pointer to const char: patternEnd,
+ **                    one pointer to const char: name
+ ** Pre-Conditions:    the component runs from pattern up to patternEnd
+ ** Post-Conditions:   returns true if the whole name matches
+ ******************************************************************************/
+bool matchName(const char *pattern, const char *patternEnd, const char *name);
+
+
+
+/******************************************************************************
+ ** Function:          matchChar()
+ ** Description:       This function matches one character of a name against
+ **                    the ?, [...] or plain character at the start of a
+ **                    pattern. A bracket expression may hold ranges, begin
+ **                    with ! or ^ to match what it does not list, and take a
+ **                    ] right after its opening as a member; a [ that is
+ **                    never closed is a plain character.
+ ** Parameters:        one pointer to const char: pattern,
+ **                    one pointer to const char: patternEnd,
+ **                    one char: c
+ ** Pre-Conditions:    pattern is before patternEnd and not at a *
+ ** Post-Conditions:   returns the rest of the pattern after what matched, or
+ **                    NULL if c does not match
+ ******************************************************************************/
+const char *matchChar(const char *pattern, const char *patternEnd, char c);
+
+
+
+/******************************************************************************
+ ** Function:          listDirectory()
+ ** Description:       This function returns the names in a directory, read
+ **                    in large batches with getdents64. Listings are kept by
+ **                    device and inode, and one is read again only when the
+ **                    directory's mtime has changed since, so matching the
+ **                    same directory again costs one stat. The directory is
+ **                    stat'ed before it is read, so a change made during the
+ **                    read is caught the next time.
+ ** Parameters:        one pointer to const char: dir
+ ** Pre-Conditions:    none
+ ** Post-Conditions:   returns the listing, which stays valid until the next
+ **                    call, or NULL if dir cannot be read
+ ******************************************************************************/
+struct dirListing *listDirectory(const char *dir);
+
+
+
+/******************************************************************************
+ ** Function:          clearDirCache()
+ ** Description:       This function frees every directory listing kept for
+ **                    file name patterns.
+ ** Parameters:        none
+ ** Pre-Conditions:    none
+ ** Post-Conditions:   dirCache is empty
+ ******************************************************************************/
+void clearDirCache();
+
+
+
+/******************************************************************************
+ ** Function:          compareNames()
+ ** Description:       This function orders two file names by byte value,
+ **                    for qsort.
+ ** Parameters:        one pointer to const void: a,
+ **                    one pointer to const void: b
+ ** Pre-Conditions:    a and b point to pointers to char
+ ** Post-Conditions:   returns less than, equal to, or greater than zero
+ ******************************************************************************/
+int compareNames(const void *a, const void *b);
+
+
+
+/******************************************************************************
+ ** Function:          captureOutput()
+ ** Description:       This function runs the command of a $(command) in a new
+ **                    copy of the shell and reads what it prints through a
+ **                    pipe into expander.output, which grows as needed and
+ **                    is reused. The copy is passed this shell's $$ and $?,
+ **                    so they expand inside as they would outside. Trailing
+ **                    newlines are dropped, as other shells do. An interrupt
+ **                    kills the command.
+ ** Parameters:        one pointer to const char: text
+ ** Pre-Conditions:    text is the command between the parentheses
+ ** Post-Conditions:   returns the number of bytes in expander.output, or -1
+ **                    if out of memory
+ ******************************************************************************/
+ssize_t captureOutput(const char *text);
+
+
+
+/******************************************************************************
+ ** Function:          runList()
+ ** Description:       This function runs a list of parsed commands. && runs
+ **                    its second command only if the first succeeded and ||
+ **                    only if it failed; if, while and for choose and repeat
+ **                    their parts from the exit status of the conditions. The
+ **                    tree is not changed, so loop bodies run again without
+ **                    being parsed again. An interrupt or the exit command
+ **                    stops the whole list.
+ ** Parameters:        one pointer to struct node: node
+ ** Pre-Conditions:    node came from parseCommand(), or is NULL
+ ** Post-Conditions:   returns the wait status of the last command run
+ ******************************************************************************/
+int runList(struct node *node);
+
+
+
+/******************************************************************************
+ ** Function:          runPipeline()
+ ** Description:       This function runs one pipeline: a built in command,
+ **                    a simple command run in the shell, or programs started
+ **                    in the foreground or background.
+ ** Parameters:        one pointer to struct pipeline: pl
+ ** Pre-Conditions:    pl came from the parser
+ ** Post-Conditions:   returns the wait status of the pipeline (0 for a
+ **                    background job that started), which is also kept in
+ **                    lastStatus for the status command unless pl was the
+ **                    status command or ran in the background
+ ******************************************************************************/
+int runPipeline(struct pipeline *pl);
+
+
+
+/******************************************************************************
+ ** Function:          startJobControl()
+ ** Description:       This function turns on job control for an interactive
+ **                    shell on a terminal. The shell waits until it is in the
+ **                    foreground, puts itself in its own process group, takes
+ **                    the terminal, and ignores the terminal's stop signals
+ **                    so that Ctrl-Z stops only the foreground job.
+ ** Parameters:        none
+ ** Pre-Conditions:    stdin is the terminal
+ ** Post-Conditions:   isJobControl is true if all of that worked
+ ******************************************************************************/
+void startJobControl();
+
+
+
+/******************************************************************************
+ ** Function:          giveTerminal()
+ ** Description:       This function makes a process group the terminal's
+ **                    foreground group, first putting back the terminal
+ **                    settings it had, if there are any.
+ ** Parameters:        one pid_t: pgid,
+ **                    one pointer to const struct termios: modes
+ ** Pre-Conditions:    isJobControl is true; modes may be NULL
+ ** Post-Conditions:   the group owns the terminal
+ ******************************************************************************/
+void giveTerminal(pid_t pgid, const struct termios *modes);
+
+
+
+/******************************************************************************
+ ** Function:          finishForeground()
+ ** Description:       This function reports how a foreground job ended: the
+ **                    signal that killed it after an interrupt, or that it
+ **                    ran out of time. A job that was killed by SIGINT from
+ **                    the terminal also stops the rest of the list it is in,
+ **                    as an interrupt caught by the shell would.
+ ** Parameters:        one int: status,
+ **                    one bool: isTimedOut
+ ** Pre-Conditions:    status is the wait status of the job's last process
+ ** Post-Conditions:   any message has been printed
+ ******************************************************************************/
+void finishForeground(int status, bool isTimedOut);
+
+
+
+/******************************************************************************
+ ** Function:          suspendForeground()
+ ** Description:       This function turns a foreground pipeline that was
+ **                    stopped with Ctrl-Z into a stopped job in the job table,
+ **                    keeping its terminal settings and what is left of its
+ **                    time limit, and reports it.
+ ** Parameters:        one pointer to type pid_t: pids,
+ **                    one int: numPids,
+ **                    one pointer to struct pipeline: pl,
+ **                    one long long: startNs
+ ** Pre-Conditions:    pids are the processes of the pipeline not yet reaped
+ **                    and fgPgid is its process group
+ ** Post-Conditions:   the job is in the table, or has been killed if it could
+ **                    not be added
+ ******************************************************************************/
+void suspendForeground(pid_t *pids, int numPids, struct pipeline *pl, long long startNs);
+
+
+
+/******************************************************************************
+ ** Function:          signalJob()
+ ** Description:       This function sends a signal to every process of a
+ **                    job, including any they have started, with one kill of
+ **                    the job's process group.
+ ** Parameters:        one pointer to struct job: job,
+ **                    one int: sig
+ ** Pre-Conditions:    job is in the job table
+ ** Post-Conditions:   the signal has been sent
+ ******************************************************************************/
+void signalJob(struct job *job, int sig);
+
+
+
+/******************************************************************************
+ ** Function:          markDone()
+ ** Description:       This function records that a process of a job has been
+ **                    reaped, closing its pidfd and adding up what it used.
+ ** Parameters:        one pointer to struct process: proc,
+ **                    one int: status,
+ **                    one pointer to const struct rusage: ru
+ ** Pre-Conditions:    proc was just reaped with status and ru
+ ** Post-Conditions:   proc is done and its job has one process fewer live
+ ******************************************************************************/
+void markDone(struct process *proc, int status, const struct rusage *ru);
+
+
+
+/******************************************************************************
+ ** Function:          pickJob()
+ ** Description:       This function finds the job named by the argument of
+ **                    fg or bg, a job number with or without a leading %. With
+ **                    no argument it picks the newest stopped job, or else the
+ **                    newest job.
+ ** Parameters:        one pointer to struct command: cmd
+ ** Pre-Conditions:    cmd is the fg or bg command
+ ** Post-Conditions:   returns the job, or NULL after printing an error
+ ******************************************************************************/
+struct job *pickJob(struct command *cmd);
+
+
+
+/******************************************************************************
+ ** Function:          fgBuiltin()
+ ** Description:       This function is the fg built in command. It gives the
+ **                    terminal to a job, continues it if it is stopped, and
+ **                    waits for it as a foreground job; it may be stopped
+ **                    again with Ctrl-Z.
+ ** Parameters:        one pointer to struct command: cmd,
+ **                    one pointer to bool: isTimedOut
+ ** Pre-Conditions:    cmd is the fg command
+ ** Post-Conditions:   returns the wait status of the job, which has been
+ **                    removed from the table unless it stopped again
+ ******************************************************************************/
+int fgBuiltin(struct command *cmd, bool *isTimedOut);
+
+
+
+/******************************************************************************
+ ** Function:          bgBuiltin()
+ ** Description:       This function is the bg built in command. It continues
+ **                    a stopped job in the background.
+ ** Parameters:        one pointer to struct command: cmd
+ ** Pre-Conditions:    cmd is the bg command
+ ** Post-Conditions:   returns 0 if a job was continued, or 1
+ ******************************************************************************/
+int bgBuiltin(struct command *cmd);
+
+
+
+/******************************************************************************
+ ** Function:          endJobs()
+ ** Description:       This function kills every background job the shell has
+ **                    started and waits for them, so none are left behind as
+ **                    zombies, when the shell exits.
+ ** Parameters:        none
+ ** Pre-Conditions:    none
+ ** Post-Conditions:   every background process has been killed and reaped
+ ******************************************************************************/
+void endJobs();
+
+
+
+/******************************************************************************
+ ** Function:          loadScript()
+ ** Description:       This function looks for a script's parsed commands in
+ **                    the cache directory named by SMALLSH_CACHE. An entry is
+ **                    used only if it was saved for the same path and the
+ **                    script still has the same device, inode, size and
+ **                    modification time.
+ ** Parameters:        one pointer to const char: fullPath,
+ **                    one pointer to const char: cachePath,
+ **                    one pointer to const struct stat: info,
+ **                    one pointer to struct arena: arena,
+ **                    one pointer to pointer to pointer to struct node: commands,
+ **                    one pointer to int: numCommands,
+ **                    one pointer to size_t: offset
+ ** Pre-Conditions:    both paths came from scriptCachePath() and info
+ **                    describes the open script
+ ** Post-Conditions:   returns 0 with the commands decoded into the arena and
+ **                    offset set to where parsing stopped, or -1 if there is
+ **                    no usable entry
+ ******************************************************************************/
+int loadScript(const char *fullPath, const char *cachePath, const struct stat *info,
+               struct arena *arena, struct node ***commands, int *numCommands,
+               size_t *offset);
+
+
+
+/******************************************************************************
+ ** Function:          saveScript()
+ ** Description:       This function saves a script's parsed commands in the
+ **                    cache directory, with the script's identity and the
+ **                    byte offset parsing reached, so the next run can resume
+ **                    after them. The entry is written to a temporary file
+ **                    and renamed into place.
+ ** Parameters:        one pointer to const char: fullPath,
+ **                    one pointer to const char: cachePath,
+ **                    one pointer to const struct stat: info,
+ **                    one pointer to pointer to struct node: commands,
+ **                    one int: numCommands,
+ **                    one size_t: offset
+ ** Pre-Conditions:    both paths came from scriptCachePath()
+ ** Post-Conditions:   the entry has been written if possible
+ ******************************************************************************/
+void saveScript(const char *fullPath, const char *cachePath, const struct stat *info,
+                struct node **commands, int numCommands, size_t offset);
+
+
+
+/******************************************************************************
+ ** Function:          scriptCachePath()
+ ** Description:       This function names the cache file for a script: a
+ **                    hash of the script's full path under the scripts
+ **                    directory of SMALLSH_CACHE, which is created if needed.
+ **                    It is worked out once, before a cd can change what a
+ **                    relative path names.
+ ** Parameters:        one pointer to const char: path,
+ **                    one pointer to type char: fullPath,
+ **                    one pointer to type char: cachePath
+ ** Pre-Conditions:    fullPath and cachePath have room for PATH_MAX chars
+ ** Post-Conditions:   returns 0 with both paths filled in, or -1 if there is
+ **                    no cache directory
+ ******************************************************************************/
+int scriptCachePath(const char *path, char *fullPath, char *cachePath);
+
+
+
+/******************************************************************************
+ ** Function:          encodeList()
+ ** Description:       This function writes a list of parsed commands to a
+ **                    buffer, depth first, strings as a length and their
+ **                    bytes.
+ ** Parameters:        one pointer to struct byteBuffer: buf,
+ **                    one pointer to struct node: node
+ ** Pre-Conditions:    buf is open for writing
+ ** Post-Conditions:   the list has been appended, or buf->hasError is set
+ ******************************************************************************/
+void encodeList(struct byteBuffer *buf, struct node *node);
+
+
+
+/******************************************************************************
+ ** Function:          decodeList()
+ ** Description:       This function rebuilds a list written by encodeList()
+ **                    in an arena, checking every count and length against
+ **                    the data.
+ ** Parameters:        one pointer to struct byteBuffer: buf,
+ **                    one pointer to struct arena: arena
+ ** Pre-Conditions:    buf holds the data to read
+ ** Post-Conditions:   returns the list; buf->hasError is set if the data was
+ **                    bad or memory ran out
+ ******************************************************************************/
+struct node *decodeList(struct byteBuffer *buf, struct arena *arena);
+
+
+
+/******************************************************************************
+ ** Function:          putBytes()
+ ** Description:       This function appends bytes to a buffer, growing it as
+ **                    needed. putInt() and putString() use it for numbers and
+ **                    strings.
+ ** Parameters:        one pointer to struct byteBuffer: buf,
+ **                    one pointer to const void: data,
+ **                    one size_t: length
+ ** Pre-Conditions:    buf is open for writing
+ ** Post-Conditions:   the bytes were added, or buf->hasError is set
+ ******************************************************************************/
+void putBytes(struct byteBuffer *buf, const void *data, size_t length);
+void putInt(struct byteBuffer *buf, int value);
+void putString(struct byteBuffer *buf, const char *text);
+
+
+
+/******************************************************************************
+ ** Function:          getBytes()
+ ** Description:       This function takes bytes from a buffer being read.
+ **                    getInt() and getString() use it for numbers and
+ **                    strings; strings are copied into an arena.
+ ** Parameters:        one pointer to struct byteBuffer: buf,
+ **                    one pointer to void: data,
+ **                    one size_t: length
+ ** Pre-Conditions:    buf holds the data to read
+ ** Post-Conditions:   the bytes were copied, or buf->hasError is set if the
+ **                    data ran out
+ ******************************************************************************/
+void getBytes(struct byteBuffer *buf, void *data, size_t length);
+int getInt(struct byteBuffer *buf);
+char *getString(struct byteBuffer *buf, struct arena *arena);
+
+
+
+/******************************************************************************
+ ** Function:          runCached()
+ ** Description:       This function runs the cached prefix, cached command
+ **                    args < in > out. The result is looked up by a hash of
+ **                    the working directory, the arguments, the program that
+ **                    would run, the environment variables named in
+ **                    SMALLSH_CACHE_ENV (PATH, HOME, LANG, LC_ALL and TZ if it
+ **                    is unset), and the device, inode, size and modification
+ **                    time of the input file or the text of a here-document.
+ **                    On a hit the saved output and exit status are replayed
+ **                    without starting a process. On a miss the command runs
+ **                    with its output caught in a memfd, which is then copied
+ **                    to where it was going and saved if the command exited.
+ **                    A pipeline, a background job, a built in command, or an
+ **                    input file that cannot be found runs as if there were
+ **                    no prefix.
+ ** Parameters:        one pointer to struct pipeline: pl
+ ** Pre-Conditions:    pl->stages[0].argv[0] is cached and the words of pl have
+ **                    been expanded
+ ** Post-Conditions:   returns the wait status of the command, which is also
+ **                    left in lastStatus
+ ******************************************************************************/
+int runCached(struct pipeline *pl);
+
+
+
+/******************************************************************************
+ ** Function:          isBuiltin()
+ ** Description:       This function checks whether a command name is one of
+ **                    the built in commands in builtins[].
+ ** Parameters:        one pointer to const char: name
+ ** Pre-Conditions:    name is a string
+ ** Post-Conditions:   returns true if the shell runs the command itself
+ ******************************************************************************/
+bool isBuiltin(const char *name);
+
+
+
+/******************************************************************************
+ ** Function:          resultCachePath()
+ ** Description:       This function builds the key for a cached command and
+ **                    names its file: a hash of the key under the results
+ **                    directory of SMALLSH_CACHE, or of ~/.cache/smallsh if
+ **                    that is unset. The directories are created if needed.
+ **                    A command reading the shell's own input is keyed by
+ **                    it only if that is a regular file or /dev/null.
+ ** Parameters:        one pointer to struct command: cmd,
+ **                    one pointer to struct byteBuffer: key,
+ **                    one pointer to type char: path
+ ** Pre-Conditions:    key is empty and path has room for PATH_MAX chars
+ ** Post-Conditions:   returns 0 with the key and path filled in, or -1 if
+ **                    the result cannot be cached
+ ******************************************************************************/
+int resultCachePath(struct command *cmd, struct byteBuffer *key, char *path);
+
+
+
+/******************************************************************************
+ ** Function:          replayResult()
+ ** Description:       This function writes the output saved in a result file
+ **                    to outFd, if the file was saved under the same key, and
+ **                    marks the file as just used for the LRU order.
+ ** Parameters:        one pointer to const char: path,
+ **                    one pointer to struct byteBuffer: key,
+ **                    one int: outFd,
+ **                    one pointer to int: status
+ ** Pre-Conditions:    path and key came from resultCachePath()
+ ** Post-Conditions:   returns 0 with the saved status, or -1 on a miss
+ ******************************************************************************/
+int replayResult(const char *path, struct byteBuffer *key, int outFd, int *status);
+
+
+
+/******************************************************************************
+ ** Function:          saveResult()
+ ** Description:       This function saves a command's key, exit status and
+ **                    output in a result file, written to a temporary file
+ **                    and renamed into place, and then trims the cache.
+ ** Parameters:        one pointer to const char: path,
+ **                    one pointer to struct byteBuffer: key,
+ **                    one int: status,
+ **                    one pointer to const char: output,
+ **                    one size_t: length
+ ** Pre-Conditions:    path and key came from resultCachePath()
+ ** Post-Conditions:   the result has been saved if it fits in the cache
+ ******************************************************************************/
+void saveResult(const char *path, struct byteBuffer *key, int status,
+                const char *output, size_t length);
+
+
+
+/******************************************************************************
+ ** Function:          trimResults()
+ ** Description:       This function keeps the results directory under the
+ **                    size in SMALLSH_CACHE_SIZE, 64MB if it is unset, by
+ **                    removing the results used least recently first.
+ ** Parameters:        one pointer to const char: dir
+ ** Pre-Conditions:    dir is the results directory
+ ** Post-Conditions:   the directory holds no more than the limit
+ ******************************************************************************/
+void trimResults(const char *dir);
+int compareResults(const void *a, const void *b);
+
+
+
+/******************************************************************************
+ ** Function:          startPipeline()
+ ** Description:       This function starts every stage of a pipeline, joining
+ **                    neighbouring stages with pipes. An explicit <, >, << or
+ **                    <<< on a stage takes the place of the pipe on that
+ **                    side, and the first stage of a background pipeline
+ **                    reads /dev/null when it has no input file. A stage that
+ **                    fails to start is skipped, so the rest of the pipeline
+ **                    sees end of file or a broken pipe instead of hanging.
+ **                    A background pipeline, a pipeline with a time limit, or
+ **                    any pipeline under job control gets a process group of
+ **                    its own led by its first process, so the whole job,
+ **                    including anything its commands start, can be
+ **                    signalled at once. Each process is pinned by
+ **                    placeProcess() as soon as it has started.
+ ** Parameters:        one pointer to struct pipeline: pl,
+ **                    one pointer to type pid_t: pids,
+ **                    one pointer to int: cpus,
+ **                    one bool: isLimited
+ ** Pre-Conditions:    pl was filled in by parseSimple() and pids has room for
+ **                    one entry per stage
+ ** Post-Conditions:   pids[i] holds the PID of stage i, 0 if the stage only
+ **                    created its files and needs no process, or -1 if it
+ **                    could not be started, and cpus[i] the CPU it was pinned
+ **                    to or -1. Returns the job's process group, or 0 if it
+ **                    runs in the shell's
+ ******************************************************************************/
+pid_t startPipeline(struct pipeline *pl, pid_t *pids, int *cpus, bool isLimited);
+
+
+
+/******************************************************************************
+ ** Function:          placeProcess()
+ ** Description:       This function applies the placement policy to a new
+ **                    process. A foreground process is kept on the CPUs
+ **                    reserved for the foreground, if there are any. A
+ **                    background process is pinned to one CPU of those left,
+ **                    taken in turn or the one with the fewest background
+ **                    processes, or with no policy to all of them. The
+ **                    affinity is set from the shell, since posix_spawn and
+ **                    the launcher have no way to pass it to the child.
+ ** Parameters:        one pid_t: pid,
+ **                    one bool: isBackground
+ ** Pre-Conditions:    pid is a process the shell has just started
+ ** Post-Conditions:   returns the CPU the process was pinned to, which
+ **                    counts against it until releaseCpu(), or -1
+ ******************************************************************************/
+int placeProcess(pid_t pid, bool isBackground);
+void releaseCpu(int cpu);
+
+
+
+/******************************************************************************
+ ** Function:          placementBuiltin()
+ ** Description:       This function is the placement built in command:
+ **                    placement [off | none | roundrobin | leastloaded]
+ **                    [-f cpus] [-n node]. -f reserves a list of CPUs, like
+ **                    0-1,4, for the foreground, and background jobs use the
+ **                    rest; -n takes the CPUs from one NUMA node, so memory
+ **                    the jobs touch is allocated on that node too. With no
+ **                    arguments it shows the current placement.
+ **                    SMALLSH_PLACEMENT sets it at startup the same way.
+ ** Parameters:        one pointer to struct command: cmd
+ ** Pre-Conditions:    cmd->argv[0] is "placement"
+ ** Post-Conditions:   returns the exit value: 0, or 2 for bad arguments
+ ******************************************************************************/
+int placementBuiltin(struct command *cmd);
+int setPlacement(int argc, char **argv);
+int startPlacement(const char *text);
+
+
+
+/******************************************************************************
+ ** Function:          parseCpuList()
+ ** Description:       This function reads a list of CPUs in the form the
+ **                    kernel uses, such as 0-3,8,10-11. printCpuList() writes
+ **                    one the same way.
+ ** Parameters:        one pointer to const char: text,
+ **                    one pointer to cpu_set_t: cpus
+ ** Pre-Conditions:    none
+ ** Post-Conditions:   returns 0 with cpus set, or -1 if the list is bad or
+ **                    empty
+ ******************************************************************************/
+int parseCpuList(const char *text, cpu_set_t *cpus);
+void printCpuList(const cpu_set_t *cpus);
+
+
+
+/******************************************************************************
+ ** Function:          openRedirection()
+ ** Description:       This function opens the target of a < or > redirection.
+ **                    Output files are created or truncated. The descriptor is
+ **                    close-on-exec, so only the copy dup'd onto stdin or
+ **                    stdout survives into a command.
+ ** Parameters:        one pointer to const char: path,
+ **                    one bool: isOutput
+ ** Pre-Conditions:    path is the name of the file to open
+ ** Post-Conditions:   returns the open descriptor, or -1 after printing an
+ **                    error message
+ ******************************************************************************/
+int openRedirection(const char *path, bool isOutput);
+
+
+
+/******************************************************************************
+ ** Function:          openInputText()
+ ** Description:       This function makes a descriptor that reads the body
+ **                    of a here-document or here-string, without a file. A
+ **                    body small enough to fit in a pipe is written to one;
+ **                    a larger one goes in a memfd, which can hold any size
+ **                    without a reader to drain it.
+ ** Parameters:        one pointer to const char: text
+ ** Pre-Conditions:    none
+ ** Post-Conditions:   returns a close-on-exec descriptor positioned at the
+ **                    start of text, or -1 after printing an error
+ ******************************************************************************/
+int openInputText(const char *text);
+
+
+
+/******************************************************************************
+ ** Function:          spawnProcess()
+ ** Description:       This function starts a command with posix_spawn, which
+ **                    uses vfork-style process creation, so the cost of
+ **                    starting a command does not grow with the memory used by
+ **                    the shell. The program is found through the path cache
+ **                    and run by its full path. The given descriptors are
+ **                    handed to the child as its stdin and stdout through
+ **                    file actions, and the child is put in the given
+ **                    process group, taking the terminal if asked to.
+ ** Parameters:        one pointer to pointer of type char: argv,
+ **                    two ints: inFd, outFd,
+ **                    one pid_t: pgid,
+ **                    one bool: takeTerminal
+ ** Pre-Conditions:    argv is a NULL terminated array of arguments with the
+ **                    command name first. inFd and outFd are -1 if the child
+ **                    should share the shell's stdin or stdout. pgid is the
+ **                    group to join, 0 to lead a new one, or -1 to stay in
+ **                    the shell's
+ ** Post-Conditions:   returns the PID of the new child process, or -1 if the
+ **                    command could not be run, in which case an error
+ **                    message has been printed
+ ******************************************************************************/
+pid_t spawnProcess(char **argv, int inFd, int outFd, pid_t pgid, bool takeTerminal);
+
+
+
+/******************************************************************************
+ ** Function:          isCopyStage()
+ ** Description:       This function decides whether a pipeline stage only
+ **                    copies data, so the shell can move it with splice and
+ **                    tee instead of running a program. That is the case for
+ **                    a stage with redirections but no command, and for cat
+ **                    and tee when they are given file names but no options.
+ ** Parameters:        one pointer to struct command: stage
+ ** Pre-Conditions:    stage is part of a pipeline of two or more stages
+ ** Post-Conditions:   returns true if runCopyStage() can handle the stage
+ ******************************************************************************/
+bool isCopyStage(struct command *stage);
+
+
+
+/******************************************************************************
+ ** Function:          runCopyStage()
+ ** Description:       This function does the work of a copy stage in a child
+ **                    of the shell: cat copies its files (or its input) to its
+ **                    output, tee duplicates its input to its output and each
+ **                    file, and a stage with no command copies input to output.
+ ** Parameters:        one pointer to struct command: stage,
+ **                    two ints: inFd, outFd
+ ** Pre-Conditions:    isCopyStage() returned true for stage. inFd and outFd
+ **                    are the stage's input and output
+ ** Post-Conditions:   returns the exit value for the stage: 0 on success and
+ **                    1 if a file could not be opened or copied
+ ******************************************************************************/
+int runCopyStage(struct command *stage, int inFd, int outFd);
+
+
+
+/******************************************************************************
+ ** Function:          copyFd()
+ ** Description:       This function copies everything from one descriptor to
+ **                    another. It uses splice so data moves inside the kernel
+ **                    when either side is a pipe, and falls back to a read and
+ **                    write loop for other kinds of files.
+ ** Parameters:        two ints: inFd, outFd
+ ** Pre-Conditions:    inFd is open for reading and outFd for writing
+ ** Post-Conditions:   returns 0 once inFd reaches end of file, or 1 on error
+ ******************************************************************************/
+int copyFd(int inFd, int outFd);
+
+
+
+/******************************************************************************
+ ** Function:          teeFd()
+ ** Description:       This function copies its input to its output and to
+ **                    every file given. When the input and output are pipes
+ **                    it duplicates each chunk with tee and splices it into
+ **                    the files, so data never passes through user space;
+ **                    otherwise it reads into a buffer and writes each copy.
+ ** Parameters:        two ints: inFd, outFd,
+ **                    one pointer to type int: fileFds,
+ **                    one int: numFiles
+ ** Pre-Conditions:    inFd is open for reading, outFd and fileFds[] for
+ **                    writing
+ ** Post-Conditions:   returns 0 once inFd reaches end of file, or 1 on error
+ ******************************************************************************/
+int teeFd(int inFd, int outFd, int *fileFds, int numFiles);
+
+
+
+/******************************************************************************
+ ** Function:          hashIndex()
+ ** Description:       This function maps a PID or job number to a bucket of
+ **                    the job table. Multiplying by an odd constant spreads
+ **                    the keys, and consecutive keys still land in distinct
+ **                    buckets.
+ ** Parameters:        one int: key,
+ **                    one size_t: numBuckets
+ ** Pre-Conditions:    numBuckets is a power of two
+ ** Post-Conditions:   returns a bucket index less than numBuckets
+ ******************************************************************************/
+size_t hashIndex(int key, size_t numBuckets);
+
+
+
+/******************************************************************************
+ ** Function:          growJobTable()
+ ** Description:       This function doubles the number of buckets in the job
+ **                    table and rehashes every process and job, keeping the
+ **                    chains short as the number of jobs grows.
+ ** Parameters:        none
+ ** Pre-Conditions:    jobs is the global job table
+ ** Post-Conditions:   the table has twice as many buckets (MIN_BUCKETS the
+ **                    first time), or is unchanged if memory could not be
+ **                    allocated
+ ******************************************************************************/
+void growJobTable();
+
+
+
+/******************************************************************************
+ ** Function:          pipelineText()
+ ** Description:       This function rebuilds the text of a command line from
+ **                    its parsed words, for display by the jobs built in.
+ ** Parameters:        one pointer to struct pipeline: pl
+ ** Pre-Conditions:    pl was filled in by parseSimple()
+ ** Post-Conditions:   returns a newly allocated string the caller must free,
+ **                    or NULL if memory could not be allocated
+ ******************************************************************************/
+char *pipelineText(struct pipeline *pl);
+
+
+
+/******************************************************************************
+ ** Function:          addJob()
+ ** Description:       This function records a new background job and the
+ **                    processes in it, giving it the next job number. Job
+ **                    numbers start again from 1 once no jobs are left. A
+ **                    job that is to be queued has no processes yet.
+ ** Parameters:        one pointer to type pid_t: pids,
+ **                    one int: numPids,
+ **                    one pointer to struct pipeline: pl
+ ** Pre-Conditions:    pids[] holds the PIDs of the stages of pl that were
+ **                    started, in pipeline order, or numPids is 0
+ ** Post-Conditions:   returns the new job, or NULL if memory or a pidfd
+ **                    could not be allocated
+ ******************************************************************************/
+struct job *addJob(pid_t *pids, int numPids, struct pipeline *pl);
+
+
+
+/******************************************************************************
+ ** Function:          watchProcesses()
+ ** Description:       This function adds the processes of a job to the job
+ **                    table. A pidfd is opened for each process and added to
+ **                    the table's epoll set, and each is hashed by PID.
+ ** Parameters:        one pointer to struct job: job,
+ **                    one pointer to type pid_t: pids,
+ **                    one int: numPids
+ ** Pre-Conditions:    the job has no processes yet and numPids is at least 1
+ ** Post-Conditions:   returns 0, or -1 with the job unchanged if memory or a
+ **                    pidfd could not be allocated
+ ******************************************************************************/
+int watchProcesses(struct job *job, pid_t *pids, int numPids);
+
+
+
+/******************************************************************************
+ ** Function:          holdJob()
+ ** Description:       This function takes the pidfds of a job's live
+ **                    processes out of the job table's epoll set, or puts
+ **                    them back. A job held by fg is waited on by fg alone,
+ **                    so reapChildren() cannot reap and free it meanwhile.
+ ** Parameters:        one pointer to struct job: job,
+ **                    one bool: isHeld
+ ** Pre-Conditions:    the job's pidfds are in the set if isHeld, and out of
+ **                    it otherwise
+ ** Post-Conditions:   the pidfds of live processes are out of the set if
+ **                    isHeld, and in it otherwise
+ ******************************************************************************/
+void holdJob(struct job *job, bool isHeld);
+
+
+
+/******************************************************************************
+ ** Function:          findProcess()
+ ** Description:       This function looks up a background process by PID.
+ ** Parameters:        one pid_t: pid
+ ** Pre-Conditions:    jobs is the global job table
+ ** Post-Conditions:   returns the process, or NULL if the shell is not
+ **                    tracking a background process with that PID
+ ******************************************************************************/
+struct process *findProcess(pid_t pid);
+
+
+
+/******************************************************************************
+ ** Function:          findJob()
+ ** Description:       This function looks up a background job by job number.
+ ** Parameters:        one int: id
+ ** Pre-Conditions:    jobs is the global job table
+ ** Post-Conditions:   returns the job, or NULL if there is no such job
+ ******************************************************************************/
+struct job *findJob(int id);
+
+
+
+/******************************************************************************
+ ** Function:          removeJob()
+ ** Description:       This function takes a job and its processes out of the
+ **                    job table and frees them, closing any pidfds still open.
+ ** Parameters:        one pointer to struct job: job
+ ** Pre-Conditions:    job was returned by addJob() and not yet removed
+ ** Post-Conditions:   job has been freed and must not be used again
+ ******************************************************************************/
+void removeJob(struct job *job);
+
+
+
+/******************************************************************************
+ ** Function:          listJobs()
+ ** Description:       This function prints the background jobs in the order
+ **                    they were started, one per line, with the job number,
+ **                    the PID of the last process still running and the
+ **                    command line, and for a job with a time limit the time
+ **                    left or that it is being terminated. Queued jobs are
+ **                    shown without a PID. It is the jobs built in command.
+ ** Parameters:        none
+ ** Pre-Conditions:    jobs is the global job table
+ ** Post-Conditions:   the jobs have been printed to stdout
+ ******************************************************************************/
+void listJobs();
+
+
+
+/******************************************************************************
+ ** Function:          parseTimeout()
+ ** Description:       This function reads the arguments of a timeout prefix,
+ **                    timeout [-k grace] duration command..., where a time is
+ **                    a number of seconds that may have a fraction and an s,
+ **                    m, h or d suffix. A duration of 0 sets no limit.
+ ** Parameters:        one pointer to struct command: cmd,
+ **                    one pointer to long long: timeoutNs,
+ **                    one pointer to long long: graceNs
+ ** Pre-Conditions:    cmd->argv[0] is timeout
+ ** Post-Conditions:   returns the number of words before the command, or -1
+ **                    after printing a usage message
+ ******************************************************************************/
+int parseTimeout(struct command *cmd, long long *timeoutNs, long long *graceNs);
+
+
+
+/******************************************************************************
+ ** Function:          parseDuration()
+ ** Description:       This function converts a time such as 10, 1.5s, 2m or
+ **                    1h to nanoseconds.
+ ** Parameters:        one pointer to const char: text,
+ **                    one pointer to long long: ns
+ ** Pre-Conditions:    none
+ ** Post-Conditions:   returns 0 with ns set, or -1 if text is not a time
+ ******************************************************************************/
+int parseDuration(const char *text, long long *ns);
+
+
+
+/******************************************************************************
+ ** Function:          startDeadline()
+ ** Description:       This function puts a time limit on a background job or
+ **                    on the foreground pipeline. Every limit waits in one
+ **                    heap ordered by when it is next due, and the shell's
+ **                    single timerfd is set for the earliest of them, so the
+ **                    limits are kept without a timeout process or a timer
+ **                    per job.
+ ** Parameters:        one pointer to struct deadline: limit,
+ **                    one long long: timeoutNs,
+ **                    one long long: graceNs
+ ** Pre-Conditions:    limit->job is set, or NULL for the foreground pipeline
+ ** Post-Conditions:   limit is in the heap and the timer is set
+ ******************************************************************************/
+void startDeadline(struct deadline *limit, long long timeoutNs, long long graceNs);
+
+
+
+/******************************************************************************
+ ** Function:          stopDeadline()
+ ** Description:       This function takes a limit out of the heap once what
+ **                    it limits is done.
+ ** Parameters:        one pointer to struct deadline: limit
+ ** Pre-Conditions:    none
+ ** Post-Conditions:   limit is not in the heap and the timer is set for the
+ **                    next limit, if any
+ ******************************************************************************/
+void stopDeadline(struct deadline *limit);
+
+
+
+/******************************************************************************
+ ** Function:          expireDeadlines()
+ ** Description:       This function acts on every limit that is due. The
+ **                    first time a limit is reached the processes it covers
+ **                    are sent SIGTERM and the limit is set again for the
+ **                    grace period; if they are still running when that runs
+ **                    out they are sent SIGKILL.
+ ** Parameters:        none
+ ** Pre-Conditions:    jobs.timerFd is the shell's timerfd
+ ** Post-Conditions:   the timer has been read and set for the next limit
+ ******************************************************************************/
+void expireDeadlines();
+
+
+
+/******************************************************************************
+ ** Function:          siftTimer()
+ ** Description:       This function moves a limit up or down the heap until
+ **                    it is in order again.
+ ** Parameters:        one size_t: index
+ ** Pre-Conditions:    only the limit at index may be out of order
+ ** Post-Conditions:   the heap is in order
+ ******************************************************************************/
+void siftTimer(size_t index);
+
+
+
+/******************************************************************************
+ ** Function:          armTimer()
+ ** Description:       This function sets the timerfd for the earliest limit
+ **                    in the heap, or turns it off if the heap is empty.
+ ** Parameters:        none
+ ** Pre-Conditions:    jobs.timerFd is the shell's timerfd
+ ** Post-Conditions:   the timer fires when the first limit is due
+ ******************************************************************************/
+void armTimer();
+
+
+
+/******************************************************************************
+ ** Function:          queueJob()
+ ** Description:       This function holds back a background pipeline that
+ **                    would go past the limit on running jobs. It becomes a
+ **                    job with a copy of the pipeline and no processes, put
+ **                    in the queue by the niceness given by a nice prefix
+ **                    (10 for nice alone), and in order of arrival after that.
+ ** Parameters:        one pointer to struct pipeline: pl,
+ **                    two long longs: timeoutNs, graceNs
+ ** Pre-Conditions:    pl is a background pipeline; timeoutNs is 0 if there
+ **                    is no time limit
+ ** Post-Conditions:   the job is queued and reported, or a message printed
+ ******************************************************************************/
+void queueJob(struct pipeline *pl, long long timeoutNs, long long graceNs);
+
+
+
+/******************************************************************************
+ ** Function:          unqueueJob()
+ ** Description:       This function takes a job out of the queue, moving the
+ **                    last queued job into its place.
+ ** Parameters:        one pointer to struct job: job
+ ** Pre-Conditions:    job->pending is set
+ ** Post-Conditions:   the job is no longer in the queue
+ ******************************************************************************/
+void unqueueJob(struct job *job);
+
+
+
+/******************************************************************************
+ ** Function:          siftQueue()
+ ** Description:       This function moves a job up or down the queue's heap
+ **                    until it is in order again: lower niceness first, and
+ **                    then lower job number.
+ ** Parameters:        one size_t: index
+ ** Pre-Conditions:    only the job at index may be out of order
+ ** Post-Conditions:   the heap is in order
+ ******************************************************************************/
+void siftQueue(size_t index);
+bool isAhead(struct job *first, struct job *second);
+
+
+
+/******************************************************************************
+ ** Function:          startQueuedJobs()
+ ** Description:       This function starts jobs from the front of the queue
+ **                    while there is room for them under the limit.
+ ** Parameters:        none
+ ** Pre-Conditions:    none
+ ** Post-Conditions:   the queue is empty or the limit has been reached
+ ******************************************************************************/
+void startQueuedJobs();
+
+
+
+/******************************************************************************
+ ** Function:          startJob()
+ ** Description:       This function starts a queued job's pipeline, in a
+ **                    process group of its own, and starts its time limit.
+ **                    A job none of whose stages could start is removed.
+ ** Parameters:        one pointer to struct job: job,
+ **                    one bool: isReported
+ ** Pre-Conditions:    job->pending is set
+ ** Post-Conditions:   returns 0 with the job running, and its last PID
+ **                    printed if isReported, or -1 if it was removed
+ ******************************************************************************/
+int startJob(struct job *job, bool isReported);
+
+
+
+/******************************************************************************
+ ** Function:          jobLimit()
+ ** Description:       This function works out how many background jobs may
+ **                    run at once. With maxjobs auto that is one per online
+ **                    CPU, less the load from the rest of the system: the one
+ **                    minute load average beyond the jobs already running.
+ ** Parameters:        none
+ ** Pre-Conditions:    none
+ ** Post-Conditions:   returns the limit, at least 1, or 0 for no limit
+ ******************************************************************************/
+int jobLimit();
+
+
+
+/******************************************************************************
+ ** Function:          copyPipeline()
+ ** Description:       This function copies a pipeline, with its stages and
+ **                    all of their strings, into one block of memory that a
+ **                    single free releases.
+ ** Parameters:        one pointer to struct pipeline: pl
+ ** Pre-Conditions:    none
+ ** Post-Conditions:   returns the copy, or NULL if there is no memory
+ ******************************************************************************/
+struct pipeline *copyPipeline(struct pipeline *pl);
+
+
+
+/******************************************************************************
+ ** Function:          maxjobsBuiltin()
+ ** Description:       This function is the maxjobs built in command. With a
+ **                    number it limits how many background jobs run at once,
+ **                    auto follows the CPUs and the load, and off removes the
+ **                    limit. With no arguments it shows the limit and how
+ **                    many jobs are running and queued. SMALLSH_MAX_JOBS sets
+ **                    the limit at startup the same way.
+ ** Parameters:        one pointer to struct command: cmd
+ ** Pre-Conditions:    cmd->argv[0] is "maxjobs"
+ ** Post-Conditions:   returns the exit value: 0, or 2 for a bad limit
+ ******************************************************************************/
+int maxjobsBuiltin(struct command *cmd);
+int setJobLimit(const char *text);
+
+
+
+/******************************************************************************
+ ** Function:          waitProcess()
+ ** Description:       This function waits for a foreground process to exit,
+ **                    or under job control to stop. While time limits are
+ **                    pending it also watches the timer and acts on any that
+ **                    come due in the meantime, and while jobs are queued it
+ **                    reaps background jobs so queued ones can start; SIGCHLD is held back until
+ **                    the wait is ready for it, so a change that happens in
+ **                    between still wakes it.
+ ** Parameters:        one pid_t: pid,
+ **                    one pointer to int: status,
+ **                    one pointer to struct rusage: ru
+ ** Pre-Conditions:    pid is a child of the shell
+ ** Post-Conditions:   returns pid with status and ru filled in as by wait4,
+ **                    or -1 on error
+ ******************************************************************************/
+pid_t waitProcess(pid_t pid, int *status, struct rusage *ru);
+
+
+
+/******************************************************************************
+ ** Function:          sigchldHandler()
+ ** Description:       This function catches SIGCHLD while waitProcess() waits
+ **                    on the timer, so that the wait is woken when a child
+ **                    changes state. It has nothing else to do.
+ ** Parameters:        none
+ ** Pre-Conditions:    it is the SIGCHLD handler
+ ** Post-Conditions:   none
+ ******************************************************************************/
+void sigchldHandler();
+
+
+
+/******************************************************************************
+ ** Function:          hashString()
+ ** Description:       This function computes the FNV-1a hash of a string,
+ **                    used to find command names in the path cache.
+ ** Parameters:        one pointer to const char: text
+ ** Pre-Conditions:    text is a NUL terminated string
+ ** Post-Conditions:   returns the hash value
+ ******************************************************************************/
+size_t hashString(const char *text);
+
+
+
+/******************************************************************************
+ ** Function:          lookupCommand()
+ ** Description:       This function finds the program to run for a command
+ **                    name. Names containing a / are used as they are. Other
+ **                    names are looked up in the path cache, and an entry is
+ **                    trusted as long as PATH is unchanged and the directory
+ **                    it was found in has the same modification time; that
+ **                    costs one stat instead of a failed exec for every
+ **                    directory ahead of it in PATH. On a miss PATH is searched
+ **                    and the result is cached.
+ ** Parameters:        one pointer to const char: name,
+ **                    one bool: countHit
+ ** Pre-Conditions:    name is the first argument of a command. countHit is
+ **                    true if the lookup is for running the command
+ ** Post-Conditions:   returns the path of the program, valid until the next
+ **                    call, or NULL if no executable file was found
+ ******************************************************************************/
+const char *lookupCommand(const char *name, bool countHit);
+
+
+
+/******************************************************************************
+ ** Function:          forgetCommand()
+ ** Description:       This function drops one command name from the path
+ **                    cache, if it is there.
+ ** Parameters:        one pointer to const char: name
+ ** Pre-Conditions:    pathCache is the global path cache
+ ** Post-Conditions:   the next lookup of name searches PATH again
+ ******************************************************************************/
+void forgetCommand(const char *name);
+
+
+
+/******************************************************************************
+ ** Function:          clearPathCache()
+ ** Description:       This function empties the path cache. It runs when PATH
+ **                    changes and for hash -r.
+ ** Parameters:        none
+ ** Pre-Conditions:    pathCache is the global path cache
+ ** Post-Conditions:   every entry has been freed
+ ******************************************************************************/
+void clearPathCache();
+
+
+
+/******************************************************************************
+ ** Function:          hashBuiltin()
+ ** Description:       This function is the hash built in command. With no
+ **                    arguments it lists the cached commands and how often
+ **                    each was used, -r empties the cache, and any names
+ **                    given are looked up and added to it.
+ ** Parameters:        one pointer to struct command: cmd
+ ** Pre-Conditions:    cmd->argv[0] is "hash"
+ ** Post-Conditions:   returns the exit value: 0, or 1 if a name was not found
+ ******************************************************************************/
+int hashBuiltin(struct command *cmd);
+
+
+
+/******************************************************************************
+ ** Function:          monotonicNs()
+ ** Description:       This function reads the monotonic clock, which is used
+ **                    to time jobs from spawn to reap.
+ ** Parameters:        none
+ ** Pre-Conditions:    none
+ ** Post-Conditions:   returns the time in nanoseconds
+ ******************************************************************************/
+long long monotonicNs();
+
+
+
+/******************************************************************************
+ ** Function:          addUsage()
+ ** Description:       This function adds the resources one reaped process
+ **                    used, as reported by wait4, to a job's totals. CPU
+ **                    times and context switches are summed and the largest
+ **                    resident set is kept.
+ ** Parameters:        one pointer to struct usage: total,
+ **                    one pointer to const struct rusage: ru
+ ** Pre-Conditions:    ru was filled in by wait4 for a child of the shell
+ ** Post-Conditions:   total includes the process
+ ******************************************************************************/
+void addUsage(struct usage *total, const struct rusage *ru);
+
+
+
+/******************************************************************************
+ ** Function:          recordUsage()
+ ** Description:       This function saves the resource use of a finished job
+ **                    in the history shown by the times builtin, dropping the
+ **                    oldest entry when the history is full, and adds it to
+ **                    the totals for every job the shell has run.
+ ** Parameters:        one int: id,
+ **                    one pid_t: pid,
+ **                    one pointer to type char: command,
+ **                    one pointer to const struct usage: use
+ ** Pre-Conditions:    id is the job number, or 0 for a foreground job.
+ **                    command was allocated with malloc and may be NULL
+ ** Post-Conditions:   the history owns command
+ ******************************************************************************/
+void recordUsage(int id, pid_t pid, char *command, const struct usage *use);
+
+
+
+/******************************************************************************
+ ** Function:          printUsage()
+ ** Description:       This function prints CPU times, wall time, peak RSS,
+ **                    and voluntary/involuntary context switches on one line.
+ ** Parameters:        one pointer to const struct usage: use
+ ** Pre-Conditions:    none
+ ** Post-Conditions:   the line has been printed
+ ******************************************************************************/
+void printUsage(const struct usage *use);
+
+
+
+/******************************************************************************
+ ** Function:          timesBuiltin()
+ ** Description:       This function is the times built in command. It prints
+ **                    the CPU time used by the shell itself, the resource use
+ **                    of each recent finished job, foreground or background,
+ **                    and the totals for every job since the shell started.
+ ** Parameters:        none
+ ** Pre-Conditions:    none
+ ** Post-Conditions:   the report has been printed
+ ******************************************************************************/
+void timesBuiltin();
+
+
+
+/******************************************************************************
+ ** Function:          startTrace()
+ ** Description:       This function turns tracing on, mapping the ring the
+ **                    events go in the first time. The pages of the ring are
+ **                    only touched as events fill them.
+ ** Parameters:        none
+ ** Pre-Conditions:    none
+ ** Post-Conditions:   returns 0 with traceLog.isOn true, or -1 after printing
+ **                    an error
+ ******************************************************************************/
+int startTrace();
+
+
+
+/******************************************************************************
+ ** Function:          traceEvent()
+ ** Description:       This function records one event with the time it
+ **                    happened, overwriting the oldest once the ring is full.
+ **                    With tracing off it does nothing.
+ ** Parameters:        one int: type,
+ **                    one pid_t: pid,
+ **                    one long long: value
+ ** Pre-Conditions:    type is an enum traceType
+ ** Post-Conditions:   the event is in the ring if tracing is on
+ ******************************************************************************/
+void traceEvent(int type, pid_t pid, long long value);
+
+
+
+/******************************************************************************
+ ** Function:          traceStart()
+ ** Description:       This function reads the clock at the start of something
+ **                    whose length will be traced, only if tracing is on.
+ ** Parameters:        none
+ ** Pre-Conditions:    none
+ ** Post-Conditions:   returns the monotonic time in nanoseconds, or 0
+ ******************************************************************************/
+long long traceStart();
+
+
+
+/******************************************************************************
+ ** Function:          traceBuiltin()
+ ** Description:       This function is the trace built in command. trace on
+ **                    and trace off start and stop recording, trace clear
+ **                    empties the log, and trace dump [file] writes it out in
+ **                    the Chrome trace event format, which chrome://tracing
+ **                    and Perfetto can show. Each child is drawn on a line of
+ **                    its own from exec to reap. With no argument it says
+ **                    whether tracing is on.
+ ** Parameters:        one pointer to struct command: cmd
+ ** Pre-Conditions:    cmd is the trace command
+ ** Post-Conditions:   returns the exit value of the command
+ ******************************************************************************/
+int traceBuiltin(struct command *cmd);
+
+
+
+/******************************************************************************
+ ** Function:          dumpTrace()
+ ** Description:       This function writes the events in the log, oldest
+ **                    first, as a Chrome trace JSON object.
+ ** Parameters:        one pointer to FILE: out
+ ** Pre-Conditions:    out is open for writing
+ ** Post-Conditions:   the trace has been written
+ ******************************************************************************/
+void dumpTrace(FILE *out);
+
+
+
+/******************************************************************************
+ ** Function:          closeReader()
+ ** Description:       This function frees the buffers of a reader set up by
+ **                    openReader(), unmapping a mapped script.
+ ** Parameters:        one pointer to struct lineReader: reader
+ ** Pre-Conditions:    reader was set up by openReader()
+ ** Post-Conditions:   the reader's memory has been released; its descriptor
+ **                    is left for the caller to close
+ ******************************************************************************/
+void closeReader(struct lineReader *reader);
+
+
+
+/******************************************************************************
+ ** Function:          parallelBuiltin()
+ ** Description:       This function is the parallel built in command:
+ **                    parallel [-j N] [-k] command args... < inputs
+ **                    It reads one item per line and runs the command once
+ **                    for each, with every {} in its arguments replaced by
+ **                    the item (or the item added as the last argument if
+ **                    there is no {}). At most N commands run at a time, N
+ **                    being the number of online CPUs by default, and the
+ **                    next item starts as soon as one finishes. Like
+ **                    background jobs, the commands are watched through
+ **                    pidfds in an epoll set. With -k each command writes to
+ **                    a memfd and the outputs are copied out in input order.
+ **                    The running commands take the place of the foreground
+ **                    pipeline, so an interrupt kills them and stops the
+ **                    rest from starting.
+ ** Parameters:        one pointer to struct command: cmd
+ ** Pre-Conditions:    cmd->argv[0] is "parallel". SIGINT is handled by
+ **                    sigintHandler() and signalNum is 0
+ ** Post-Conditions:   returns a wait status whose exit value is the number
+ **                    of commands that failed (101 for more than 100), or one
+ **                    showing SIGINT if the run was interrupted
+ ******************************************************************************/
+int parallelBuiltin(struct command *cmd);
+
+
+
+/******************************************************************************
+ ** Function:          expandTemplate()
+ ** Description:       This function builds the argument list for one item of
+ **                    a parallel command by replacing each {} in the template
+ **                    words with the item.
+ ** Parameters:        one pointer to pointer to type char: words,
+ **                    one int: numWords,
+ **                    one pointer to const char: item
+ ** Pre-Conditions:    words holds numWords template words
+ ** Post-Conditions:   returns a NULL terminated array whose strings are each
+ **                    allocated, to be released with freeArgs(), or NULL if
+ **                    memory ran out
+ ******************************************************************************/
+char **expandTemplate(char **words, int numWords, const char *item);
+
+
+
+/******************************************************************************
+ ** Function:          freeArgs()
+ ** Description:       This function frees an argument list built by
+ **                    expandTemplate().
+ ** Parameters:        one pointer to pointer to type char: args
+ ** Pre-Conditions:    args is NULL or came from expandTemplate()
+ ** Post-Conditions:   the strings and the array have been freed
+ ******************************************************************************/
+void freeArgs(char **args);
+
+
+
+/******************************************************************************
+ ** Function:          isSimpleCommand()
+ ** Description:       This function decides whether a command can be run
+ **                    inside the shell instead of being spawned: echo (with
+ **                    at most -n), pwd, true and false without arguments, a
+ **                    test of one file (-e, -f, -d, -s, -r, -w or -x), and
+ **                    cat of regular files with no options. Anything else,
+ **                    including options these versions do not know, is left
+ **                    to the real program.
+ ** Parameters:        one pointer to struct command: cmd
+ ** Pre-Conditions:    cmd is the only stage of a foreground pipeline
+ ** Post-Conditions:   returns true if runSimpleCommand() can run cmd
+ ******************************************************************************/
+bool isSimpleCommand(struct command *cmd);
+
+
+
+/******************************************************************************
+ ** Function:          runSimpleCommand()
+ ** Description:       This function runs a command accepted by
+ **                    isSimpleCommand() in the shell process, with its < and >
+ **                    redirections applied to descriptors of its own, which
+ **                    saves a process creation for the commands scripts use
+ **                    most.
+ ** Parameters:        one pointer to struct command: cmd
+ ** Pre-Conditions:    isSimpleCommand(cmd) is true
+ ** Post-Conditions:   the command's output has been written, or buffered in
+ **                    stdout if it goes to the shell's own output, and its
+ **                    wait status is returned
+ ******************************************************************************/
+int runSimpleCommand(struct command *cmd);
+
+
+
+/******************************************************************************
+ ** Function:          copyFile()
+ ** Description:       This function copies a regular file to a descriptor
+ **                    inside the kernel: copy_file_range to another file,
+ **                    sendfile to anything else, and copyFd() if neither is
+ **                    supported.
+ ** Parameters:        two ints: inFd, outFd
+ ** Pre-Conditions:    inFd is open on a regular file
+ ** Post-Conditions:   returns 0 if everything was copied, otherwise 1
+ ******************************************************************************/
+int copyFile(int inFd, int outFd);
+
+
+
+/******************************************************************************
+ ** Function:          writeAll()
+ ** Description:       This function writes a whole buffer to a descriptor,
+ **                    continuing after short writes.
+ ** Parameters:        one int: fd,
+ **                    one pointer to const char: data,
+ **                    one size_t: length
+ ** Pre-Conditions:    data holds length bytes
+ ** Post-Conditions:   returns 0 if everything was written, otherwise 1
+ ******************************************************************************/
+int writeAll(int fd, const char *data, size_t length);
+
+
+
+/******************************************************************************
+ ** Function:          writeOutput()
+ ** Description:       This function writes what a command run in the shell
+ **                    prints. Output to the shell's own standard output goes
+ **                    through the stdout buffer with the shell's messages,
+ **                    so a list of such commands is written together when
+ **                    the list is done, or before anything else is started.
+ ** Parameters:        one int: fd,
+ **                    one pointer to const char: data,
+ **                    one size_t: length
+ ** Pre-Conditions:    data holds length bytes
+ ** Post-Conditions:   returns 0 if everything was written or buffered,
+ **                    otherwise 1
+ ******************************************************************************/
+int writeOutput(int fd, const char *data, size_t length);
+
+
+
+/******************************************************************************
+ ** Function:          startLauncher()
+ ** Description:       This function forks the launcher helper while the
+ **                    shell is still small and connects it to the shell with
+ **                    a socketpair. From then on spawnProcess() hands each
+ **                    command to the helper instead of creating it itself.
+ ** Parameters:        none
+ ** Pre-Conditions:    called once at startup, before other descriptors are
+ **                    opened
+ ** Post-Conditions:   launcherFd is the shell's end of the socket, or -1 if
+ **                    the helper could not be started
+ ******************************************************************************/
+void startLauncher();
+
+
+
+/******************************************************************************
+ ** Function:          runLauncher()
+ ** Description:       This function is the launcher helper's loop. For each
+ **                    request it changes to the shell's working directory if
+ **                    needed, then starts the program with clone3 and
+ **                    CLONE_PARENT, so the new process is a child of the
+ **                    shell rather than the helper, and the shell reaps it
+ **                    and collects its status and resource use as usual. The
+ **                    stdin and stdout descriptors arrive with the request
+ **                    through SCM_RIGHTS. The reply holds the new PID and,
+ **                    if exec failed, the error, which the child reports
+ **                    through a close-on-exec pipe.
+ ** Parameters:        one int: fd
+ ** Pre-Conditions:    fd is the helper's end of the socket
+ ** Post-Conditions:   returns when the shell closes its end
+ ******************************************************************************/
+void runLauncher(int fd);
+
+
+
+/******************************************************************************
+ ** Function:          receiveFds()
+ ** Description:       This function takes the descriptors attached to a
+ **                    message through SCM_RIGHTS, in the order they were
+ **                    sent. Every one received is open in this process, so
+ **                    when there are more than the caller expects, or some
+ **                    were cut off for lack of room, all of them are closed
+ **                    and the message is refused.
+ ** Parameters:        one pointer to struct msghdr: msg,
+ **                    one pointer to type int: fds,
+ **                    one int: maxFds
+ ** Pre-Conditions:    msg was filled in by recvmsg and fds has room for
+ **                    maxFds descriptors
+ ** Post-Conditions:   returns the number of descriptors put in fds, or -1
+ **                    with none left open
+ ******************************************************************************/
+int receiveFds(struct msghdr *msg, int *fds, int maxFds);
+
+
+
+/******************************************************************************
+ ** Function:          launchProcess()
+ ** Description:       This function asks the launcher helper to start a
+ **                    program. The request carries the program path, the
+ **                    shell's working directory and the arguments in one
+ **                    message, with inFd and outFd attached.
+ ** Parameters:        one pointer to pid_t: cpid,
+ **                    one pointer to const char: path,
+ **                    one pointer to pointer to type char: argv,
+ **                    two ints: inFd, outFd,
+ **                    one pid_t: pgid
+ ** Pre-Conditions:    path is the program to run. inFd and outFd are -1 if
+ **                    the child keeps the shell's stdin or stdout, and pgid
+ **                    is as for spawnProcess()
+ ** Post-Conditions:   returns 0 with *cpid set, an error number if the
+ **                    program could not be run, or -1 if there is no helper
+ **                    or the request is too large, in which case the caller
+ **                    spawns the program itself
+ ******************************************************************************/
+int launchProcess(pid_t *cpid, const char *path, char **argv, int inFd, int outFd, pid_t pgid);
+
+
+
+/******************************************************************************
+ ** Function:          serveClients()
+ ** Description:       This function is the server started by --listen. It
+ **                    listens on a Unix socket and waits in epoll for new
+ **                    connections, requests and finished sessions. A request
+ **                    holds the client's working directory and, optionally,
+ **                    commands to run, with the client's stdin, stdout and
+ **                    stderr attached through SCM_RIGHTS. Each request is run
+ **                    by a session forked from the server, so it starts with
+ **                    the server's warm state but has its own directory,
+ **                    status and jobs, and its output goes straight to the
+ **                    client. When the session ends its exit status is sent
+ **                    back and the connection is closed.
+ ** Parameters:        one pointer to const char: path
+ ** Pre-Conditions:    called at startup, before the launcher and the job
+ **                    table are set up
+ ** Post-Conditions:   returns only in a session, with the commands to run,
+ **                    or NULL if they are to be read from stdin
+ ******************************************************************************/
+const char *serveClients(const char *path);
+
+
+
+/******************************************************************************
+ ** Function:          startSession()
+ ** Description:       This function sets up a session just forked by the
+ **                    server: it closes the server's descriptors, puts the
+ **                    client's descriptors on 0, 1 and 2, changes to the
+ **                    client's directory, and starts a new session so the
+ **                    server's terminal does not reach its jobs.
+ ** Parameters:        one pointer to const char: dir,
+ **                    one pointer to int: fds,
+ **                    one pointer to struct client: clients,
+ **                    two ints: listenFd, epollFd
+ ** Pre-Conditions:    fds holds the client's three descriptors
+ ** Post-Conditions:   the process is ready to run the client's commands
+ ******************************************************************************/
+void startSession(const char *dir, int *fds, struct client *clients, int listenFd, int epollFd);
+
+
+
+int main(int argc, char** argv)
+{
+    // declare variables
+    bool isInteractive = false;
+    bool useLauncher = false;
+    bool useCache = false;
+    bool hasSyntaxError = false;
+    const char *commandText = NULL;
+    const char *scriptPath = NULL;
+    const char *listenPath = NULL;
+    pid_t parentPid = 0;
+    int inputFd = 0;
+    int i;
+    struct parser parser;
+    struct arena arena = { NULL };
+    struct node *commands;
+    struct node **scriptCommands = NULL;
+    struct node **newCommands;
+    int numScriptCommands = 0;
+    int numCached = 0;
+    int nextCommand = 0;
+    int commandsSize = 0;
+    size_t offset;
+    struct stat scriptInfo;
+    char fullPath[PATH_MAX];
+    char cacheFile[PATH_MAX];
+    struct epoll_event event;
+
+    // commands come from a -c string, a script file, or standard input
+    for (i = 1; i < argc && argv[i][0] == '-'; i++)
+    {
+        if (strcmp(argv[i], "-i") == 0)
+        {
+            isInteractive = true;
+        }
+        else if (strcmp(argv[i], "-l") == 0)
+        {
+            useLauncher = true;
+        }
+        else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+        {
+            commandText = argv[++i];
+        }
+        else if (strcmp(argv[i], "--listen") == 0 && i + 1 < argc)
+        {
+            listenPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--parent") == 0 && i + 2 < argc)
+        {
+            // a $(command) sees the $$ and $? of the shell it came from
+            parentPid = atoi(argv[++i]);
+            lastStatus = atoi(argv[++i]);
+        }
+        else
+        {
+            fprintf(stderr, "usage: smallsh [-i] [-l] [-c command | script | --listen socket]\n");
+            exit(2);
+        }
+    }
+    if (commandText == NULL && i < argc)
+    {
+        scriptPath = argv[i];
+    }
+
+    // with --listen this process only serves clients; each client's
+    // commands run in a session forked from it, which carries on from here
+    if (listenPath != NULL)
+    {
+        commandText = serveClients(listenPath);
+        scriptPath = NULL;
+    }
+    shellPid = (parentPid > 0) ? parentPid : getpid();
+
+    // with -l, commands are started by a small helper forked right away
+    if (useLauncher == true)
+    {
+        startLauncher();
+    }
+
+    // background processes are watched through their pidfds in one epoll
+    // set, so finished children are noticed between prompts and while reading
+    jobs.epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (jobs.epollFd == -1)
+    {
+        perror("smallsh: epoll_create1");
+        exit(1);
+    }
+
+    // time limits share one timerfd, which is watched in the same set
+    jobs.timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+    event.events = EPOLLIN;
+    event.data.ptr = &jobs.timerFd;
+    if (jobs.timerFd == -1 ||
+        epoll_ctl(jobs.epollFd, EPOLL_CTL_ADD, jobs.timerFd, &event) == -1)
+    {
+        perror("smallsh: timerfd");
+        exit(1);
+    }
+
+    // create instance of sigaction struct for foreground processes
+    foreground_act.sa_handler = sigintHandler;
+    foreground_act.sa_flags = SA_RESTART;
+    sigfillset(&(foreground_act.sa_mask));
+    sigaction(SIGINT, &foreground_act, NULL); 
+
+    // create sigaction struct to ignore interrupts the rest of the time
+    restOfTheTime_act.sa_handler = SIG_IGN;
+    restOfTheTime_act.sa_flags = SA_RESTART;
+    sigfillset(&(restOfTheTime_act.sa_mask));
+    sigaction(SIGINT, &restOfTheTime_act, NULL); 
+
+    // a copy stage writing to a closed pipe should fail, not be killed
+    // (spawned commands get the default action back when they start)
+    signal(SIGPIPE, SIG_IGN);
+
+    // SMALLSH_MAX_JOBS limits background jobs from the start, as maxjobs does
+    if (getenv("SMALLSH_MAX_JOBS") != NULL && setJobLimit(getenv("SMALLSH_MAX_JOBS")) == -1)
+    {
+        fprintf(stderr, "smallsh: bad SMALLSH_MAX_JOBS\n");
+    }
+
+    // SMALLSH_PLACEMENT pins jobs to CPUs from the start, as placement does
+    if (getenv("SMALLSH_PLACEMENT") != NULL && startPlacement(getenv("SMALLSH_PLACEMENT")) == -1)
+    {
+        fprintf(stderr, "smallsh: bad SMALLSH_PLACEMENT\n");
+    }
+
+    // SMALLSH_TRACE turns tracing on from the start of the session
+    if (getenv("SMALLSH_TRACE") != NULL && getenv("SMALLSH_TRACE")[0] != '\0')
+    {
+        startTrace();
+    }
+
+    // open the script, if one was named
+    if (scriptPath != NULL)
+    {
+        inputFd = open(scriptPath, O_RDONLY|O_CLOEXEC);
+        if (inputFd == -1)
+        {
+            printf("smallsh: %s", scriptPath);
+            fflush(NULL);
+            perror(" ");
+            exit(127);
+        }
+    }
+
+    // prompt only when a person is typing the commands (or -i asks for it)
+    if (commandText == NULL && scriptPath == NULL && isatty(0))
+    {
+        isInteractive = true;
+
+        // a person at a terminal can stop jobs and move them around
+        startJobControl();
+    }
+
+    if (openReader(&inputReader, (commandText != NULL) ? -1 : inputFd, commandText) == -1)
+    {
+        perror("smallsh");
+        exit(1);
+    }
+
+    // a mapped script can have its parsed commands cached; a cached copy
+    // is run first and parsing picks up where it stopped
+    if (inputReader.isMapped == true && fstat(inputFd, &scriptInfo) == 0 &&
+        scriptCachePath(scriptPath, fullPath, cacheFile) == 0)
+    {
+        useCache = true;
+        if (loadScript(fullPath, cacheFile, &scriptInfo, &arena,
+                       &scriptCommands, &numScriptCommands, &offset) == 0)
+        {
+            numCached = numScriptCommands;
+            commandsSize = numScriptCommands;
+            inputReader.start = offset;
+        }
+    }
+
+    // a mapped script needs no descriptor
+    if (inputReader.isMapped == true)
+    {
+        close(inputFd);
+    }
+
+    openParser(&parser, &inputReader, &arena, isInteractive);
+
+    do
+    {
+        // clean up zombies, reporting any bg jobs that have finished
+        reapChildren();
+
+        if (isInteractive == true)
+        {
+            // flush out prompt each time it is printed
+            fflush(stdout);
+
+            // prompt user for input
+            printf(": ");
+            fflush(stdout);
+        }
+
+        // take the next command from the cache, or parse it; end of input
+        // acts like the exit command
+        if (nextCommand < numScriptCommands)
+        {
+            commands = scriptCommands[nextCommand++];
+        }
+        else
+        {
+            commands = parseCommand(&parser);
+            hasSyntaxError = hasSyntaxError || parser.hasError;
+
+            // keep what was parsed so it can be saved with the script
+            if (useCache == true && commands != NULL)
+            {
+                if (numScriptCommands == commandsSize)
+                {
+                    commandsSize = (commandsSize == 0) ? MIN_BUCKETS : commandsSize * 2;
+                    newCommands = realloc(scriptCommands, commandsSize * sizeof(struct node *));
+                    if (newCommands == NULL)
+                    {
+                        useCache = false;
+                    }
+                    else
+                    {
+                        scriptCommands = newCommands;
+                    }
+                }
+                if (useCache == true)
+                {
+                    scriptCommands[numScriptCommands++] = commands;
+                    nextCommand = numScriptCommands;
+                }
+            }
+        }
+
+        // run the command; an interrupt only stops the one it arrived in
+        isInterrupted = 0;
+        runList(commands);
+
+        // what the whole list printed in the shell goes out together
+        fflush(stdout);
+
+        // the parsed command is not needed again unless it is to be cached
+        if (useCache == false)
+        {
+            clearArena(&arena);
+        }
+
+    } // repeat until user exits shell
+    while (isExiting == false && (parser.isAtEnd == false || nextCommand < numScriptCommands));
+
+    // kill any processes or jobs that shell has started
+    endJobs();
+
+    // hand the terminal back to whoever had it before
+    if (isJobControl == true)
+    {
+        giveTerminal(originalPgid, &shellModes);
+    }
+
+    // save the script's commands if parsing got further than the cache
+    if (useCache == true && hasSyntaxError == false && numScriptCommands > numCached)
+    {
+        saveScript(fullPath, cacheFile, &scriptInfo, scriptCommands,
+                   numScriptCommands, inputReader.start);
+    }
+
+    // like other shells, a script exits with the status of its last command
+    if (WIFSIGNALED(lastStatus))
+    {
+        return 128 + WTERMSIG(lastStatus);
+    }
+    return WEXITSTATUS(lastStatus);
+}
+
+
+
+int reapChildren()
+{
+    struct epoll_event events[MAX_EVENTS];
+    struct process *proc;
+    struct job *job;
+    struct rusage bgUsage;
+    int bgExitStatus;
+    int bgStatus;
+    int numEvents;
+    int numReported = 0;
+    int i;
+
+    // each ready pidfd belongs to a process that has exited
+    while ((numEvents = epoll_wait(jobs.epollFd, events, MAX_EVENTS, 0)) > 0)
+    {
+        for (i = 0; i < numEvents; i++)
+        {
+            // the timerfd says a time limit is due
+            if (events[i].data.ptr == &jobs.timerFd)
+            {
+                expireDeadlines();
+                continue;
+            }
+
+            proc = events[i].data.ptr;
+            traceEvent(TRACE_CHILD, proc->pid, 0);
+
+            if (DEBUG)
+            {
+                printf("Now cleaning up process %d\n", proc->pid);
+            }
+
+            // the pidfd keeps the PID from being reused until this wait
+            if (wait4(proc->pid, &bgStatus, WNOHANG, &bgUsage) <= 0)
+            {
+                continue;
+            }
+            traceEvent(TRACE_REAP, proc->pid, bgStatus);
+
+            markDone(proc, bgStatus, &bgUsage);
+            job = proc->job;
+
+            // once every process in the job is done, print process id and
+            // exit status of its last stage and remove it from the table
+            if (job->numLive == 0)
+            {
+                proc = &job->procs[job->numProcs - 1];
+                bgStatus = proc->status;
+
+                if (WIFEXITED(bgStatus))
+                {
+                    bgExitStatus = WEXITSTATUS(bgStatus);
+                    printf("background pid %d is done: exit value %d.", proc->pid, bgExitStatus);
+                }
+                else
+                {
+                    bgExitStatus = WTERMSIG(bgStatus);
+                    printf("background pid %d is done: terminated by signal %d", proc->pid, bgExitStatus);
+                }
+
+                // say so if the job ran out of time
+                printf("%s\n", (job->limit.step > 0) ? " (timed out)" : "");
+
+                // keep what the job used; its command moves to the history
+                job->use.wallNs = monotonicNs() - job->startNs;
+                recordUsage(job->id, proc->pid, job->command, &job->use);
+                job->command = NULL;
+
+                if (DEBUG)
+                {
+                    printf("Now removing job %d from table.\n", job->id);
+                }
+
+                removeJob(job);
+                numReported++;
+            }
+        }
+    }
+
+    // finished jobs make room for queued ones
+    if (jobs.numQueued > 0)
+    {
+        startQueuedJobs();
+    }
+
+    if (numReported > 0)
+    {
+        fflush(stdout);
+    }
+
+    return numReported;
+}
+
+
+
+char *readLine(struct lineReader *reader, const char *prompt)
+{
+    struct pollfd fds[2];
+    size_t length = 0;
+    size_t count;
+    size_t newSize;
+    ssize_t numRead;
+    char *newLine;
+    char *newline;
+    char *text;
+
+    while (true)
+    {
+        if (reader->start < reader->end)
+        {
+            text = reader->buffer + reader->start;
+            count = reader->end - reader->start;
+            newline = memchr(text, '\n', count);
+
+            // a whole line in the buffer is ended and returned in place
+            if (newline != NULL && length == 0)
+            {
+                *newline = '\0';
+                reader->start += newline - text + 1;
+                return text;
+            }
+
+            // otherwise gather the pieces of the line in reader->line
+            if (newline != NULL)
+            {
+                count = newline - text + 1;
+            }
+
+            if (length + count + 1 > reader->lineSize)
+            {
+                newSize = (reader->lineSize == 0) ? READ_BUFFER : reader->lineSize;
+                while (newSize < length + count + 1)
+                {
+                    newSize *= 2;
+                }
+
+                newLine = realloc(reader->line, newSize);
+                if (newLine == NULL)
+                {
+                    printf("smallsh: line too long\n");
+                    return NULL;
+                }
+                reader->line = newLine;
+                reader->lineSize = newSize;
+            }
+
+            memcpy(reader->line + length, text, count);
+            reader->start += count;
+            length += count;
+
+            if (newline != NULL)
+            {
+                reader->line[length - 1] = '\0';
+                return reader->line;
+            }
+        }
+
+        // a buffer holding all of the input has nothing more to give;
+        // return a final line with no newline
+        if (reader->isComplete == true)
+        {
+            if (length > 0)
+            {
+                reader->line[length] = '\0';
+                return reader->line;
+            }
+            return NULL;
+        }
+
+        // wait for more input or for a child to finish
+        fds[0].fd = reader->fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = jobs.epollFd;
+        fds[1].events = POLLIN;
+
+        if (poll(fds, 2, -1) == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return NULL;
+        }
+
+        if (fds[1].revents & POLLIN)
+        {
+            // report finished jobs now instead of at the next prompt
+            if (reapChildren() > 0 && prompt != NULL && length == 0)
+            {
+                printf("%s", prompt);
+                fflush(stdout);
+            }
+        }
+
+        if (fds[0].revents & (POLLIN|POLLHUP|POLLERR))
+        {
+            numRead = read(reader->fd, reader->buffer, reader->size);
+            if (numRead == -1 && errno == EINTR)
+            {
+                continue;
+            }
+            if (numRead <= 0)
+            {
+                // end of file
+                reader->isComplete = true;
+                continue;
+            }
+
+            reader->start = 0;
+            reader->end = numRead;
+        }
+    }
+}
+
+
+
+int openReader(struct lineReader *reader, int fd, const char *text)
+{
+    struct stat info;
+    void *data;
+
+    reader->fd = fd;
+    reader->start = 0;
+    reader->end = 0;
+    reader->isMapped = false;
+    reader->isComplete = false;
+    reader->line = NULL;
+    reader->lineSize = 0;
+
+    // a command string is copied so its lines can be ended in place
+    if (text != NULL)
+    {
+        reader->buffer = strdup(text);
+        if (reader->buffer == NULL)
+        {
+            return -1;
+        }
+        reader->size = strlen(text);
+        reader->end = reader->size;
+        reader->isComplete = true;
+        return 0;
+    }
+
+    // a script file is mapped whole; the private mapping takes the NULs
+    // written at line ends without touching the file
+    if (fd != 0 && fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0)
+    {
+        data = mmap(NULL, info.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED)
+        {
+            reader->buffer = data;
+            reader->size = info.st_size;
+            reader->end = reader->size;
+            reader->isMapped = true;
+            reader->isComplete = true;
+            return 0;
+        }
+    }
+
+    // anything else is read a large block at a time as it arrives
+    reader->size = READ_BUFFER;
+    reader->buffer = malloc(reader->size);
+    if (reader->buffer == NULL)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+
+
+void sigintHandler()
+{
+    int i;
+
+    // if interrupt signal occurs while fg pipeline is running, kill it
+    if (fgPgid > 0)
+    {
+        // the fg job has its own group, so one kill reaches all of it
+        kill(-fgPgid, SIGKILL);
+        signalNum = 2;
+    }
+    else if (numFgPids > 0)
+    {
+        // kill every process in the foreground pipeline
+        for (i = 0; i < numFgPids; i++)
+        {
+            pidfd_send_signal(fgPidfd[i], SIGKILL, NULL, 0);
+        }
+ 
+        // set global variable for status messages
+        signalNum = 2;  
+    }  
+
+    // stop the rest of the commands on the line, or the loop running
+    isInterrupted = 1;
+
+    // ignore interrupt signal for all other processes
+    // and simply return
+    return;
+}
+
+
+
+void openParser(struct parser *ps, struct lineReader *reader, struct arena *arena, bool isInteractive)
+{
+    memset(ps, 0, sizeof(*ps));
+    ps->reader = reader;
+    ps->arena = arena;
+    ps->isInteractive = isInteractive;
+    ps->p = NULL;
+}
+
+
+
+struct node *parseCommand(struct parser *ps)
+{
+    struct node *list;
+
+    ps->numLines = 0;
+    ps->depth = 0;
+    ps->hasError = false;
+
+    if (peekToken(ps) == TOKEN_END)
+    {
+        return NULL;
+    }
+
+    list = parseList(ps, true);
+    if (ps->hasError == true)
+    {
+        // drop whatever is left of the line the error was found on, and
+        // the bodies of its here-documents
+        ps->p = NULL;
+        ps->hasToken = false;
+        readHeredocs(ps);
+        return NULL;
+    }
+
+    // use up the newline that ended the command, and the here-documents
+    // that follow it
+    if (peekToken(ps) == TOKEN_NEWLINE)
+    {
+        takeToken(ps);
+    }
+    readHeredocs(ps);
+    if (ps->hasError == true)
+    {
+        return NULL;
+    }
+
+    traceEvent(TRACE_PARSE, 0, ps->numLines);
+    return list;
+}
+
+
+
+struct node *parseList(struct parser *ps, bool isTopLevel)
+{
+    struct node *head = NULL;
+    struct node **tail = &head;
+    struct node *item;
+    enum tokenType type;
+
+    while (true)
+    {
+        type = peekToken(ps);
+
+        if (type == TOKEN_END || (type == TOKEN_NEWLINE && isTopLevel == true))
+        {
+            break;
+        }
+
+        // blank lines may appear anywhere inside if, while and for
+        if (type == TOKEN_NEWLINE)
+        {
+            takeToken(ps);
+            continue;
+        }
+
+        if (type == TOKEN_WORD && isCloser(ps) == true)
+        {
+            if (isTopLevel == true)
+            {
+                parseError(ps, NULL);
+                return NULL;
+            }
+            break;
+        }
+
+        // a word starting with # where a command would begin is a comment;
+        // the rest of the line is ignored
+        if (type == TOKEN_WORD && ps->word[0] == '#')
+        {
+            ps->p = "";
+            ps->hasToken = false;
+            continue;
+        }
+
+        item = parseAndOr(ps);
+        if (item == NULL)
+        {
+            return NULL;
+        }
+        *tail = item;
+        tail = &item->next;
+
+        // a command is followed by ; or the end of the line or list
+        type = peekToken(ps);
+        if (type == TOKEN_SEMI)
+        {
+            takeToken(ps);
+        }
+        else if (type != TOKEN_NEWLINE && type != TOKEN_END &&
+                 (type != TOKEN_WORD || isCloser(ps) == false))
+        {
+            parseError(ps, NULL);
+            return NULL;
+        }
+    }
+
+    return head;
+}
+
+
+
+struct node *parseAndOr(struct parser *ps)
+{
+    struct node *left;
+    struct node *right;
+    struct node *node;
+    enum tokenType type;
+
+    left = parsePipeline(ps);
+
+    while (left != NULL)
+    {
+        type = peekToken(ps);
+        if (type != TOKEN_AND && type != TOKEN_OR)
+        {
+            break;
+        }
+        takeToken(ps);
+
+        // the command after the operator may be on the next line
+        while (peekToken(ps) == TOKEN_NEWLINE)
+        {
+            takeToken(ps);
+        }
+
+        right = parsePipeline(ps);
+        node = newNode(ps, (type == TOKEN_AND) ? NODE_AND : NODE_OR);
+        if (right == NULL || node == NULL)
+        {
+            return NULL;
+        }
+        node->first = left;
+        node->second = right;
+        left = node;
+    }
+
+    return left;
+}
+
+
+
+struct node *parsePipeline(struct parser *ps)
+{
+    struct node *node;
+    enum tokenType type;
+    enum nodeType kind;
+
+    type = peekToken(ps);
+
+    if (type == TOKEN_WORD &&
+        (isKeyword(ps, "if") || isKeyword(ps, "while") || isKeyword(ps, "for")))
+    {
+        kind = (ps->word[0] == 'i') ? NODE_IF :
+               (ps->word[0] == 'w') ? NODE_WHILE : NODE_FOR;
+        takeToken(ps);
+
+        ps->depth++;
+        node = (kind == NODE_IF) ? parseIf(ps) : parseLoop(ps, kind);
+        ps->depth--;
+
+        return node;
+    }
+
+    if (type != TOKEN_WORD && type != TOKEN_PIPE && type != TOKEN_LESS &&
+        type != TOKEN_GREAT && type != TOKEN_AMP &&
+        type != TOKEN_HEREDOC && type != TOKEN_HERESTRING)
+    {
+        parseError(ps, NULL);
+        return NULL;
+    }
+
+    return parseSimple(ps);
+}
+
+
+
+struct node *parseSimple(struct parser *ps)
+{
+    bool isBackground = false;
+    char **target = NULL;
+    enum tokenType redirection = TOKEN_END;
+    struct heredoc *doc;
+    bool isHeredocStripped = false;
+    char **argv;
+    int numStages = 1;
+    int numWords = 0;
+    int i;
+    int j;
+    struct command *stage = &ps->stages[0];
+    struct pipeline *pl;
+    struct node *node;
+    enum tokenType type;
+
+    stage->argc = 0;
+    stage->argv = ps->words;
+    stage->inputFile = NULL;
+    stage->inputText = NULL;
+    stage->outputFile = NULL;
+
+    while (true)
+    {
+        type = peekToken(ps);
+
+        if (target != NULL)
+        {
+            // the word after < or > names the file, whatever it is
+            if (type == TOKEN_NEWLINE || type == TOKEN_SEMI || type == TOKEN_END)
+            {
+                parseError(ps, "missing file name for redirection");
+                return NULL;
+            }
+            if (redirection == TOKEN_HERESTRING)
+            {
+                // a here-string is the word and a newline
+                *target = arenaAlloc(ps->arena, ps->length + 2);
+                if (*target != NULL)
+                {
+                    memcpy(*target, ps->word, ps->length);
+                    (*target)[ps->length] = '\n';
+                }
+            }
+            else
+            {
+                *target = arenaString(ps->arena, ps->word, ps->length);
+            }
+            if (*target == NULL)
+            {
+                parseError(ps, "out of memory");
+                return NULL;
+            }
+
+            // the last input redirection is the one used
+            if (redirection == TOKEN_LESS)
+            {
+                stage->inputText = NULL;
+            }
+            else if (redirection != TOKEN_GREAT)
+            {
+                stage->inputFile = NULL;
+            }
+
+            // a here-document's body comes after this line; until then
+            // it is empty
+            if (redirection == TOKEN_HEREDOC)
+            {
+                if (ps->numHeredocs == MAX_STAGES)
+                {
+                    parseError(ps, "too many here-documents");
+                    return NULL;
+                }
+                doc = &ps->heredocs[ps->numHeredocs++];
+                doc->delimiter = stage->inputText;
+                doc->target = &stage->inputText;
+                doc->pl = NULL;
+                doc->isStripped = isHeredocStripped;
+                stage->inputText = "";
+            }
+            takeToken(ps);
+            target = NULL;
+        }
+        else if (type == TOKEN_LESS)
+        {
+            takeToken(ps);
+            target = &stage->inputFile;
+            redirection = type;
+        }
+        else if (type == TOKEN_HEREDOC || type == TOKEN_HERESTRING)
+        {
+            isHeredocStripped = (ps->length == 3);
+            takeToken(ps);
+            target = &stage->inputText;
+            redirection = type;
+        }
+        else if (type == TOKEN_GREAT)
+        {
+            takeToken(ps);
+            target = &stage->outputFile;
+            redirection = type;
+        }
+        else if (type == TOKEN_PIPE)
+        {
+            if (stage->argc == 0 && stage->inputFile == NULL &&
+                stage->inputText == NULL && stage->outputFile == NULL)
+            {
+                parseError(ps, "missing command before |");
+                return NULL;
+            }
+            if (numStages == MAX_STAGES)
+            {
+                parseError(ps, "too many commands in pipeline");
+                return NULL;
+            }
+            takeToken(ps);
+
+            // end this stage's args and start the next stage after them
+            stage->argv[stage->argc] = NULL;
+            stage = &ps->stages[numStages++];
+            stage->argc = 0;
+            stage->argv = ps->stages[numStages - 2].argv +
+                          ps->stages[numStages - 2].argc + 1;
+            stage->inputFile = NULL;
+            stage->inputText = NULL;
+            stage->outputFile = NULL;
+        }
+        else if (type == TOKEN_AMP &&
+                 (numWords > 0 || numStages > 1 || stage->inputFile != NULL ||
+                  stage->inputText != NULL || stage->outputFile != NULL))
+        {
+            takeToken(ps);
+
+            // an & that ends the pipeline runs it in the background
+            type = peekToken(ps);
+            if (type == TOKEN_NEWLINE || type == TOKEN_SEMI || type == TOKEN_END ||
+                (type == TOKEN_WORD && ps->depth > 0 && isCloser(ps) == true))
+            {
+                isBackground = true;
+                break;
+            }
+
+            // an & that was not last is an ordinary argument
+            if (numWords == MAX_ARGS)
+            {
+                parseError(ps, "too many arguments");
+                return NULL;
+            }
+            if (addWord(ps, stage, "&", 1) == -1)
+            {
+                return NULL;
+            }
+            numWords++;
+        }
+        else if (type == TOKEN_WORD || type == TOKEN_AMP)
+        {
+            if (numWords == MAX_ARGS)
+            {
+                parseError(ps, "too many arguments");
+                return NULL;
+            }
+            if (addWord(ps, stage, ps->word, ps->length) == -1)
+            {
+                return NULL;
+            }
+            takeToken(ps);
+            numWords++;
+        }
+        else
+        {
+            // ; && || and the end of the line end the pipeline
+            break;
+        }
+    }
+
+    if (target != NULL)
+    {
+        parseError(ps, "missing file name for redirection");
+        return NULL;
+    }
+
+    if (numStages > 1 && stage->argc == 0 && stage->inputFile == NULL &&
+        stage->inputText == NULL && stage->outputFile == NULL)
+    {
+        parseError(ps, "missing command after |");
+        return NULL;
+    }
+
+    stage->argv[stage->argc] = NULL;
+
+    // copy the pipeline out of the scratch space, each argv sized exactly
+    node = newNode(ps, NODE_PIPELINE);
+    pl = arenaAlloc(ps->arena, sizeof(struct pipeline));
+    if (node == NULL || pl == NULL ||
+        (pl->stages = arenaAlloc(ps->arena, numStages * sizeof(struct command))) == NULL)
+    {
+        parseError(ps, "out of memory");
+        return NULL;
+    }
+    pl->numStages = numStages;
+    pl->isBackground = isBackground;
+    for (i = 0; i < numStages; i++)
+    {
+        pl->stages[i] = ps->stages[i];
+        argv = arenaAlloc(ps->arena, (ps->stages[i].argc + 1) * sizeof(char *));
+        if (argv == NULL)
+        {
+            parseError(ps, "out of memory");
+            return NULL;
+        }
+        memcpy(argv, ps->stages[i].argv, (ps->stages[i].argc + 1) * sizeof(char *));
+        pl->stages[i].argv = argv;
+
+        // here-document bodies read later go to the copy
+        for (j = 0; j < ps->numHeredocs; j++)
+        {
+            if (ps->heredocs[j].target == &ps->stages[i].inputText)
+            {
+                ps->heredocs[j].target = &pl->stages[i].inputText;
+                ps->heredocs[j].pl = pl;
+            }
+        }
+    }
+    pl->hasExpansions = needsExpansion(pl);
+    node->pl = pl;
+
+    if (DEBUG)
+    {
+        for (i = 0; i < pl->numStages; i++)
+        {
+            for (j = 0; j < pl->stages[i].argc; j++)
+            {
+                printf("stage %d args[%d] is: %s\n", i, j, pl->stages[i].argv[j]);
+            }
+        }
+    }
+
+    return node;
+}
+
+
+
+struct node *parseIf(struct parser *ps)
+{
+    struct node *node;
+
+    node = newNode(ps, NODE_IF);
+    if (node == NULL)
+    {
+        return NULL;
+    }
+
+    node->cond = parseList(ps, false);
+    if (expectKeyword(ps, "then", node->cond) == -1)
+    {
+        return NULL;
+    }
+
+    node->body = parseList(ps, false);
+    if (ps->hasError == true)
+    {
+        return NULL;
+    }
+
+    if (node->body != NULL && isKeyword(ps, "elif"))
+    {
+        // the rest is another if, which uses up the fi
+        takeToken(ps);
+        node->orElse = parseIf(ps);
+        return (node->orElse == NULL) ? NULL : node;
+    }
+
+    if (node->body != NULL && isKeyword(ps, "else"))
+    {
+        takeToken(ps);
+        node->orElse = parseList(ps, false);
+        if (expectKeyword(ps, "fi", node->orElse) == -1)
+        {
+            return NULL;
+        }
+        return node;
+    }
+
+    if (expectKeyword(ps, "fi", node->body) == -1)
+    {
+        return NULL;
+    }
+
+    return node;
+}
+
+
+
+struct node *parseLoop(struct parser *ps, enum nodeType type)
+{
+    struct node *node;
+    enum tokenType next;
+    int numWords = 0;
+    int i;
+
+    node = newNode(ps, type);
+    if (node == NULL)
+    {
+        return NULL;
+    }
+
+    if (type == NODE_FOR)
+    {
+        // the variable name is letters, digits and _, not starting with
+        // a digit, so it can be put in the environment
+        if (peekToken(ps) != TOKEN_WORD || isdigit((unsigned char) ps->word[0]))
+        {
+            parseError(ps, NULL);
+            return NULL;
+        }
+        for (i = 0; i < (int) ps->length; i++)
+        {
+            if (!isalnum((unsigned char) ps->word[i]) && ps->word[i] != '_')
+            {
+                parseError(ps, NULL);
+                return NULL;
+            }
+        }
+        node->name = arenaString(ps->arena, ps->word, ps->length);
+        if (node->name == NULL)
+        {
+            parseError(ps, "out of memory");
+            return NULL;
+        }
+        takeToken(ps);
+
+        // gather the words after in up to the end of the line or ;
+        if (isKeyword(ps, "in"))
+        {
+            takeToken(ps);
+            while (peekToken(ps) == TOKEN_WORD)
+            {
+                if (numWords == MAX_ARGS)
+                {
+                    parseError(ps, "too many arguments");
+                    return NULL;
+                }
+                ps->words[numWords] = arenaString(ps->arena, ps->word, ps->length);
+                if (ps->words[numWords] == NULL)
+                {
+                    parseError(ps, "out of memory");
+                    return NULL;
+                }
+                numWords++;
+                takeToken(ps);
+            }
+        }
+
+        next = peekToken(ps);
+        if (next != TOKEN_SEMI && next != TOKEN_NEWLINE && !isKeyword(ps, "do"))
+        {
+            parseError(ps, NULL);
+            return NULL;
+        }
+        if (next != TOKEN_WORD)
+        {
+            takeToken(ps);
+        }
+        while (peekToken(ps) == TOKEN_NEWLINE)
+        {
+            takeToken(ps);
+        }
+
+        node->numWords = numWords;
+        node->words = arenaAlloc(ps->arena, (numWords + 1) * sizeof(char *));
+        if (node->words == NULL)
+        {
+            parseError(ps, "out of memory");
+            return NULL;
+        }
+        memcpy(node->words, ps->words, numWords * sizeof(char *));
+
+        // with no list in front of it, do is still required
+        if (expectKeyword(ps, "do", node) == -1)
+        {
+            return NULL;
+        }
+    }
+    else
+    {
+        node->cond = parseList(ps, false);
+        if (expectKeyword(ps, "do", node->cond) == -1)
+        {
+            return NULL;
+        }
+    }
+
+    node->body = parseList(ps, false);
+    if (expectKeyword(ps, "done", node->body) == -1)
+    {
+        return NULL;
+    }
+
+    return node;
+}
+
+
+
+enum tokenType peekToken(struct parser *ps)
+{
+    char *start;
+    char *p;
+    int depth;
+    int i;
+
+    if (ps->hasToken == true)
+    {
+        return ps->type;
+    }
+    ps->hasToken = true;
+
+    // read another line once the last one is used up, after the bodies
+    // of any here-documents on it
+    if (ps->p == NULL)
+    {
+        if (ps->numHeredocs > 0)
+        {
+            readHeredocs(ps);
+        }
+
+        if (ps->isAtEnd == false && ps->isInteractive == true && ps->numLines > 0)
+        {
+            printf("> ");
+            fflush(stdout);
+        }
+
+        if (ps->isAtEnd == false)
+        {
+            ps->p = readLine(ps->reader, (ps->isInteractive == false) ? NULL :
+                                         (ps->numLines > 0) ? "> " : ": ");
+        }
+        if (ps->p == NULL)
+        {
+            ps->isAtEnd = true;
+            ps->type = TOKEN_END;
+            ps->word = "end of file";
+            ps->length = strlen(ps->word);
+            return ps->type;
+        }
+        ps->numLines++;
+        traceEvent(TRACE_READ, 0, ps->numLines);
+    }
+
+    // skip leading / duplicate / trailing spaces
+    p = ps->p;
+    while (*p == ' ' || *p == '\t' || *p == '\r')
+    {
+        p++;
+    }
+
+    if (*p == '\0')
+    {
+        ps->type = TOKEN_NEWLINE;
+        ps->word = "newline";
+        ps->length = strlen(ps->word);
+        ps->p = NULL;
+        return ps->type;
+    }
+
+    // a ; ends a word even when it is not set apart by spaces, except
+    // inside $( ), which holds a whole command
+    start = p;
+    if (*p == ';')
+    {
+        p++;
+    }
+    else
+    {
+        for (depth = 0; *p != '\0'; p++)
+        {
+            if (p[0] == '$' && p[1] == '(')
+            {
+                depth++;
+                p++;
+            }
+            else if (*p == '(' && depth > 0)
+            {
+                depth++;
+            }
+            else if (*p == ')' && depth > 0)
+            {
+                depth--;
+            }
+            else if (depth == 0 && (*p == ' ' || *p == '\t' || *p == '\r' || *p == ';'))
+            {
+                break;
+            }
+        }
+        if (depth > 0)
+        {
+            parseError(ps, "missing ) in command substitution");
+        }
+    }
+    ps->p = p;
+    ps->word = start;
+    ps->length = p - start;
+
+    // << <<- and <<< may run into the word after them
+    if (ps->length > 2 && start[0] == '<' && start[1] == '<')
+    {
+        i = (start[2] == '<' || start[2] == '-') ? 3 : 2;
+        if (ps->length > (size_t) i)
+        {
+            ps->p = start + i;
+            ps->length = i;
+        }
+    }
+
+    // every other operator is a word of its own
+    if (ps->length == 1 && start[0] == ';')
+    {
+        ps->type = TOKEN_SEMI;
+    }
+    else if (ps->length == 1 && start[0] == '|')
+    {
+        ps->type = TOKEN_PIPE;
+    }
+    else if (ps->length == 1 && start[0] == '<')
+    {
+        ps->type = TOKEN_LESS;
+    }
+    else if (ps->length == 1 && start[0] == '>')
+    {
+        ps->type = TOKEN_GREAT;
+    }
+    else if ((ps->length == 2 && memcmp(start, "<<", 2) == 0) ||
+             (ps->length == 3 && memcmp(start, "<<-", 3) == 0))
+    {
+        ps->type = TOKEN_HEREDOC;
+    }
+    else if (ps->length == 3 && memcmp(start, "<<<", 3) == 0)
+    {
+        ps->type = TOKEN_HERESTRING;
+    }
+    else if (ps->length == 1 && start[0] == '&')
+    {
+        ps->type = TOKEN_AMP;
+    }
+    else if (ps->length == 2 && start[0] == '&' && start[1] == '&')
+    {
+        ps->type = TOKEN_AND;
+    }
+    else if (ps->length == 2 && start[0] == '|' && start[1] == '|')
+    {
+        ps->type = TOKEN_OR;
+    }
+    else
+    {
+        ps->type = TOKEN_WORD;
+    }
+
+    return ps->type;
+}
+
+
+
+void takeToken(struct parser *ps)
+{
+    ps->hasToken = false;
+}
+
+
+
+bool isKeyword(struct parser *ps, const char *keyword)
+{
+    return peekToken(ps) == TOKEN_WORD && ps->length == strlen(keyword) &&
+           memcmp(ps->word, keyword, ps->length) == 0;
+}
+
+
+
+bool isCloser(struct parser *ps)
+{
+    return isKeyword(ps, "then") || isKeyword(ps, "else") ||
+           isKeyword(ps, "elif") || isKeyword(ps, "fi") ||
+           isKeyword(ps, "do") || isKeyword(ps, "done");
+}
+
+
+
+int expectKeyword(struct parser *ps, const char *keyword, struct node *part)
+{
+    if (ps->hasError == true)
+    {
+        return -1;
+    }
+
+    if (part == NULL || isKeyword(ps, keyword) == false)
+    {
+        parseError(ps, NULL);
+        return -1;
+    }
+
+    takeToken(ps);
+    return 0;
+}
+
+
+
+void parseError(struct parser *ps, const char *message)
+{
+    if (ps->hasError == true)
+    {
+        return;
+    }
+    ps->hasError = true;
+
+    if (message != NULL)
+    {
+        printf("smallsh: %s\n", message);
+    }
+    else
+    {
+        peekToken(ps);
+        printf("smallsh: syntax error near %.*s\n", (int) ps->length, ps->word);
+    }
+    fflush(stdout);
+}
+
+
+
+void readHeredocs(struct parser *ps)
+{
+    struct heredoc *doc;
+    char *line;
+    int i;
+
+    for (i = 0; i < ps->numHeredocs; i++)
+    {
+        doc = &ps->heredocs[i];
+        ps->body.length = 0;
+
+        while (true)
+        {
+            if (ps->isInteractive == true)
+            {
+                printf("> ");
+                fflush(stdout);
+            }
+
+            line = (ps->isAtEnd == true) ? NULL :
+                   readLine(ps->reader, (ps->isInteractive == true) ? "> " : NULL);
+            if (line == NULL)
+            {
+                // like other shells, use what there is
+                ps->isAtEnd = true;
+                printf("smallsh: here-document ended by end of file (wanted %s)\n",
+                       doc->delimiter);
+                fflush(stdout);
+                break;
+            }
+            ps->numLines++;
+            traceEvent(TRACE_READ, 0, ps->numLines);
+
+            if (doc->isStripped == true)
+            {
+                while (*line == '\t')
+                {
+                    line++;
+                }
+            }
+            if (strcmp(line, doc->delimiter) == 0)
+            {
+                break;
+            }
+
+            putBytes(&ps->body, line, strlen(line));
+            putBytes(&ps->body, "\n", 1);
+        }
+
+        *doc->target = arenaString(ps->arena, (ps->body.data != NULL) ? ps->body.data : "",
+                                   ps->body.length);
+        if (ps->body.hasError == true || *doc->target == NULL)
+        {
+            ps->body.hasError = false;
+            *doc->target = "";
+            parseError(ps, "out of memory");
+        }
+
+        // a body with a $ in it is expanded when the command runs
+        if (doc->pl != NULL && strchr(*doc->target, '$') != NULL)
+        {
+            doc->pl->hasExpansions = true;
+        }
+    }
+
+    ps->numHeredocs = 0;
+}
+
+
+
+int addWord(struct parser *ps, struct command *stage, const char *text, size_t length)
+{
+    char *word;
+
+    word = arenaString(ps->arena, text, length);
+    if (word == NULL)
+    {
+        parseError(ps, "out of memory");
+        return -1;
+    }
+
+    stage->argv[stage->argc++] = word;
+    return 0;
+}
+
+
+
+struct node *newNode(struct parser *ps, enum nodeType type)
+{
+    struct node *node;
+
+    node = arenaAlloc(ps->arena, sizeof(struct node));
+    if (node == NULL)
+    {
+        parseError(ps, "out of memory");
+        return NULL;
+    }
+
+    node->type = type;
+    return node;
+}
+
+
+
+void *arenaAlloc(struct arena *arena, size_t size)
+{
+    struct arenaBlock *block = arena->blocks;
+    size_t blockSize;
+    void *data;
+
+    // keep everything aligned for any type
+    size = (size + 15) & ~(size_t) 15;
+
+    if (block == NULL || block->size - block->used < size)
+    {
+        blockSize = (size > ARENA_BLOCK) ? size : ARENA_BLOCK;
+        block = malloc(sizeof(struct arenaBlock) + blockSize);
+        if (block == NULL)
+        {
+            return NULL;
+        }
+        block->size = blockSize;
+        block->used = 0;
+        block->next = arena->blocks;
+        arena->blocks = block;
+    }
+
+    data = block->data + block->used;
+    block->used += size;
+    memset(data, 0, size);
+
+    return data;
+}
+
+
+
+char *arenaString(struct arena *arena, const char *text, size_t length)
+{
+    char *copy;
+
+    copy = arenaAlloc(arena, length + 1);
+    if (copy == NULL)
+    {
+        return NULL;
+    }
+
+    memcpy(copy, text, length);
+    copy[length] = '\0';
+
+    return copy;
+}
+
+
+
+void clearArena(struct arena *arena)
+{
+    struct arenaBlock *block;
+
+    // free all but the oldest block, which is kept for the next command
+    while (arena->blocks != NULL && arena->blocks->next != NULL)
+    {
+        block = arena->blocks;
+        arena->blocks = block->next;
+        free(block);
+    }
+
+    if (arena->blocks != NULL)
+    {
+        arena->blocks->used = 0;
+    }
+}
+
+
+
+bool needsExpansion(struct pipeline *pl)
+{
+    struct command *stage;
+    int i;
+    int j;
+
+    for (i = 0; i < pl->numStages; i++)
+    {
+        stage = &pl->stages[i];
+        for (j = 0; j < stage->argc; j++)
+        {
+            if (strchr(stage->argv[j], '$') != NULL ||
+                hasPattern(stage->argv[j]) == true)
+            {
+                return true;
+            }
+        }
+        if ((stage->inputFile != NULL && strchr(stage->inputFile, '$') != NULL) ||
+            (stage->inputText != NULL && strchr(stage->inputText, '$') != NULL) ||
+            (stage->outputFile != NULL && strchr(stage->outputFile, '$') != NULL))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+
+int expandPipeline(struct pipeline *pl, struct pipeline *expanded, struct command *stages)
+{
+    struct command *stage;
+    char **files[3];
+    int i;
+    int j;
+
+    // the words of the last pipeline are no longer in use
+    clearArena(&expander.arena);
+
+    *expanded = *pl;
+    expanded->stages = stages;
+
+    for (i = 0; i < pl->numStages; i++)
+    {
+        stage = &stages[i];
+        *stage = pl->stages[i];
+
+        stage->argv = expandWords(&expander.arena, stage->argv, &stage->argc);
+        if (stage->argv == NULL)
+        {
+            break;
+        }
+
+        // a file name or here-document stays one word, whatever it
+        // expands to
+        files[0] = &stage->inputFile;
+        files[1] = &stage->inputText;
+        files[2] = &stage->outputFile;
+        for (j = 0; j < 3; j++)
+        {
+            if (*files[j] == NULL)
+            {
+                continue;
+            }
+            expander.numFields = 0;
+            if (expandWord(&expander.arena, *files[j], false) == -1)
+            {
+                break;
+            }
+            *files[j] = expander.fields[0];
+        }
+        if (j < 3)
+        {
+            break;
+        }
+    }
+
+    if (i < pl->numStages)
+    {
+        // an interrupted $(command) has already been reported
+        if (isInterrupted == 0)
+        {
+            printf("smallsh: out of memory\n");
+            fflush(stdout);
+        }
+        return -1;
+    }
+
+    if (DEBUG)
+    {
+        for (i = 0; i < expanded->numStages; i++)
+        {
+            for (j = 0; j < stages[i].argc; j++)
+            {
+                printf("stage %d expanded args[%d] is: %s\n", i, j, stages[i].argv[j]);
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+
+char **expandWords(struct arena *arena, char **words, int *numWords)
+{
+    char **args;
+    int i;
+
+    for (i = 0; i < *numWords && strchr(words[i], '$') == NULL &&
+                hasPattern(words[i]) == false; i++)
+    {
+    }
+    if (i == *numWords)
+    {
+        return words;
+    }
+
+    expander.numFields = 0;
+    for (i = 0; i < *numWords; i++)
+    {
+        if (expandWord(arena, words[i], true) == -1)
+        {
+            return NULL;
+        }
+    }
+
+    args = arenaAlloc(arena, (expander.numFields + 1) * sizeof(char *));
+    if (args == NULL)
+    {
+        return NULL;
+    }
+    memcpy(args, expander.fields, expander.numFields * sizeof(char *));
+    *numWords = expander.numFields;
+
+    return args;
+}
+
+
+
+int expandWord(struct arena *arena, const char *word, bool isSplit)
+{
+    const char *p = word;
+    const char *start;
+    const char *value;
+    char *text;
+    char number[24];
+    ssize_t length;
+    int depth;
+
+    if (strchr(word, '$') == NULL)
+    {
+        if (isSplit == true && hasPattern(word) == true)
+        {
+            return globField(arena, (char *) word);
+        }
+        return addField((char *) word);
+    }
+
+    // a file name is one field even if it expands to nothing
+    expander.length = 0;
+    expander.hasField = (isSplit == false);
+    expander.isGlobbed = isSplit;
+
+    while (*p != '\0')
+    {
+        // plain text up to the next $ is kept as it is
+        start = p;
+        while (*p != '\0' && *p != '$')
+        {
+            p++;
+        }
+        if (p > start && addText(arena, start, p - start, false) == -1)
+        {
+            return -1;
+        }
+        if (*p == '\0')
+        {
+            break;
+        }
+        p++;
+
+        if (*p == '$')
+        { // the shell's process id
+            snprintf(number, sizeof(number), "%d", (int) shellPid);
+            value = number;
+            length = strlen(number);
+            p++;
+        }
+        else if (*p == '?')
+        { // the status of the last command, as a number
+            snprintf(number, sizeof(number), "%d", WIFSIGNALED(lastStatus) ?
+                     128 + WTERMSIG(lastStatus) : WEXITSTATUS(lastStatus));
+            value = number;
+            length = strlen(number);
+            p++;
+        }
+        else if (isalpha((unsigned char) *p) || *p == '_')
+        { // a variable from the environment; an unset one is empty
+            start = p;
+            while (isalnum((unsigned char) *p) || *p == '_')
+            {
+                p++;
+            }
+            text = arenaString(arena, start, p - start);
+            if (text == NULL)
+            {
+                return -1;
+            }
+            value = getenv(text);
+            length = (value == NULL) ? 0 : strlen(value);
+        }
+        else if (*p == '(')
+        { // what a command prints
+            start = ++p;
+            for (depth = 1; *p != '\0'; p++)
+            {
+                if (*p == '(')
+                {
+                    depth++;
+                }
+                else if (*p == ')' && --depth == 0)
+                {
+                    break;
+                }
+            }
+
+            // the parser does not allow an unclosed one; keep it as text
+            if (*p == '\0')
+            {
+                if (addText(arena, start - 2, p - start + 2, false) == -1)
+                {
+                    return -1;
+                }
+                break;
+            }
+
+            text = arenaString(arena, start, p - start);
+            p++;
+            if (text == NULL || (length = captureOutput(text)) == -1)
+            {
+                return -1;
+            }
+            value = expander.output.data;
+        }
+        else
+        { // a $ before anything else is just a $
+            if (addText(arena, "$", 1, false) == -1)
+            {
+                return -1;
+            }
+            continue;
+        }
+
+        if (length > 0 && addText(arena, value, length, isSplit) == -1)
+        {
+            return -1;
+        }
+    }
+
+    if (expander.hasField == true)
+    {
+        return endField(arena);
+    }
+
+    return 0;
+}
+
+
+
+int addText(struct arena *arena, const char *text, size_t length, bool isSplit)
+{
+    size_t newSize;
+    char *newText;
+    size_t i;
+
+    // make room for all of it; splitting only ever takes some away
+    if (expander.length + length + 1 > expander.size)
+    {
+        newSize = (expander.size == 0) ? 256 : expander.size;
+        while (newSize < expander.length + length + 1)
+        {
+            newSize *= 2;
+        }
+        newText = realloc(expander.text, newSize);
+        if (newText == NULL)
+        {
+            return -1;
+        }
+        expander.text = newText;
+        expander.size = newSize;
+    }
+
+    if (isSplit == false)
+    {
+        memcpy(expander.text + expander.length, text, length);
+        expander.length += length;
+        expander.hasField = true;
+        return 0;
+    }
+
+    // each run of blanks ends a field
+    for (i = 0; i < length; i++)
+    {
+        if (text[i] == ' ' || text[i] == '\t' || text[i] == '\n')
+        {
+            if (expander.hasField == true && endField(arena) == -1)
+            {
+                return -1;
+            }
+        }
+        else
+        {
+            expander.text[expander.length++] = text[i];
+            expander.hasField = true;
+        }
+    }
+
+    return 0;
+}
+
+
+
+int endField(struct arena *arena)
+{
+    char *field;
+
+    field = arenaString(arena, (expander.text != NULL) ? expander.text : "",
+                        expander.length);
+    expander.length = 0;
+    expander.hasField = false;
+
+    if (field == NULL)
+    {
+        return -1;
+    }
+
+    if (expander.isGlobbed == true && hasPattern(field) == true)
+    {
+        return globField(arena, field);
+    }
+    return addField(field);
+}
+
+
+
+int addField(char *field)
+{
+    char **newFields;
+    int newSize;
+
+    if (expander.numFields == expander.fieldsSize)
+    {
+        newSize = (expander.fieldsSize == 0) ? MIN_BUCKETS : expander.fieldsSize * 2;
+        newFields = realloc(expander.fields, newSize * sizeof(char *));
+        if (newFields == NULL)
+        {
+            return -1;
+        }
+        expander.fields = newFields;
+        expander.fieldsSize = newSize;
+    }
+
+    expander.fields[expander.numFields++] = field;
+    return 0;
+}
+
+
+
+bool hasPattern(const char *text)
+{
+    return strpbrk(text, "*?[") != NULL;
+}
+
+
+
+int globField(struct arena *arena, char *pattern)
+{
+    char path[PATH_MAX];
+    const char *rest = pattern;
+    size_t length = 0;
+    int first = expander.numFields;
+
+    // an absolute pattern starts from the root
+    while (*rest == '/' && length < sizeof(path) - 1)
+    {
+        path[length++] = *rest++;
+    }
+    path[length] = '\0';
+
+    if (globPath(arena, path, length, rest) == -1)
+    {
+        return -1;
+    }
+
+    if (expander.numFields == first)
+    {
+        return addField(pattern);
+    }
+
+    qsort(expander.fields + first, expander.numFields - first,
+          sizeof(char *), compareNames);
+
+    return 0;
+}
+
+
+
+int globPath(struct arena *arena, char *path, size_t length, const char *rest)
+{
+    struct byteBuffer dirs = { NULL, 0, 0, 0, false };
+    struct dirListing *listing;
+    struct stat info;
+    const char *end;
+    const char *next;
+    const char *name;
+    size_t componentLength;
+    size_t nameLength;
+    size_t numSlashes;
+    size_t pos;
+    char *field;
+    unsigned char type;
+    bool hasError;
+
+    // the component runs up to the next slash; the slashes after it are
+    // kept, so a pattern ending in one matches only directories
+    end = strchr(rest, '/');
+    componentLength = (end != NULL) ? (size_t) (end - rest) : strlen(rest);
+    next = end;
+    while (next != NULL && *next == '/')
+    {
+        next++;
+    }
+    numSlashes = (end != NULL) ? (size_t) (next - end) : 0;
+
+    if (memchr(rest, '*', componentLength) == NULL &&
+        memchr(rest, '?', componentLength) == NULL &&
+        memchr(rest, '[', componentLength) == NULL)
+    {
+        nameLength = componentLength + numSlashes;
+        if (length + nameLength >= PATH_MAX)
+        {
+            return 0;
+        }
+        memcpy(path + length, rest, nameLength);
+        path[length + nameLength] = '\0';
+
+        if (next != NULL && *next != '\0')
+        {
+            return globPath(arena, path, length + nameLength, next);
+        }
+        if (lstat(path, &info) == -1)
+        {
+            return 0;
+        }
+        field = arenaString(arena, path, length + nameLength);
+        return (field == NULL) ? -1 : addField(field);
+    }
+
+    listing = listDirectory((length > 0) ? path : ".");
+    if (listing == NULL)
+    {
+        return 0;
+    }
+
+    for (pos = 0; pos < listing->names.length; pos += nameLength + 1)
+    {
+        type = (unsigned char) listing->names.data[pos++];
+        name = listing->names.data + pos;
+        nameLength = strlen(name);
+
+        // . and .. are never matched, and other hidden names only by a
+        // component that begins with a . too
+        if (name[0] == '.' &&
+            (*rest != '.' || name[1] == '\0' ||
+             (name[1] == '.' && name[2] == '\0')))
+        {
+            continue;
+        }
+        if (matchName(rest, rest + componentLength, name) == false ||
+            length + nameLength + numSlashes >= PATH_MAX)
+        {
+            continue;
+        }
+
+        memcpy(path + length, name, nameLength);
+        path[length + nameLength] = '\0';
+
+        if (end == NULL)
+        {
+            field = arenaString(arena, path, length + nameLength);
+            if (field == NULL || addField(field) == -1)
+            {
+                return -1;
+            }
+            continue;
+        }
+
+        // anything after a slash must be below a directory
+        if (type != DT_DIR &&
+            ((type != DT_LNK && type != DT_UNKNOWN) ||
+             stat(path, &info) == -1 || S_ISDIR(info.st_mode) == false))
+        {
+            continue;
+        }
+
+        if (*next == '\0')
+        {
+            memcpy(path + length + nameLength, end, numSlashes);
+            field = arenaString(arena, path, length + nameLength + numSlashes);
+            if (field == NULL || addField(field) == -1)
+            {
+                return -1;
+            }
+        }
+        else
+        {
+            putBytes(&dirs, name, nameLength + 1);
+        }
+    }
+
+    // the directories are matched below only once this listing is done
+    // with, since reading them may replace it
+    for (pos = 0; pos < dirs.length && dirs.hasError == false;
+         pos += nameLength + 1)
+    {
+        name = dirs.data + pos;
+        nameLength = strlen(name);
+        memcpy(path + length, name, nameLength);
+        memcpy(path + length + nameLength, end, numSlashes);
+        path[length + nameLength + numSlashes] = '\0';
+
+        if (globPath(arena, path, length + nameLength + numSlashes,
+                     next) == -1)
+        {
+            dirs.hasError = true;
+        }
+    }
+
+    hasError = dirs.hasError;
+    free(dirs.data);
+
+    return (hasError == true) ? -1 : 0;
+}
+
+
+
+bool matchName(const char *pattern, const char *patternEnd, const char *name)
+{
+    const char *star = NULL;        // pattern just after the last *
+    const char *starName = NULL;    // where the name was at that *
+    const char *p = pattern;
+    const char *after;
+
+    while (*name != '\0')
+    {
+        if (p < patternEnd && *p == '*')
+        {
+            star = ++p;
+            starName = name;
+            continue;
+        }
+        if (p < patternEnd && (after = matchChar(p, patternEnd, *name)) != NULL)
+        {
+            p = after;
+            name++;
+            continue;
+        }
+
+        // on a mismatch the last * takes one more character and the rest
+        // of the pattern is tried again after it
+        if (star == NULL)
+        {
+            return false;
+        }
+        p = star;
+        name = ++starName;
+    }
+
+    while (p < patternEnd && *p == '*')
+    {
+        p++;
+    }
+
+    return p == patternEnd;
+}
+
+
+
+const char *matchChar(const char *pattern, const char *patternEnd, char c)
+{
+    const char *p = pattern + 1;
+    const char *close;
+    unsigned char low;
+    unsigned char high;
+    bool isNegated = false;
+    bool isMatched = false;
+
+    if (*pattern == '?')
+    {
+        return pattern + 1;
+    }
+    if (*pattern != '[')
+    {
+        return (*pattern == c) ? pattern + 1 : NULL;
+    }
+
+    if (p < patternEnd && (*p == '!' || *p == '^'))
+    {
+        isNegated = true;
+        p++;
+    }
+
+    // a ] first is a member, not the end
+    close = (p < patternEnd && *p == ']') ? p + 1 : p;
+    while (close < patternEnd && *close != ']')
+    {
+        close++;
+    }
+    if (close == patternEnd)
+    {
+        return (c == '[') ? pattern + 1 : NULL;
+    }
+
+    while (p < close)
+    {
+        low = (unsigned char) *p;
+        if (p + 2 < close && p[1] == '-')
+        {
+            high = (unsigned char) p[2];
+            p += 3;
+        }
+        else
+        {
+            high = low;
+            p++;
+        }
+        if ((unsigned char) c >= low && (unsigned char) c <= high)
+        {
+            isMatched = true;
+        }
+    }
+
+    return (isMatched != isNegated) ? close + 1 : NULL;
+}
+
+
+
+struct dirListing *listDirectory(const char *dir)
+{
+    struct dirListing *listing;
+    struct dirent64 *entry;
+    struct stat info;
+    char buffer[READ_BUFFER];
+    ssize_t numRead;
+    ssize_t pos;
+    size_t index;
+    int fd;
+
+    if (stat(dir, &info) == -1 || S_ISDIR(info.st_mode) == false)
+    {
+        return NULL;
+    }
+
+    index = (size_t) (info.st_ino ^ info.st_dev) % MIN_BUCKETS;
+    for (listing = dirCache.buckets[index]; listing != NULL;
+         listing = listing->next)
+    {
+        if (listing->dev == info.st_dev && listing->ino == info.st_ino)
+        {
+            break;
+        }
+    }
+
+    if (listing != NULL && listing->names.hasError == false &&
+        listing->mtime.tv_sec == info.st_mtim.tv_sec &&
+        listing->mtime.tv_nsec == info.st_mtim.tv_nsec)
+    {
+        return listing;
+    }
+
+    fd = open(dir, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    if (fd == -1)
+    {
+        return NULL;
+    }
+
+    if (listing == NULL)
+    {
+        if (dirCache.numListings >= GLOB_DIRS)
+        {
+            clearDirCache();
+        }
+        listing = calloc(1, sizeof(struct dirListing));
+        if (listing == NULL)
+        {
+            close(fd);
+            return NULL;
+        }
+        listing->dev = info.st_dev;
+        listing->ino = info.st_ino;
+        listing->next = dirCache.buckets[index];
+        dirCache.buckets[index] = listing;
+        dirCache.numListings++;
+    }
+    listing->mtime = info.st_mtim;
+    listing->names.length = 0;
+    listing->names.hasError = false;
+
+    if (DEBUG)
+    {
+        printf("reading directory %s\n", dir);
+        fflush(stdout);
+    }
+
+    // each call fills the buffer with as many entries as fit
+    while ((numRead = getdents64(fd, buffer, sizeof(buffer))) > 0)
+    {
+        for (pos = 0; pos < numRead; pos += entry->d_reclen)
+        {
+            entry = (struct dirent64 *) (buffer + pos);
+            putBytes(&listing->names, &entry->d_type, 1);
+            putBytes(&listing->names, entry->d_name, strlen(entry->d_name) + 1);
+        }
+    }
+    if (numRead == -1)
+    {
+        listing->names.hasError = true;
+    }
+    close(fd);
+
+    // a listing that could not be read in full is read again next time
+    return listing;
+}
+
+
+
+void clearDirCache()
+{
+    struct dirListing *listing;
+    struct dirListing *next;
+    int i;
+
+    for (i = 0; i < MIN_BUCKETS; i++)
+    {
+        for (listing = dirCache.buckets[i]; listing != NULL; listing = next)
+        {
+            next = listing->next;
+            free(listing->names.data);
+            free(listing);
+        }
+        dirCache.buckets[i] = NULL;
+    }
+    dirCache.numListings = 0;
+}
+
+
+
+int compareNames(const void *a, const void *b)
+{
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+
+
+ssize_t captureOutput(const char *text)
+{
+    struct byteBuffer *out = &expander.output;
+    struct sigaction previous;
+    char *argv[8];
+    char pidText[24];
+    char statusText[24];
+    char *newData;
+    size_t newSize;
+    ssize_t numRead;
+    int pipeFds[2];
+    int status = 0;
+    pid_t cpid;
+
+    out->length = 0;
+
+    if (pipe2(pipeFds, O_CLOEXEC) == -1)
+    {
+        perror("smallsh: pipe");
+        return 0;
+    }
+
+    // the command is run by a new copy of this shell, in a group of its
+    // own so that anything it starts can be killed with it; it is told
+    // this shell's $$ and $? so that they mean the same inside
+    snprintf(pidText, sizeof(pidText), "%d", (int) shellPid);
+    snprintf(statusText, sizeof(statusText), "%d", lastStatus);
+    argv[0] = "/proc/self/exe";
+    argv[1] = "--parent";
+    argv[2] = pidText;
+    argv[3] = statusText;
+    argv[4] = "-c";
+    argv[5] = (char *) text;
+    argv[6] = NULL;
+    cpid = spawnProcess(argv, -1, pipeFds[1], 0, false);
+    close(pipeFds[1]);
+
+    // an interrupt while it runs kills it, as for a fg pipeline
+    signalNum = 0;
+    if (cpid > 0)
+    {
+        fgPgid = cpid;
+        sigaction(SIGINT, &foreground_act, &previous);
+    }
+
+    // read until the command closes its end of the pipe
+    while (out->hasError == false)
+    {
+        if (out->size - out->length < OUTPUT_BLOCK)
+        {
+            newSize = (out->size == 0) ? OUTPUT_BLOCK : out->size * 2;
+            newData = realloc(out->data, newSize);
+            if (newData == NULL)
+            {
+                out->hasError = true;
+                break;
+            }
+            out->data = newData;
+            out->size = newSize;
+        }
+
+        numRead = read(pipeFds[0], out->data + out->length, out->size - out->length);
+        if (numRead > 0)
+        {
+            out->length += numRead;
+        }
+        else if (numRead == 0 || errno != EINTR)
+        {
+            break;
+        }
+    }
+    close(pipeFds[0]);
+
+    if (cpid > 0)
+    {
+        while (waitpid(cpid, &status, 0) == -1 && errno == EINTR)
+        {
+        }
+        traceEvent(TRACE_REAP, cpid, status);
+        sigaction(SIGINT, &previous, NULL);
+        fgPgid = 0;
+    }
+
+    if (out->hasError == true)
+    {
+        out->hasError = false;
+        return -1;
+    }
+    if (signalNum != 0)
+    {
+        printf("terminated by signal %d\n", signalNum);
+        fflush(stdout);
+        return -1;
+    }
+
+    // like other shells, drop the newlines at the end
+    while (out->length > 0 && out->data[out->length - 1] == '\n')
+    {
+        out->length--;
+    }
+
+    return out->length;
+}
+
+
+
+int runList(struct node *node)
+{
+    struct sigaction previous;
+    struct arena loopArena = { NULL };
+    char **words;
+    int numWords;
+    int status = 0;
+    int i;
+
+    for (; node != NULL && isExiting == false && isInterrupted == 0; node = node->next)
+    {
+        switch (node->type)
+        {
+            case NODE_PIPELINE:
+                status = runPipeline(node->pl);
+                break;
+
+            case NODE_AND:
+            case NODE_OR:
+                // the second command runs only if the first decides it
+                status = runList(node->first);
+                if ((status == 0) == (node->type == NODE_AND))
+                {
+                    status = runList(node->second);
+                }
+                break;
+
+            case NODE_IF:
+                status = runList(node->cond);
+                if (isExiting == true || isInterrupted != 0)
+                {
+                    break;
+                }
+                if (status == 0)
+                {
+                    status = runList(node->body);
+                }
+                else
+                {
+                    // with no branch taken, if succeeds
+                    status = runList(node->orElse);
+                }
+                break;
+
+            case NODE_WHILE:
+                // an interrupt between commands stops the loop too; the
+                // status is that of the last body run, or 0
+                sigaction(SIGINT, &foreground_act, &previous);
+                status = 0;
+                while (runList(node->cond) == 0 &&
+                       isExiting == false && isInterrupted == 0)
+                {
+                    status = runList(node->body);
+                }
+                sigaction(SIGINT, &previous, NULL);
+                break;
+
+            case NODE_FOR:
+                // the words are expanded once, before the loop starts
+                numWords = node->numWords;
+                words = expandWords(&loopArena, node->words, &numWords);
+                if (words == NULL)
+                {
+                    if (isInterrupted == 0)
+                    {
+                        printf("smallsh: out of memory\n");
+                        fflush(stdout);
+                    }
+                    status = W_EXITCODE(1, 0);
+                    break;
+                }
+
+                // the variable is passed to commands in the environment
+                sigaction(SIGINT, &foreground_act, &previous);
+                status = 0;
+                for (i = 0; i < numWords &&
+                            isExiting == false && isInterrupted == 0; i++)
+                {
+                    setenv(node->name, words[i], 1);
+                    isEnvironChanged = true;
+                    status = runList(node->body);
+                }
+                sigaction(SIGINT, &previous, NULL);
+                break;
+        }
+
+        // words expanded for a loop go once it is over
+        if (loopArena.blocks != NULL)
+        {
+            clearArena(&loopArena);
+            free(loopArena.blocks);
+            loopArena.blocks = NULL;
+        }
+
+        // an if, loop or && || list leaves its own status for the next
+        // status command, as a pipeline does
+        if (node->type != NODE_PIPELINE)
+        {
+            lastStatus = status;
+        }
+    }
+
+    return status;
+}
+
+
+
+int runPipeline(struct pipeline *pl)
+{
+    struct command *cmd = &pl->stages[0];
+    struct command stages[MAX_STAGES];
+    struct command expandedStages[MAX_STAGES];
+    struct pipeline limited;
+    struct pipeline expanded;
+    struct sigaction previous;
+    pid_t pids[MAX_STAGES];
+    int cpus[MAX_STAGES];
+    bool isTimedOut = false;
+    bool isStopped = false;
+    int exitStatus;
+    int i;
+    int j;
+    int last;
+    int numStarted;
+    struct job *job;
+    int stageStatus;
+    int status = 0;
+    long long startNs;
+    long long timeoutNs = 0;
+    long long graceNs = 0;
+    pid_t pgid;
+    struct rusage stageUsage;
+
+    // expand $ in a copy of the pipeline, so that the parsed one is the
+    // same the next time it runs
+    if (pl->hasExpansions == true)
+    {
+        if (expandPipeline(pl, &expanded, expandedStages) == -1)
+        {
+            lastStatus = W_EXITCODE(1, 0);
+            return lastStatus;
+        }
+        pl = &expanded;
+        cmd = &pl->stages[0];
+    }
+
+    // a lone redirection only creates or checks its files
+    if (pl->numStages == 1 && cmd->argc == 0)
+    {
+        cmd = NULL;
+    }
+
+    // cached replays what the command printed the last time it ran on
+    // the same input, or runs it and saves what it prints
+    if (cmd != NULL && strcmp(cmd->argv[0], "cached") == 0)
+    {
+        return runCached(pl);
+    }
+
+    // timeout runs the rest of the pipeline under a time limit; the parsed
+    // pipeline is copied rather than changed so that a loop can run it again
+    if (cmd != NULL && strcmp(cmd->argv[0], "timeout") == 0)
+    {
+        i = parseTimeout(cmd, &timeoutNs, &graceNs);
+        if (i == -1)
+        {
+            lastStatus = W_EXITCODE(2, 0);
+            return lastStatus;
+        }
+
+        memcpy(stages, pl->stages, pl->numStages * sizeof(struct command));
+        stages[0].argv += i;
+        stages[0].argc -= i;
+        limited = *pl;
+        limited.stages = stages;
+        pl = &limited;
+
+        // the command is always run as a process, so it can be stopped
+        cmd = NULL;
+    }
+
+    // each command run here is listed in builtins[], so cached runs it
+    // every time
+    if (cmd != NULL && pl->numStages == 1 && strcmp(cmd->argv[0], "exit") == 0)
+    {
+
+        // an exit value may be given; otherwise the shell exits with the
+        // status of the last command
+        if (cmd->argc > 1)
+        {
+            lastStatus = W_EXITCODE(atoi(cmd->argv[1]) & 0xff, 0);
+        }
+
+        // exit the shell once the running commands have stopped; the
+        // jobs it has started are killed on the way out
+        isExiting = true;
+        return lastStatus;
+
+    }
+    else if (cmd != NULL && pl->numStages == 1 && strcmp(cmd->argv[0], "cd") == 0)
+    { // change working directories
+
+        // if no args, change to directory specified in HOME env var
+        if (cmd->argc == 1)
+        {
+            status = chdir(getenv("HOME"));
+        }
+        // if one arg, change to dir provided
+        else
+        {
+            status = chdir(cmd->argv[1]);
+        }
+        // support absolute and relative paths
+
+        // a failed cd is quiet but counts as failure for && and ||
+        status = W_EXITCODE((status == 0) ? 0 : 1, 0);
+
+    }
+    else if (cmd != NULL && pl->numStages == 1 && strcmp(cmd->argv[0], "jobs") == 0)
+    { // list the background jobs that are still running
+
+        listJobs();
+
+    }
+    else if (cmd != NULL && pl->numStages == 1 && strcmp(cmd->argv[0], "fg") == 0)
+    { // bring a job back to the foreground
+
+        status = fgBuiltin(cmd, &isTimedOut);
+
+    }
+    else if (cmd != NULL && pl->numStages == 1 && strcmp(cmd->argv[0], "bg") == 0)
+    { // let a stopped job carry on in the background
+
+        status = W_EXITCODE(bgBuiltin(cmd), 0);
+
+    }
+    else if (cmd != NULL && pl->numStages == 1 && strcmp(cmd->argv[0], "hash") == 0)
+    { // show or reset the cache of command paths
+
+        status = W_EXITCODE(hashBuiltin(cmd), 0);
+
+    }
+    else if (cmd != NULL && pl->numStages == 1 && strcmp(cmd->argv[0], "status") == 0)
+    { // print exit status or terminating signal of last fg command
+
+        if (WIFEXITED(lastStatus))
+        {
+            exitStatus = WEXITSTATUS(lastStatus);
+            printf("exit value %d", exitStatus);
+        }
+        else if (signalNum != 0)
+        {
+            printf("terminated by signal %d", signalNum);
+        }
+        else
+        {
+            printf("terminated by signal %d", WTERMSIG(lastStatus));
+        }
+
+        // say so if it was stopped by timeout
+        printf("%s\n", (isFgTimedOut == true) ? " (timed out)" : "");
+
+        // with -v, also show what the last fg command used
+        if (cmd->argc > 1 && strcmp(cmd->argv[1], "-v") == 0)
+        {
+            printUsage(&fgUsage);
+        }
+
+        // the status shown is left for the next status command
+        return 0;
+
+    }
+    else if (cmd != NULL && pl->numStages == 1 && strcmp(cmd->argv[0], "parallel") == 0)
+    { // run a command once per input line, several at a time
+
+        startNs = monotonicNs();
+        signalNum = 0;
+        sigaction(SIGINT, &foreground_act, &previous);
+        status = parallelBuiltin(cmd);
+        sigaction(SIGINT, &previous, NULL);
+
+        fgUsage.wallNs = monotonicNs() - startNs;
+        if (fgUsage.numProcs > 0)
+        {
+            recordUsage(0, 0, pipelineText(pl), &fgUsage);
+        }
+
+        if (signalNum != 0)
+        {
+            printf("terminated by signal %d\n", signalNum);
+        }
+
+    }
+    else if (cmd != NULL && pl->numStages == 1 && strcmp(cmd->argv[0], "times") == 0)
+    { // show the resources used by the shell and its jobs
+
+        timesBuiltin();
+
+    }
+    else if (cmd != NULL && pl->numStages == 1 && strcmp(cmd->argv[0], "trace") == 0)
+    { // record where the shell's time goes, or write out what was recorded
+
+        status = W_EXITCODE(traceBuiltin(cmd), 0);
+
+    }
+    else if (cmd != NULL && pl->numStages == 1 && pl->isBackground == false &&
+             isSimpleCommand(cmd))
+    { // run common simple commands without creating a process
+
+        signalNum = 0;
+        status = runSimpleCommand(cmd);
+
+    }
+    else if (cmd != NULL && pl->numStages == 1 && strcmp(cmd->argv[0], "maxjobs") == 0)
+    { // limit how many background jobs run at once
+
+        status = W_EXITCODE(maxjobsBuiltin(cmd), 0);
+
+    }
+    else if (cmd != NULL && pl->numStages == 1 && strcmp(cmd->argv[0], "placement") == 0)
+    { // choose the CPUs that jobs run on
+
+        status = W_EXITCODE(placementBuiltin(cmd), 0);
+
+    }
+    else if (pl->isBackground == true && (jobs.numQueued > 0 ||
+             (jobLimit() > 0 && jobs.numJobs >= (size_t) jobLimit())))
+    { // too many background jobs are running; wait in the queue
+
+        queueJob(pl, timeoutNs, graceNs);
+        return 0;
+
+    }
+    else // pass through to BASH to interpret command there
+    {
+        startNs = monotonicNs();
+        pgid = startPipeline(pl, pids, cpus, timeoutNs > 0);
+        last = pl->numStages - 1;
+
+        // if command is bg process
+        if (pl->isBackground == true)
+        {
+            // gather the stages that were started
+            numStarted = 0;
+            for (i = 0; i < pl->numStages; i++)
+            {
+                if (pids[i] > 0)
+                {
+                    cpus[numStarted] = cpus[i];
+                    pids[numStarted++] = pids[i];
+                }
+            }
+
+            // add the job to the table of background jobs
+            if (numStarted > 0 && (job = addJob(pids, numStarted, pl)) != NULL)
+            {
+                job->startNs = startNs;
+                job->pgid = pgid;
+                for (i = 0; i < numStarted; i++)
+                {
+                    job->procs[i].cpu = cpus[i];
+                }
+                if (timeoutNs > 0)
+                {
+                    startDeadline(&job->limit, timeoutNs, graceNs);
+                }
+
+                // then print process id of its last stage when begins,
+                // and the CPU it was put on
+                if (cpus[numStarted - 1] >= 0)
+                {
+                    printf("background pid is %d (cpu %d)\n", pids[numStarted - 1],
+                           cpus[numStarted - 1]);
+                }
+                else
+                {
+                    printf("background pid is %d\n", pids[numStarted - 1]);
+                }
+            }
+            else if (numStarted > 0)
+            {
+                // a job that cannot be tracked is not left running
+                printf("smallsh: cannot track background job\n");
+                kill(-pgid, SIGKILL);
+                for (i = 0; i < numStarted; i++)
+                {
+                    waitpid(pids[i], NULL, 0);
+                    releaseCpu(cpus[i]);
+                }
+            }
+
+            // starting a background job succeeds; its status is reported
+            // when it is done
+            return 0;
+        }
+
+        // reset value of signal number
+        signalNum = 0;
+
+        // record the pipeline and a pidfd for each process in the
+        // global arrays for access in signal handlers; the count is
+        // set last so the handler never sees a partial entry
+        j = 0;
+        for (i = 0; i < pl->numStages; i++)
+        {
+            if (pids[i] > 0)
+            {
+                fgpid[j] = pids[i];
+                fgPidfd[j] = pidfd_open(pids[i], 0);
+                j++;
+            }
+        }
+        numFgPids = j;
+        fgPgid = pgid;
+
+        // set interrupt handler for fg process
+        sigaction(SIGINT, &foreground_act, &previous);
+
+        // start the clock on a timeout
+        if (timeoutNs > 0)
+        {
+            fgLimit.job = NULL;
+            startDeadline(&fgLimit, timeoutNs, graceNs);
+        }
+
+        // wait for every stage, adding up what each one used;
+        // the last one gives the status. Under job control a stage
+        // that stops ends the wait, and the rest become a stopped job
+        memset(&fgUsage, 0, sizeof(fgUsage));
+        for (i = 0; i < numFgPids; i++)
+        {
+            if (waitProcess(fgpid[i], &stageStatus, &stageUsage) != fgpid[i])
+            {
+                continue;
+            }
+            if (WIFSTOPPED(stageStatus))
+            {
+                break;
+            }
+            addUsage(&fgUsage, &stageUsage);
+            if (fgpid[i] == pids[last])
+            {
+                status = stageStatus;
+            }
+        }
+        fgUsage.wallNs = monotonicNs() - startNs;
+
+        isStopped = (i < numFgPids);
+        if (isStopped == true)
+        {
+            suspendForeground(&fgpid[i], numFgPids - i, pl, startNs);
+            status = W_EXITCODE(128 + WSTOPSIG(stageStatus), 0);
+        }
+        else if (numFgPids > 0)
+        {
+            recordUsage(0, fgpid[numFgPids - 1], pipelineText(pl), &fgUsage);
+        }
+
+        if (timeoutNs > 0)
+        {
+            isTimedOut = (fgLimit.step > 0);
+            stopDeadline(&fgLimit);
+        }
+
+        // restore to ignore interrupts (or to the loop's handler), and
+        // take the terminal back from the job
+        sigaction(SIGINT, &previous, NULL);
+        fgPgid = 0;
+        if (pgid > 0 && isJobControl == true)
+        {
+            giveTerminal(shellPgid, &shellModes);
+        }
+
+        // reset global count so signal handlers know
+        // there is no active fg process
+        j = numFgPids;
+        numFgPids = 0;
+        for (i = 0; i < j; i++)
+        {
+            if (fgPidfd[i] != -1)
+            {
+                close(fgPidfd[i]);
+            }
+        }
+
+        // a stopped job has already been reported
+        if (isStopped == false)
+        {
+            // a last stage that could not be started counts as exit
+            // value 1, and one that only created its files as 0
+            if (pids[last] == -1)
+            {
+                status = W_EXITCODE(1, 0);
+            }
+            else if (pids[last] == 0)
+            {
+                status = W_EXITCODE(0, 0);
+            }
+
+            // if process was terminated by signal, print message
+            finishForeground(status, isTimedOut);
+        }
+    }
+
+    lastStatus = status;
+    isFgTimedOut = isTimedOut;
+    return status;
+}
+
+
+
+void endJobs()
+{
+    struct job *job;
+    int i;
+
+    // kill any processes or jobs that shell has started, along with
+    // anything they started in their process groups
+    for (job = jobs.head; job != NULL; job = job->next)
+    {
+        if (DEBUG)
+        {
+            printf("Now killing job %d\n", job->id);
+        }
+
+        signalJob(job, SIGKILL);
+    }
+
+    // then wait for them so none are left behind as zombies
+    for (job = jobs.head; job != NULL; job = job->next)
+    {
+        for (i = 0; i < job->numProcs; i++)
+        {
+            if (job->procs[i].isDone == false)
+            {
+                waitpid(job->procs[i].pid, NULL, 0);
+            }
+        }
+    }
+}
+
+
+
+void startJobControl()
+{
+    pid_t pgid;
+
+    // a shell started in the background waits its turn for the terminal
+    while ((pgid = tcgetpgrp(0)) != -1 && pgid != getpgrp())
+    {
+        kill(-getpgrp(), SIGTTIN);
+    }
+    if (pgid == -1)
+    {
+        return;
+    }
+
+    // the terminal's stop signals are for the jobs, not the shell
+    signal(SIGTSTP, SIG_IGN);
+    signal(SIGTTIN, SIG_IGN);
+    signal(SIGTTOU, SIG_IGN);
+
+    // put the shell in its own group and take the terminal for it
+    originalPgid = pgid;
+    shellPgid = getpid();
+    if (getpgrp() != shellPgid && setpgid(0, shellPgid) == -1)
+    {
+        perror("smallsh: setpgid");
+        return;
+    }
+
+    ttyFd = fcntl(0, F_DUPFD_CLOEXEC, 10);
+    if (ttyFd == -1 || tcsetpgrp(ttyFd, shellPgid) == -1 ||
+        tcgetattr(ttyFd, &shellModes) == -1)
+    {
+        perror("smallsh: job control");
+        return;
+    }
+
+    isJobControl = true;
+}
+
+
+
+void giveTerminal(pid_t pgid, const struct termios *modes)
+{
+    if (modes != NULL)
+    {
+        tcsetattr(ttyFd, TCSADRAIN, modes);
+    }
+    tcsetpgrp(ttyFd, pgid);
+}
+
+
+
+void finishForeground(int status, bool isTimedOut)
+{
+    // Ctrl-C under job control goes to the job, not the shell
+    if (signalNum == 0 && WIFSIGNALED(status) && WTERMSIG(status) == SIGINT)
+    {
+        signalNum = SIGINT;
+        isInterrupted = 1;
+    }
+
+    if (signalNum != 0)
+    {
+        printf("terminated by signal %d\n", signalNum);
+    }
+    else if (isTimedOut == true && WIFSIGNALED(status))
+    {
+        printf("terminated by signal %d (timed out)\n", WTERMSIG(status));
+    }
+    else if (isTimedOut == true)
+    {
+        printf("exit value %d (timed out)\n", WEXITSTATUS(status));
+    }
+}
+
+
+
+void suspendForeground(pid_t *pids, int numPids, struct pipeline *pl, long long startNs)
+{
+    struct job *job;
+    long long left;
+    int i;
+
+    job = addJob(pids, numPids, pl);
+    if (job == NULL)
+    {
+        // a job that cannot be tracked is not left stopped
+        printf("smallsh: cannot track stopped job\n");
+        kill(-fgPgid, SIGKILL);
+        for (i = 0; i < numPids; i++)
+        {
+            waitpid(pids[i], NULL, 0);
+        }
+        return;
+    }
+
+    job->pgid = fgPgid;
+    job->isStopped = true;
+    job->startNs = startNs;
+    job->use = fgUsage;
+    job->hasModes = (tcgetattr(ttyFd, &job->modes) == 0);
+
+    // the job keeps whatever time it had left
+    if (fgLimit.isQueued == true)
+    {
+        left = fgLimit.whenNs - monotonicNs();
+        startDeadline(&job->limit, (left > 0) ? left : 0, fgLimit.graceNs);
+        job->limit.step = fgLimit.step;
+    }
+
+    // stopping ends the rest of the line, as an interrupt does
+    isInterrupted = 1;
+
+    printf("[%d] Stopped %d %s\n", job->id, pids[numPids - 1], job->command);
+}
+
+
+
+void signalJob(struct job *job, int sig)
+{
+    int i;
+
+    if (job->pgid > 0)
+    {
+        kill(-job->pgid, sig);
+        return;
+    }
+
+    for (i = 0; i < job->numProcs; i++)
+    {
+        if (job->procs[i].isDone == false)
+        {
+            pidfd_send_signal(job->procs[i].pidfd, sig, NULL, 0);
+        }
+    }
+}
+
+
+
+void markDone(struct process *proc, int status, const struct rusage *ru)
+{
+    // closing the pidfd also drops it from the epoll set
+    close(proc->pidfd);
+    proc->pidfd = -1;
+    proc->isDone = true;
+    proc->status = status;
+    proc->job->numLive--;
+    addUsage(&proc->job->use, ru);
+
+    // its CPU has room for another job
+    releaseCpu(proc->cpu);
+    proc->cpu = -1;
+}
+
+
+
+struct job *pickJob(struct command *cmd)
+{
+    struct job *job = NULL;
+    const char *text;
+    char *end;
+    long id;
+
+    if (cmd->argc > 1)
+    {
+        text = (cmd->argv[1][0] == '%') ? cmd->argv[1] + 1 : cmd->argv[1];
+        id = strtol(text, &end, 10);
+        if (end != text && *end == '\0' && id > 0 && id <= INT_MAX)
+        {
+            job = findJob(id);
+        }
+    }
+    else
+    {
+        for (job = jobs.tail; job != NULL && job->isStopped == false; job = job->prev)
+        {
+        }
+        if (job == NULL)
+        {
+            job = jobs.tail;
+        }
+    }
+
+    if (job == NULL)
+    {
+        printf("smallsh: %s: no such job\n", cmd->argv[0]);
+        fflush(stdout);
+    }
+
+    return job;
+}
+
+
+
+int fgBuiltin(struct command *cmd, bool *isTimedOut)
+{
+    struct sigaction previous;
+    struct process *proc = NULL;
+    struct job *job;
+    struct rusage ru;
+    int status = 0;
+    int i;
+
+    job = pickJob(cmd);
+    if (job == NULL)
+    {
+        return W_EXITCODE(1, 0);
+    }
+
+    // a queued job skips the rest of the queue
+    if (job->pending != NULL && startJob(job, false) == -1)
+    {
+        return W_EXITCODE(1, 0);
+    }
+
+    // show what is being brought back
+    printf("%s\n", job->command);
+    fflush(stdout);
+
+    // hand over the terminal, then let the job run again
+    fgPgid = job->pgid;
+    if (isJobControl == true)
+    {
+        giveTerminal(job->pgid, (job->hasModes == true) ? &job->modes : NULL);
+    }
+    if (job->isStopped == true)
+    {
+        signalJob(job, SIGCONT);
+        job->isStopped = false;
+    }
+
+    // wait for it as for any fg pipeline, with no one else reaping it
+    holdJob(job, true);
+    signalNum = 0;
+    sigaction(SIGINT, &foreground_act, &previous);
+    for (i = 0; i < job->numProcs; i++)
+    {
+        proc = &job->procs[i];
+        if (proc->isDone == true ||
+            waitProcess(proc->pid, &status, &ru) != proc->pid)
+        {
+            continue;
+        }
+        if (WIFSTOPPED(status))
+        {
+            break;
+        }
+        markDone(proc, status, &ru);
+    }
+    sigaction(SIGINT, &previous, NULL);
+    fgPgid = 0;
+
+    // stopped again: it stays in the table
+    if (i < job->numProcs)
+    {
+        holdJob(job, false);
+        job->isStopped = true;
+        if (isJobControl == true)
+        {
+            job->hasModes = (tcgetattr(ttyFd, &job->modes) == 0);
+            giveTerminal(shellPgid, &shellModes);
+        }
+        isInterrupted = 1;
+        printf("[%d] Stopped %d %s\n", job->id, proc->pid, job->command);
+        return W_EXITCODE(128 + WSTOPSIG(status), 0);
+    }
+
+    if (isJobControl == true)
+    {
+        giveTerminal(shellPgid, &shellModes);
+    }
+
+    // it finished in the foreground; its last process gives the status
+    proc = &job->procs[job->numProcs - 1];
+    status = proc->status;
+    *isTimedOut = (job->limit.step > 0);
+    finishForeground(status, *isTimedOut);
+
+    job->use.wallNs = monotonicNs() - job->startNs;
+    fgUsage = job->use;
+    recordUsage(job->id, proc->pid, job->command, &job->use);
+    job->command = NULL;
+    removeJob(job);
+
+    return status;
+}
+
+
+
+int bgBuiltin(struct command *cmd)
+{
+    struct job *job;
+
+    job = pickJob(cmd);
+    if (job == NULL)
+    {
+        return 1;
+    }
+
+    // a queued job is started now, whatever the limit
+    if (job->pending != NULL)
+    {
+        return (startJob(job, true) == 0) ? 0 : 1;
+    }
+
+    if (job->isStopped == true)
+    {
+        signalJob(job, SIGCONT);
+        job->isStopped = false;
+    }
+
+    printf("[%d] %s &\n", job->id, job->command);
+    return 0;
+}
+
+
+
+int loadScript(const char *fullPath, const char *cachePath, const struct stat *info,
+               struct arena *arena, struct node ***commands, int *numCommands,
+               size_t *offset)
+{
+    char magic[8];
+    struct byteBuffer buf;
+    struct stat cacheInfo;
+    struct node **list = NULL;
+    long long fields[5];
+    long long position;
+    char *savedPath;
+    void *data;
+    int count;
+    int fd;
+    int i;
+
+    fd = open(cachePath, O_RDONLY|O_CLOEXEC);
+    if (fd == -1)
+    {
+        return -1;
+    }
+    if (fstat(fd, &cacheInfo) == -1 || cacheInfo.st_size == 0)
+    {
+        close(fd);
+        return -1;
+    }
+    data = mmap(NULL, cacheInfo.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    memset(&buf, 0, sizeof(buf));
+    buf.data = data;
+    buf.length = cacheInfo.st_size;
+
+    // the entry must be for this script as it is now
+    getBytes(&buf, magic, sizeof(magic));
+    savedPath = getString(&buf, arena);
+    getBytes(&buf, fields, sizeof(fields));
+    count = getInt(&buf);
+    getBytes(&buf, &position, sizeof(position));
+
+    if (buf.hasError == true || memcmp(magic, "smallsh2", sizeof(magic)) != 0 ||
+        savedPath == NULL || strcmp(savedPath, fullPath) != 0 ||
+        fields[0] != (long long) info->st_dev || fields[1] != (long long) info->st_ino ||
+        fields[2] != (long long) info->st_size ||
+        fields[3] != (long long) info->st_mtim.tv_sec ||
+        fields[4] != (long long) info->st_mtim.tv_nsec ||
+        count < 0 || count > (int) (buf.length / sizeof(int)) ||
+        position < 0 || position > (long long) info->st_size)
+    {
+        buf.hasError = true;
+    }
+
+    if (buf.hasError == false)
+    {
+        list = malloc((count + 1) * sizeof(struct node *));
+        buf.hasError = (list == NULL);
+    }
+    for (i = 0; buf.hasError == false && i < count; i++)
+    {
+        list[i] = decodeList(&buf, arena);
+    }
+
+    munmap(data, cacheInfo.st_size);
+
+    if (buf.hasError == true)
+    {
+        free(list);
+        clearArena(arena);
+        return -1;
+    }
+
+    *commands = list;
+    *numCommands = count;
+    *offset = position;
+    return 0;
+}
+
+
+
+void saveScript(const char *fullPath, const char *cachePath, const struct stat *info,
+                struct node **commands, int numCommands, size_t offset)
+{
+    char tempPath[PATH_MAX];
+    struct byteBuffer buf;
+    long long fields[5];
+    long long position = offset;
+    int fd;
+    int i;
+
+    memset(&buf, 0, sizeof(buf));
+    fields[0] = info->st_dev;
+    fields[1] = info->st_ino;
+    fields[2] = info->st_size;
+    fields[3] = info->st_mtim.tv_sec;
+    fields[4] = info->st_mtim.tv_nsec;
+
+    putBytes(&buf, "smallsh2", 8);
+    putString(&buf, fullPath);
+    putBytes(&buf, fields, sizeof(fields));
+    putInt(&buf, numCommands);
+    putBytes(&buf, &position, sizeof(position));
+    for (i = 0; i < numCommands; i++)
+    {
+        encodeList(&buf, commands[i]);
+    }
+
+    // write a new file and rename it so a reader never sees half of one
+    if (buf.hasError == false &&
+        snprintf(tempPath, sizeof(tempPath), "%s.%d", cachePath, getpid()) < (int) sizeof(tempPath))
+    {
+        fd = open(tempPath, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0600);
+        if (fd != -1)
+        {
+            if (writeAll(fd, buf.data, buf.length) == -1 || close(fd) == -1 ||
+                rename(tempPath, cachePath) == -1)
+            {
+                unlink(tempPath);
+            }
+        }
+    }
+
+    free(buf.data);
+}
+
+
+
+int scriptCachePath(const char *path, char *fullPath, char *cachePath)
+{
+    const char *dir;
+
+    dir = getenv("SMALLSH_CACHE");
+    if (dir == NULL || dir[0] == '\0' || realpath(path, fullPath) == NULL)
+    {
+        return -1;
+    }
+
+    if (snprintf(cachePath, PATH_MAX, "%s/scripts", dir) >= PATH_MAX)
+    {
+        return -1;
+    }
+    mkdir(dir, 0700);
+    mkdir(cachePath, 0700);
+
+    if (snprintf(cachePath, PATH_MAX, "%s/scripts/%016zx", dir, hashString(fullPath)) >= PATH_MAX)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+
+
+void encodeList(struct byteBuffer *buf, struct node *node)
+{
+    struct command *stage;
+    int i;
+    int j;
+
+    for (; node != NULL; node = node->next)
+    {
+        // types are stored from 1 so that 0 can end the list
+        putInt(buf, node->type + 1);
+
+        switch (node->type)
+        {
+            case NODE_PIPELINE:
+                putInt(buf, node->pl->isBackground);
+                putInt(buf, node->pl->numStages);
+                for (i = 0; i < node->pl->numStages; i++)
+                {
+                    stage = &node->pl->stages[i];
+                    putInt(buf, stage->argc);
+                    for (j = 0; j < stage->argc; j++)
+                    {
+                        putString(buf, stage->argv[j]);
+                    }
+                    putString(buf, stage->inputFile);
+                    putString(buf, stage->inputText);
+                    putString(buf, stage->outputFile);
+                }
+                break;
+
+            case NODE_AND:
+            case NODE_OR:
+                encodeList(buf, node->first);
+                encodeList(buf, node->second);
+                break;
+
+            case NODE_IF:
+            case NODE_WHILE:
+                encodeList(buf, node->cond);
+                encodeList(buf, node->body);
+                encodeList(buf, node->orElse);
+                break;
+
+            case NODE_FOR:
+                putString(buf, node->name);
+                putInt(buf, node->numWords);
+                for (i = 0; i < node->numWords; i++)
+                {
+                    putString(buf, node->words[i]);
+                }
+                encodeList(buf, node->body);
+                break;
+        }
+    }
+
+    putInt(buf, 0);
+}
+
+
+
+struct node *decodeList(struct byteBuffer *buf, struct arena *arena)
+{
+    struct node *head = NULL;
+    struct node **tail = &head;
+    struct node *node;
+    struct command *stage;
+    int type;
+    int i;
+    int j;
+
+    while (buf->hasError == false && (type = getInt(buf)) != 0)
+    {
+        node = arenaAlloc(arena, sizeof(struct node));
+        if (node == NULL || type < NODE_PIPELINE + 1 || type > NODE_FOR + 1)
+        {
+            buf->hasError = true;
+            break;
+        }
+        node->type = type - 1;
+        *tail = node;
+        tail = &node->next;
+
+        switch (node->type)
+        {
+            case NODE_PIPELINE:
+                node->pl = arenaAlloc(arena, sizeof(struct pipeline));
+                if (node->pl == NULL)
+                {
+                    buf->hasError = true;
+                    break;
+                }
+                node->pl->isBackground = (getInt(buf) != 0);
+                node->pl->numStages = getInt(buf);
+                if (node->pl->numStages < 1 || node->pl->numStages > MAX_STAGES ||
+                    (node->pl->stages = arenaAlloc(arena, node->pl->numStages *
+                                                   sizeof(struct command))) == NULL)
+                {
+                    buf->hasError = true;
+                    break;
+                }
+                for (i = 0; buf->hasError == false && i < node->pl->numStages; i++)
+                {
+                    stage = &node->pl->stages[i];
+                    stage->argc = getInt(buf);
+                    if (stage->argc < 0 || stage->argc > MAX_ARGS ||
+                        (stage->argv = arenaAlloc(arena, (stage->argc + 1) *
+                                                  sizeof(char *))) == NULL)
+                    {
+                        buf->hasError = true;
+                        break;
+                    }
+                    for (j = 0; j < stage->argc; j++)
+                    {
+                        stage->argv[j] = getString(buf, arena);
+                        if (stage->argv[j] == NULL)
+                        {
+                            buf->hasError = true;
+                        }
+                    }
+                    stage->inputFile = getString(buf, arena);
+                    stage->inputText = getString(buf, arena);
+                    stage->outputFile = getString(buf, arena);
+                }
+                if (buf->hasError == false)
+                {
+                    node->pl->hasExpansions = needsExpansion(node->pl);
+                }
+                break;
+
+            case NODE_AND:
+            case NODE_OR:
+                node->first = decodeList(buf, arena);
+                node->second = decodeList(buf, arena);
+                if (node->first == NULL || node->second == NULL)
+                {
+                    buf->hasError = true;
+                }
+                break;
+
+            case NODE_IF:
+            case NODE_WHILE:
+                node->cond = decodeList(buf, arena);
+                node->body = decodeList(buf, arena);
+                node->orElse = decodeList(buf, arena);
+                break;
+
+            case NODE_FOR:
+                node->name = getString(buf, arena);
+                node->numWords = getInt(buf);
+                if (node->name == NULL || node->numWords < 0 || node->numWords > MAX_ARGS ||
+                    (node->words = arenaAlloc(arena, (node->numWords + 1) *
+                                              sizeof(char *))) == NULL)
+                {
+                    buf->hasError = true;
+                    break;
+                }
+                for (i = 0; i < node->numWords; i++)
+                {
+                    node->words[i] = getString(buf, arena);
+                    if (node->words[i] == NULL)
+                    {
+                        buf->hasError = true;
+                    }
+                }
+                node->body = decodeList(buf, arena);
+                break;
+        }
+    }
+
+    return head;
+}
+
+
+
+void putBytes(struct byteBuffer *buf, const void *data, size_t length)
+{
+    size_t newSize;
+    char *newData;
+
+    if (buf->hasError == true)
+    {
+        return;
+    }
+
+    if (buf->length + length > buf->size)
+    {
+        newSize = (buf->size == 0) ? READ_BUFFER : buf->size;
+        while (newSize < buf->length + length)
+        {
+            newSize *= 2;
+        }
+
+        newData = realloc(buf->data, newSize);
+        if (newData == NULL)
+        {
+            buf->hasError = true;
+            return;
+        }
+        buf->data = newData;
+        buf->size = newSize;
+    }
+
+    memcpy(buf->data + buf->length, data, length);
+    buf->length += length;
+}
+
+
+
+void putInt(struct byteBuffer *buf, int value)
+{
+    putBytes(buf, &value, sizeof(value));
+}
+
+
+
+void putString(struct byteBuffer *buf, const char *text)
+{
+    // a missing string is stored as length -1
+    if (text == NULL)
+    {
+        putInt(buf, -1);
+        return;
+    }
+
+    putInt(buf, strlen(text));
+    putBytes(buf, text, strlen(text));
+}
+
+
+
+void getBytes(struct byteBuffer *buf, void *data, size_t length)
+{
+    if (buf->hasError == true || buf->length - buf->pos < length)
+    {
+        buf->hasError = true;
+        memset(data, 0, length);
+        return;
+    }
+
+    memcpy(data, buf->data + buf->pos, length);
+    buf->pos += length;
+}
+
+
+
+int getInt(struct byteBuffer *buf)
+{
+    int value;
+
+    getBytes(buf, &value, sizeof(value));
+    return value;
+}
+
+
+
+char *getString(struct byteBuffer *buf, struct arena *arena)
+{
+    char *text;
+    int length;
+
+    length = getInt(buf);
+    if (buf->hasError == true || length == -1)
+    {
+        return NULL;
+    }
+
+    if (length < 0 || buf->length - buf->pos < (size_t) length)
+    {
+        buf->hasError = true;
+        return NULL;
+    }
+
+    text = arenaString(arena, buf->data + buf->pos, length);
+    if (text == NULL)
+    {
+        buf->hasError = true;
+        return NULL;
+    }
+    buf->pos += length;
+
+    return text;
+}
+
+
+
+int runCached(struct pipeline *pl)
+{
+    struct command stages[MAX_STAGES];
+    struct pipeline uncached;
+    struct byteBuffer key;
+    struct job *lastJob;
+    char path[PATH_MAX];
+    char capturePath[32];
+    void *output = NULL;
+    off_t length;
+    int captureFd;
+    int outFd = 1;
+    int status;
+
+    if (pl->stages[0].argc < 2)
+    {
+        printf("smallsh: usage: cached command\n");
+        lastStatus = W_EXITCODE(2, 0);
+        return lastStatus;
+    }
+
+    // the rest of the command runs from a copy, so that a loop can run the
+    // parsed pipeline again
+    memcpy(stages, pl->stages, pl->numStages * sizeof(struct command));
+    stages[0].argv++;
+    stages[0].argc--;
+    uncached = *pl;
+    uncached.stages = stages;
+
+    // only the output of one foreground command is kept, and a built in
+    // command, which may change the shell, has to run every time
+    memset(&key, 0, sizeof(key));
+    if (pl->numStages > 1 || pl->isBackground == true ||
+        isBuiltin(stages[0].argv[0]) == true ||
+        resultCachePath(&stages[0], &key, path) == -1)
+    {
+        free(key.data);
+        return runPipeline(&uncached);
+    }
+
+    // the output file is opened first, as it would be if the command ran
+    if (stages[0].outputFile != NULL)
+    {
+        outFd = openRedirection(stages[0].outputFile, true);
+        if (outFd == -1)
+        {
+            free(key.data);
+            lastStatus = W_EXITCODE(1, 0);
+            isFgTimedOut = false;
+            return lastStatus;
+        }
+    }
+    fflush(stdout);
+
+    if (replayResult(path, &key, outFd, &status) == 0)
+    {
+        if (DEBUG)
+        {
+            printf("Replayed %s from %s\n", stages[0].argv[0], path);
+        }
+
+        lastStatus = status;
+        isFgTimedOut = false;
+    }
+    else
+    {
+        // catch the output in a memfd that the command opens by name
+        captureFd = memfd_create("cached", MFD_CLOEXEC);
+        if (captureFd != -1)
+        {
+            snprintf(capturePath, sizeof(capturePath), "/proc/self/fd/%d", captureFd);
+            stages[0].outputFile = capturePath;
+        }
+
+        lastJob = jobs.tail;
+        status = runPipeline(&uncached);
+
+        if (captureFd != -1)
+        {
+            length = lseek(captureFd, 0, SEEK_END);
+            if (length > 0)
+            {
+                output = mmap(NULL, length, PROT_READ, MAP_PRIVATE, captureFd, 0);
+            }
+            if (output != MAP_FAILED)
+            {
+                if (length > 0)
+                {
+                    writeAll(outFd, output, length);
+                }
+
+                // a command that was stopped, killed or timed out has not
+                // printed all it would have
+                if (WIFEXITED(status) && isFgTimedOut == false &&
+                    (jobs.tail == lastJob || jobs.tail->isStopped == false))
+                {
+                    saveResult(path, &key, status, output, (length > 0) ? length : 0);
+                }
+
+                if (length > 0)
+                {
+                    munmap(output, length);
+                }
+            }
+            close(captureFd);
+        }
+    }
+
+    if (outFd != 1)
+    {
+        close(outFd);
+    }
+    free(key.data);
+
+    return status;
+}
+
+
+
+bool isBuiltin(const char *name)
+{
+    int i;
+
+    for (i = 0; builtins[i] != NULL; i++)
+    {
+        if (strcmp(name, builtins[i]) == 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+
+int resultCachePath(struct command *cmd, struct byteBuffer *key, char *path)
+{
+    char dir[PATH_MAX];
+    char cwd[PATH_MAX];
+    struct stat info;
+    struct stat nullInfo;
+    const char *names;
+    const char *end;
+    const char *program;
+    const char *home;
+    char name[256];
+    long long fields[5];
+    off_t offset;
+    size_t hash = 2166136261u;
+    size_t i;
+
+    // the results go under SMALLSH_CACHE, like parsed scripts, or under
+    // the user's cache directory
+    if (getenv("SMALLSH_CACHE") != NULL && getenv("SMALLSH_CACHE")[0] != '\0')
+    {
+        if (snprintf(dir, sizeof(dir), "%s", getenv("SMALLSH_CACHE")) >= (int) sizeof(dir))
+        {
+            return -1;
+        }
+    }
+    else
+    {
+        home = getenv("HOME");
+        if (home == NULL || snprintf(dir, sizeof(dir), "%s/.cache", home) >= (int) sizeof(dir))
+        {
+            return -1;
+        }
+        mkdir(dir, 0700);
+        strcat(dir, "/smallsh");
+    }
+    mkdir(dir, 0700);
+    if (strlen(dir) + sizeof("/results") > sizeof(dir))
+    {
+        return -1;
+    }
+    strcat(dir, "/results");
+    mkdir(dir, 0700);
+
+    if (getcwd(cwd, sizeof(cwd)) == NULL)
+    {
+        return -1;
+    }
+
+    // the command: where it runs, its words, and the program it runs
+    putString(key, cwd);
+    putInt(key, cmd->argc);
+    for (i = 0; i < (size_t) cmd->argc; i++)
+    {
+        putString(key, cmd->argv[i]);
+    }
+    memset(fields, 0, sizeof(fields));
+    program = lookupCommand(cmd->argv[0], false);
+    if (program != NULL && stat(program, &info) == 0)
+    {
+        fields[0] = info.st_dev;
+        fields[1] = info.st_ino;
+        fields[2] = info.st_size;
+        fields[3] = info.st_mtim.tv_sec;
+        fields[4] = info.st_mtim.tv_nsec;
+    }
+    putBytes(key, fields, sizeof(fields));
+
+    // the environment variables that may change what it prints
+    names = getenv("SMALLSH_CACHE_ENV");
+    if (names == NULL)
+    {
+        names = "PATH:HOME:LANG:LC_ALL:TZ";
+    }
+    while (*names != '\0')
+    {
+        end = strchr(names, ':');
+        if (end == NULL)
+        {
+            end = names + strlen(names);
+        }
+        if (end > names && end - names < (long) sizeof(name))
+        {
+            memcpy(name, names, end - names);
+            name[end - names] = '\0';
+            putString(key, name);
+            putString(key, getenv(name));
+        }
+        names = (*end == ':') ? end + 1 : end;
+    }
+
+    // and what it reads: the identity of the input file as it is now, or
+    // the text of a here-document
+    memset(fields, 0, sizeof(fields));
+    offset = 0;
+    if (cmd->inputFile != NULL)
+    {
+        if (stat(cmd->inputFile, &info) == -1)
+        {
+            return -1;
+        }
+        fields[0] = info.st_dev;
+        fields[1] = info.st_ino;
+        fields[2] = info.st_size;
+        fields[3] = info.st_mtim.tv_sec;
+        fields[4] = info.st_mtim.tv_nsec;
+    }
+    else if (cmd->inputText == NULL)
+    {
+        // otherwise it reads the shell's own input, from where that is
+        // now; a pipe, terminal or socket cannot be named, so the command
+        // is not cached, and /dev/null is no input at all
+        if (fstat(0, &info) == -1)
+        {
+            return -1;
+        }
+        if (S_ISREG(info.st_mode))
+        {
+            fields[0] = info.st_dev;
+            fields[1] = info.st_ino;
+            fields[2] = info.st_size;
+            fields[3] = info.st_mtim.tv_sec;
+            fields[4] = info.st_mtim.tv_nsec;
+            offset = lseek(0, 0, SEEK_CUR);
+        }
+        else if (S_ISCHR(info.st_mode) == false ||
+                 stat("/dev/null", &nullInfo) == -1 ||
+                 info.st_rdev != nullInfo.st_rdev)
+        {
+            return -1;
+        }
+    }
+    putBytes(key, fields, sizeof(fields));
+    putBytes(key, &offset, sizeof(offset));
+    putString(key, cmd->inputText);
+
+    if (key->hasError == true)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < key->length; i++)
+    {
+        hash ^= (unsigned char) key->data[i];
+        hash *= 16777619u;
+    }
+
+    if (snprintf(path, PATH_MAX, "%s/%016zx", dir, hash) >= PATH_MAX)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+
+
+int replayResult(const char *path, struct byteBuffer *key, int outFd, int *status)
+{
+    char magic[8];
+    struct byteBuffer buf;
+    struct stat info;
+    long long length;
+    int keyLength;
+    void *data;
+    int fd;
+
+    fd = open(path, O_RDONLY|O_CLOEXEC);
+    if (fd == -1)
+    {
+        return -1;
+    }
+    if (fstat(fd, &info) == -1 || info.st_size == 0)
+    {
+        close(fd);
+        return -1;
+    }
+    data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+    {
+        close(fd);
+        return -1;
+    }
+
+    memset(&buf, 0, sizeof(buf));
+    buf.data = data;
+    buf.length = info.st_size;
+
+    // the entry must be for the same key, since names are only a hash
+    getBytes(&buf, magic, sizeof(magic));
+    keyLength = getInt(&buf);
+    if (buf.hasError == false && memcmp(magic, "smallshR", sizeof(magic)) == 0 &&
+        keyLength == (int) key->length && buf.length - buf.pos >= key->length &&
+        memcmp(buf.data + buf.pos, key->data, key->length) == 0)
+    {
+        buf.pos += key->length;
+    }
+    else
+    {
+        buf.hasError = true;
+    }
+    *status = getInt(&buf);
+    getBytes(&buf, &length, sizeof(length));
+    if (length < 0 || (long long) (buf.length - buf.pos) != length)
+    {
+        buf.hasError = true;
+    }
+
+    if (buf.hasError == false)
+    {
+        writeAll(outFd, buf.data + buf.pos, length);
+
+        // the modification time orders results for trimming
+        futimens(fd, NULL);
+    }
+
+    munmap(data, info.st_size);
+    close(fd);
+
+    return (buf.hasError == true) ? -1 : 0;
+}
+
+
+
+void saveResult(const char *path, struct byteBuffer *key, int status,
+                const char *output, size_t length)
+{
+    char tempPath[PATH_MAX];
+    char dir[PATH_MAX];
+    struct byteBuffer buf;
+    const char *limit;
+    long long size = length;
+    long long maxSize = RESULT_CACHE;
+    int fd;
+
+    limit = getenv("SMALLSH_CACHE_SIZE");
+    if (limit != NULL && limit[0] != '\0')
+    {
+        maxSize = atoll(limit);
+    }
+
+    memset(&buf, 0, sizeof(buf));
+    putBytes(&buf, "smallshR", 8);
+    putInt(&buf, key->length);
+    putBytes(&buf, key->data, key->length);
+    putInt(&buf, status);
+    putBytes(&buf, &size, sizeof(size));
+
+    // a result too big for the whole cache is not kept
+    if (buf.hasError == false && (long long) (buf.length + length) <= maxSize &&
+        snprintf(tempPath, sizeof(tempPath), "%s.%d", path, getpid()) < (int) sizeof(tempPath))
+    {
+        fd = open(tempPath, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0600);
+        if (fd != -1)
+        {
+            if (writeAll(fd, buf.data, buf.length) == -1 ||
+                writeAll(fd, output, length) == -1 || close(fd) == -1 ||
+                rename(tempPath, path) == -1)
+            {
+                unlink(tempPath);
+            }
+            else
+            {
+                strcpy(dir, path);
+                *strrchr(dir, '/') = '\0';
+                trimResults(dir);
+            }
+        }
+    }
+
+    free(buf.data);
+}
+
+
+
+int compareResults(const void *a, const void *b)
+{
+    const struct resultEntry *first = a;
+    const struct resultEntry *second = b;
+
+    if (first->usedAt.tv_sec != second->usedAt.tv_sec)
+    {
+        return (first->usedAt.tv_sec < second->usedAt.tv_sec) ? -1 : 1;
+    }
+    if (first->usedAt.tv_nsec != second->usedAt.tv_nsec)
+    {
+        return (first->usedAt.tv_nsec < second->usedAt.tv_nsec) ? -1 : 1;
+    }
+    return 0;
+}
+
+
+
+void trimResults(const char *dir)
+{
+    struct resultEntry *entries = NULL;
+    struct resultEntry *newEntries;
+    struct dirent *file;
+    struct stat info;
+    const char *limit;
+    long long maxSize = RESULT_CACHE;
+    long long total = 0;
+    size_t numEntries = 0;
+    size_t size = 0;
+    size_t i;
+    DIR *results;
+
+    limit = getenv("SMALLSH_CACHE_SIZE");
+    if (limit != NULL && limit[0] != '\0')
+    {
+        maxSize = atoll(limit);
+    }
+
+    results = opendir(dir);
+    if (results == NULL)
+    {
+        return;
+    }
+
+    // list the saved results; names with a dot are files still being
+    // written by some shell
+    while ((file = readdir(results)) != NULL)
+    {
+        if (strchr(file->d_name, '.') != NULL ||
+            strlen(file->d_name) >= sizeof(entries->name) ||
+            fstatat(dirfd(results), file->d_name, &info, AT_SYMLINK_NOFOLLOW) == -1 ||
+            !S_ISREG(info.st_mode))
+        {
+            continue;
+        }
+
+        if (numEntries == size)
+        {
+            size = (size == 0) ? MIN_BUCKETS : size * 2;
+            newEntries = realloc(entries, size * sizeof(struct resultEntry));
+            if (newEntries == NULL)
+            {
+                break;
+            }
+            entries = newEntries;
+        }
+
+        strcpy(entries[numEntries].name, file->d_name);
+        entries[numEntries].usedAt = info.st_mtim;
+        entries[numEntries].size = info.st_size;
+        total += info.st_size;
+        numEntries++;
+    }
+
+    // then remove the least recently used until the rest fit
+    if (total > maxSize)
+    {
+        qsort(entries, numEntries, sizeof(struct resultEntry), compareResults);
+        for (i = 0; i < numEntries && total > maxSize; i++)
+        {
+            if (unlinkat(dirfd(results), entries[i].name, 0) == 0)
+            {
+                total -= entries[i].size;
+            }
+        }
+    }
+
+    closedir(results);
+    free(entries);
+}
+
+
+
+pid_t startPipeline(struct pipeline *pl, pid_t *pids, int *cpus, bool isLimited)
+{
+    struct command *stage;
+    long long startNs;
+    sigset_t emptyMask;
+    bool takeTerminal = (pl->isBackground == false && isJobControl == true);
+    pid_t pgid = (pl->isBackground == true || isLimited == true ||
+                  isJobControl == true) ? 0 : -1;
+    int pipeFds[2];
+    int prevRead = -1;
+    int inFd;
+    int outFd;
+    int i;
+
+    // make sure pending output appears before anything the stages print
+    fflush(stdout);
+
+    for (i = 0; i < pl->numStages; i++)
+    {
+        stage = &pl->stages[i];
+        pids[i] = -1;
+
+        // the pipe to the next stage, if there is one
+        pipeFds[0] = pipeFds[1] = -1;
+        if (i + 1 < pl->numStages && pipe2(pipeFds, O_CLOEXEC) == -1)
+        {
+            perror("smallsh: pipe");
+        }
+
+        // explicit redirections take the place of the pipes
+        inFd = prevRead;
+        outFd = pipeFds[1];
+        if (stage->inputText != NULL)
+        {
+            inFd = openInputText(stage->inputText);
+        }
+        else if (stage->inputFile != NULL)
+        {
+            inFd = openRedirection(stage->inputFile, false);
+        }
+        else if (i == 0 && pl->isBackground == true)
+        {
+            // redirect stdin for bg process to dev/null if no path provided
+            inFd = openRedirection("/dev/null", false);
+        }
+        if (stage->outputFile != NULL &&
+            (inFd != -1 || (stage->inputFile == NULL && stage->inputText == NULL)))
+        {
+            outFd = openRedirection(stage->outputFile, true);
+        }
+
+        if (((stage->inputFile != NULL || stage->inputText != NULL) && inFd == -1) ||
+            (stage->outputFile != NULL && outFd == -1) ||
+            (i + 1 < pl->numStages && pipeFds[1] == -1))
+        {
+            // a file or pipe could not be opened, so skip this stage
+        }
+        else if (stage->argc == 0 && pl->numStages == 1)
+        {
+            // a lone redirection only creates its files
+            pids[i] = 0;
+        }
+        else if (pl->numStages > 1 && isCopyStage(stage))
+        {
+            startNs = traceStart();
+            pids[i] = fork();
+
+            if (pids[i] == 0) // child process
+            {
+                // the read end of our own output pipe belongs downstream
+                if (pipeFds[0] != -1)
+                {
+                    close(pipeFds[0]);
+                }
+
+                // join the job's group as a spawned stage would
+                if (pgid != -1)
+                {
+                    setpgid(0, pgid);
+                }
+                if (pgid == 0 && takeTerminal == true)
+                {
+                    tcsetpgrp(ttyFd, getpid());
+                }
+                if (isJobControl == true)
+                {
+                    signal(SIGINT, SIG_DFL);
+                    signal(SIGTSTP, SIG_DFL);
+                    signal(SIGTTIN, SIG_DFL);
+                    signal(SIGTTOU, SIG_DFL);
+                }
+
+                sigemptyset(&emptyMask);
+                sigprocmask(SIG_SETMASK, &emptyMask, NULL);
+
+                _exit(runCopyStage(stage, inFd == -1 ? 0 : inFd,
+                                   outFd == -1 ? 1 : outFd));
+            }
+            else if (pids[i] == -1)
+            {
+                perror("smallsh: fork");
+            }
+            else
+            {
+                traceEvent(TRACE_FORK, pids[i], startNs);
+            }
+
+            if (pids[i] > 0 && pgid != -1)
+            {
+                // set the group from both sides so neither can run first
+                setpgid(pids[i], (pgid == 0) ? pids[i] : pgid);
+                if (pgid == 0 && takeTerminal == true)
+                {
+                    tcsetpgrp(ttyFd, pids[i]);
+                }
+            }
+        }
+        else
+        {
+            pids[i] = spawnProcess(stage->argv, inFd, outFd, pgid, takeTerminal);
+        }
+
+        // the first process started leads the job's group
+        if (pgid == 0 && pids[i] > 0)
+        {
+            pgid = pids[i];
+        }
+
+        // and each goes where the placement policy puts it
+        cpus[i] = -1;
+        if (pids[i] > 0 && placement.isOn == true)
+        {
+            cpus[i] = placeProcess(pids[i], pl->isBackground);
+        }
+
+        // the parent keeps no copies of the stage's descriptors
+        if (inFd != -1)
+        {
+            close(inFd);
+        }
+        if (prevRead != -1 && prevRead != inFd)
+        {
+            close(prevRead);
+        }
+        if (outFd != -1)
+        {
+            close(outFd);
+        }
+        if (pipeFds[1] != -1 && pipeFds[1] != outFd)
+        {
+            close(pipeFds[1]);
+        }
+
+        prevRead = pipeFds[0];
+    }
+
+    return (pgid > 0) ? pgid : 0;
+}
+
+
+
+int placeProcess(pid_t pid, bool isBackground)
+{
+    cpu_set_t cpus;
+    int cpu = -1;
+    int best = -1;
+    int i;
+
+    if (isBackground == false)
+    {
+        if (placement.hasFgCpus == true)
+        {
+            sched_setaffinity(pid, sizeof(cpu_set_t), &placement.fgCpus);
+        }
+        return -1;
+    }
+
+    if (placement.policy == PLACE_NONE)
+    {
+        sched_setaffinity(pid, sizeof(cpu_set_t), &placement.jobCpus);
+        return -1;
+    }
+
+    // search the allowed CPUs once round, starting after the last one
+    // chosen so that ties are spread out
+    for (i = 0; i < CPU_SETSIZE; i++)
+    {
+        cpu = (placement.next + i) % CPU_SETSIZE;
+        if (!CPU_ISSET(cpu, &placement.jobCpus))
+        {
+            continue;
+        }
+        if (placement.policy == PLACE_ROUND_ROBIN)
+        {
+            best = cpu;
+            break;
+        }
+        if (best == -1 || placement.numPlaced[cpu] < placement.numPlaced[best])
+        {
+            best = cpu;
+        }
+    }
+    if (best == -1)
+    {
+        return -1;
+    }
+
+    CPU_ZERO(&cpus);
+    CPU_SET(best, &cpus);
+    if (sched_setaffinity(pid, sizeof(cpu_set_t), &cpus) == -1)
+    {
+        return -1;
+    }
+
+    placement.next = (best + 1) % CPU_SETSIZE;
+    placement.numPlaced[best]++;
+    return best;
+}
+
+
+
+void releaseCpu(int cpu)
+{
+    if (cpu >= 0 && placement.numPlaced[cpu] > 0)
+    {
+        placement.numPlaced[cpu]--;
+    }
+}
+
+
+
+int setPlacement(int argc, char **argv)
+{
+    enum placePolicy policy = PLACE_NONE;
+    char path[64];
+    char text[4096];
+    cpu_set_t allowed;
+    cpu_set_t nodeCpus;
+    cpu_set_t fgCpus;
+    bool hasFgCpus = false;
+    bool hasNode = false;
+    bool isOff = false;
+    ssize_t length;
+    char *end;
+    long node = 0;
+    int fd;
+    int i;
+
+    for (i = 0; i < argc; i++)
+    {
+        if (strcmp(argv[i], "off") == 0)
+        {
+            isOff = true;
+        }
+        else if (strcmp(argv[i], "none") == 0)
+        {
+            policy = PLACE_NONE;
+        }
+        else if (strcmp(argv[i], "roundrobin") == 0)
+        {
+            policy = PLACE_ROUND_ROBIN;
+        }
+        else if (strcmp(argv[i], "leastloaded") == 0)
+        {
+            policy = PLACE_LEAST_LOADED;
+        }
+        else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+        {
+            if (parseCpuList(argv[++i], &fgCpus) == -1)
+            {
+                return -1;
+            }
+            hasFgCpus = true;
+        }
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+        {
+            node = strtol(argv[++i], &end, 10);
+            if (end == argv[i] || *end != '\0' || node < 0 || node > INT_MAX)
+            {
+                return -1;
+            }
+            hasNode = true;
+        }
+        else
+        {
+            return -1;
+        }
+    }
+
+    if (isOff == true)
+    {
+        placement.isOn = false;
+        placement.policy = PLACE_NONE;
+        placement.hasFgCpus = false;
+        placement.hasNode = false;
+        return 0;
+    }
+
+    // jobs may use the CPUs the shell may, or those of the node asked for
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1)
+    {
+        return -1;
+    }
+    if (hasNode == true)
+    {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%ld/cpulist", node);
+        fd = open(path, O_RDONLY|O_CLOEXEC);
+        length = (fd == -1) ? -1 : read(fd, text, sizeof(text) - 1);
+        if (fd != -1)
+        {
+            close(fd);
+        }
+        if (length <= 0)
+        {
+            return -1;
+        }
+        text[length] = '\0';
+        text[strcspn(text, "\n")] = '\0';
+        if (parseCpuList(text, &nodeCpus) == -1)
+        {
+            return -1;
+        }
+        CPU_AND(&allowed, &allowed, &nodeCpus);
+        if (CPU_COUNT(&allowed) == 0)
+        {
+            return -1;
+        }
+    }
+
+    // less the foreground's, unless that would leave none
+    placement.jobCpus = allowed;
+    if (hasFgCpus == true)
+    {
+        for (i = 0; i < CPU_SETSIZE; i++)
+        {
+            if (CPU_ISSET(i, &fgCpus))
+            {
+                CPU_CLR(i, &placement.jobCpus);
+            }
+        }
+        if (CPU_COUNT(&placement.jobCpus) == 0)
+        {
+            placement.jobCpus = allowed;
+        }
+        placement.fgCpus = fgCpus;
+    }
+
+    // processes already pinned stay counted against their CPUs
+    placement.policy = policy;
+    placement.hasFgCpus = hasFgCpus;
+    placement.node = node;
+    placement.hasNode = hasNode;
+    placement.isOn = true;
+    return 0;
+}
+
+
+
+int startPlacement(const char *text)
+{
+    char *words[8];
+    char *copy;
+    char *word;
+    char *save;
+    int numWords = 0;
+    int result = -1;
+
+    copy = strdup(text);
+    if (copy == NULL)
+    {
+        return -1;
+    }
+
+    for (word = strtok_r(copy, " \t", &save); word != NULL; word = strtok_r(NULL, " \t", &save))
+    {
+        if (numWords == 8)
+        {
+            break;
+        }
+        words[numWords++] = word;
+    }
+    if (word == NULL)
+    {
+        result = setPlacement(numWords, words);
+    }
+
+    free(copy);
+    return result;
+}
+
+
+
+int placementBuiltin(struct command *cmd)
+{
+    static const char *policies[] = { "none", "roundrobin", "leastloaded" };
+
+    if (cmd->argc > 1)
+    {
+        if (setPlacement(cmd->argc - 1, cmd->argv + 1) == -1)
+        {
+            printf("smallsh: usage: placement [off | none | roundrobin | leastloaded] "
+                   "[-f cpus] [-n node]\n");
+            fflush(stdout);
+            return 2;
+        }
+        return 0;
+    }
+
+    if (placement.isOn == false)
+    {
+        printf("placement off\n");
+        return 0;
+    }
+
+    printf("placement %s, jobs on ", policies[placement.policy]);
+    printCpuList(&placement.jobCpus);
+    if (placement.hasFgCpus == true)
+    {
+        printf(", foreground on ");
+        printCpuList(&placement.fgCpus);
+    }
+    if (placement.hasNode == true)
+    {
+        printf(", node %d", placement.node);
+    }
+    printf("\n");
+    return 0;
+}
+
+
+
+int parseCpuList(const char *text, cpu_set_t *cpus)
+{
+    char *end;
+    long first;
+    long last;
+
+    CPU_ZERO(cpus);
+    do
+    {
+        first = strtol(text, &end, 10);
+        if (end == text || first < 0 || first >= CPU_SETSIZE)
+        {
+            return -1;
+        }
+        last = first;
+        if (*end == '-')
+        {
+            text = end + 1;
+            last = strtol(text, &end, 10);
+            if (end == text || last < first || last >= CPU_SETSIZE)
+            {
+                return -1;
+            }
+        }
+        for (; first <= last; first++)
+        {
+            CPU_SET(first, cpus);
+        }
+        text = end + 1;
+    }
+    while (*end == ',');
+
+    return (*end == '\0') ? 0 : -1;
+}
+
+
+
+void printCpuList(const cpu_set_t *cpus)
+{
+    const char *separator = "";
+    int first;
+    int i;
+
+    for (i = 0; i < CPU_SETSIZE; i++)
+    {
+        if (!CPU_ISSET(i, cpus))
+        {
+            continue;
+        }
+
+        // a run of CPUs is shown as first-last
+        first = i;
+        while (i + 1 < CPU_SETSIZE && CPU_ISSET(i + 1, cpus))
+        {
+            i++;
+        }
+        if (i > first)
+        {
+            printf("%s%d-%d", separator, first, i);
+        }
+        else
+        {
+            printf("%s%d", separator, first);
+        }
+        separator = ",";
+    }
+}
+
+
+
+int openRedirection(const char *path, bool isOutput)
+{
+    int fd;
+
+    if (isOutput == true)
+    {
+        fd = open(path, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+        if (fd == -1)
+        {
+            printf("smallsh: cannot open %s for output\n", path);
+        }
+    }
+    else
+    {
+        fd = open(path, O_RDONLY|O_CLOEXEC);
+        if (fd == -1)
+        {
+            printf("smallsh: cannot open %s for input\n", path);
+        }
+    }
+
+    return fd;
+}
+
+
+
+int openInputText(const char *text)
+{
+    size_t length = strlen(text);
+    int pipeFds[2];
+    int fd;
+
+    // a pipe takes up to PIPE_BUF bytes without anyone reading it
+    if (length <= PIPE_BUF)
+    {
+        if (pipe2(pipeFds, O_CLOEXEC) == -1)
+        {
+            perror("smallsh: pipe");
+            return -1;
+        }
+        if (writeAll(pipeFds[1], text, length) == -1)
+        {
+            perror("smallsh: here-document");
+            close(pipeFds[0]);
+            close(pipeFds[1]);
+            return -1;
+        }
+        close(pipeFds[1]);
+        return pipeFds[0];
+    }
+
+    // a larger body lives in memory behind a memfd, read from the start
+    fd = memfd_create("smallsh-heredoc", MFD_CLOEXEC);
+    if (fd == -1 || writeAll(fd, text, length) == -1 ||
+        lseek(fd, 0, SEEK_SET) == -1)
+    {
+        perror("smallsh: here-document");
+        if (fd != -1)
+        {
+            close(fd);
+        }
+        return -1;
+    }
+
+    return fd;
+}
+
+
+
+pid_t spawnProcess(char **argv, int inFd, int outFd, pid_t pgid, bool takeTerminal)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t emptyMask;
+    sigset_t defaultMask;
+    const char *path;
+    pid_t cpid = -1;
+    short flags = POSIX_SPAWN_SETSIGMASK|POSIX_SPAWN_SETSIGDEF;
+    long long startNs;
+    int result;
+
+    posix_spawn_file_actions_init(&actions);
+
+    // the first process of a fg job makes its new group the terminal's
+    // foreground group before it runs, so it never reads the terminal from
+    // the background
+    takeTerminal = (takeTerminal == true && isJobControl == true && pgid == 0);
+    if (takeTerminal == true)
+    {
+        posix_spawn_file_actions_addtcsetpgrp_np(&actions, ttyFd);
+    }
+    if (inFd != -1)
+    {
+        posix_spawn_file_actions_adddup2(&actions, inFd, 0);
+    }
+    if (outFd != -1)
+    {
+        posix_spawn_file_actions_adddup2(&actions, outFd, 1);
+    }
+
+    // start the child with nothing blocked and SIGPIPE back at its default;
+    // SIGINT stays ignored as it is in the shell, unless job control is on,
+    // when the terminal's signals go to the job itself
+    posix_spawnattr_init(&attr);
+    sigemptyset(&emptyMask);
+    posix_spawnattr_setsigmask(&attr, &emptyMask);
+    sigemptyset(&defaultMask);
+    sigaddset(&defaultMask, SIGPIPE);
+    if (isJobControl == true)
+    {
+        sigaddset(&defaultMask, SIGINT);
+        sigaddset(&defaultMask, SIGTSTP);
+        sigaddset(&defaultMask, SIGTTIN);
+        sigaddset(&defaultMask, SIGTTOU);
+    }
+    posix_spawnattr_setsigdefault(&attr, &defaultMask);
+    if (pgid != -1)
+    {
+        posix_spawnattr_setpgroup(&attr, pgid);
+        flags |= POSIX_SPAWN_SETPGROUP;
+    }
+    posix_spawnattr_setflags(&attr, flags);
+
+    // make sure pending output appears before anything the child prints
+    fflush(stdout);
+    startNs = traceStart();
+
+    // run the program found in PATH in order to use Linux built-ins,
+    // through the launcher helper if there is one (it cannot hand over the
+    // terminal, so that is done here); a cached program that has since
+    // been removed is looked up again
+    path = lookupCommand(argv[0], true);
+    result = (path == NULL) ? ENOENT :
+             (takeTerminal == true) ? -1 : launchProcess(&cpid, path, argv, inFd, outFd, pgid);
+    if (result == -1)
+    {
+        result = posix_spawn(&cpid, path, &actions, &attr, argv, environ);
+    }
+    if (result == ENOENT && path != NULL && path != argv[0])
+    {
+        forgetCommand(argv[0]);
+        path = lookupCommand(argv[0], true);
+        result = (path == NULL) ? ENOENT :
+             (takeTerminal == true) ? -1 : launchProcess(&cpid, path, argv, inFd, outFd, pgid);
+        if (result == -1)
+        {
+            result = posix_spawn(&cpid, path, &actions, &attr, argv, environ);
+        }
+    }
+    if (result != 0)
+    {
+        // this will never run unless error (i.e.- bad filename)
+        printf("%s", argv[0]);
+        fflush(NULL);
+        errno = result;
+        perror(" ");
+
+        cpid = -1;
+    }
+    else
+    {
+        // posix_spawn returns once the child has run exec
+        traceEvent(TRACE_SPAWN, cpid, startNs);
+        traceEvent(TRACE_EXEC, cpid, 0);
+    }
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+
+    return cpid;
+}
+
+
+
+bool isCopyStage(struct command *stage)
+{
+    int i;
+
+    if (stage->argc == 0)
+    {
+        return true;
+    }
+
+    if (strcmp(stage->argv[0], "cat") != 0 && strcmp(stage->argv[0], "tee") != 0)
+    {
+        return false;
+    }
+
+    // options are left to the real programs
+    for (i = 1; i < stage->argc; i++)
+    {
+        if (stage->argv[i][0] == '-')
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+
+int runCopyStage(struct command *stage, int inFd, int outFd)
+{
+    int *fileFds;
+    int exitValue = 0;
+    int numFiles = 0;
+    int fd;
+    int i;
+
+    if (stage->argc <= 1)
+    {
+        // no command, or cat / tee without files
+        return copyFd(inFd, outFd);
+    }
+
+    if (strcmp(stage->argv[0], "cat") == 0)
+    {
+        for (i = 1; i < stage->argc; i++)
+        {
+            fd = open(stage->argv[i], O_RDONLY);
+            if (fd == -1)
+            {
+                fprintf(stderr, "cat: %s: %s\n", stage->argv[i], strerror(errno));
+                exitValue = 1;
+                continue;
+            }
+
+            if (copyFd(fd, outFd) != 0)
+            {
+                exitValue = 1;
+            }
+            close(fd);
+        }
+
+        return exitValue;
+    }
+
+    // tee writes every file given, skipping ones that cannot be opened;
+    // a pattern may have given it any number of them
+    fileFds = malloc((stage->argc - 1) * sizeof(int));
+    if (fileFds == NULL)
+    {
+        perror("tee");
+        return 1;
+    }
+    for (i = 1; i < stage->argc; i++)
+    {
+        fd = open(stage->argv[i], O_WRONLY|O_CREAT|O_TRUNC, 0644);
+        if (fd == -1)
+        {
+            fprintf(stderr, "tee: %s: %s\n", stage->argv[i], strerror(errno));
+            exitValue = 1;
+            continue;
+        }
+        fileFds[numFiles++] = fd;
+    }
+
+    if (teeFd(inFd, outFd, fileFds, numFiles) != 0)
+    {
+        exitValue = 1;
+    }
+    free(fileFds);
+
+    return exitValue;
+}
+
+
+
+int copyFd(int inFd, int outFd)
+{
+    char buffer[COPY_CHUNK];
+    ssize_t numRead;
+    ssize_t numWritten;
+    ssize_t done;
+
+    // move data inside the kernel while one side is a pipe
+    while ((numRead = splice(inFd, NULL, outFd, NULL, COPY_CHUNK, SPLICE_F_MOVE)) > 0)
+    {
+        // keep going until end of file
+    }
+
+    if (numRead == 0)
+    {
+        return 0;
+    }
+    if (errno != EINVAL)
+    {
+        return 1;
+    }
+
+    // neither side is a pipe, so copy through a buffer
+    while ((numRead = read(inFd, buffer, sizeof(buffer))) > 0)
+    {
+        for (done = 0; done < numRead; done += numWritten)
+        {
+            numWritten = write(outFd, buffer + done, numRead - done);
+            if (numWritten == -1)
+            {
+                return 1;
+            }
+        }
+    }
+
+    return numRead == 0 ? 0 : 1;
+}
+
+
+
+int teeFd(int inFd, int outFd, int *fileFds, int numFiles)
+{
+    char buffer[COPY_CHUNK];
+    int scratch[2];
+    int from;
+    int fd;
+    ssize_t numCopied;
+    ssize_t numMoved;
+    ssize_t done;
+    int i;
+
+    if (numFiles == 0)
+    {
+        return copyFd(inFd, outFd);
+    }
+
+    if (pipe(scratch) == 0)
+    {
+        // duplicate each chunk into the output pipe, then move the same
+        // bytes into every file; the last file consumes them from inFd
+        while ((numCopied = tee(inFd, outFd, COPY_CHUNK, 0)) > 0)
+        {
+            for (i = 0; i < numFiles; i++)
+            {
+                from = inFd;
+
+                if (i + 1 < numFiles)
+                {
+                    if (tee(inFd, scratch[1], numCopied, 0) != numCopied)
+                    {
+                        return 1;
+                    }
+                    from = scratch[0];
+                }
+
+                for (done = 0; done < numCopied; done += numMoved)
+                {
+                    numMoved = splice(from, NULL, fileFds[i], NULL,
+                                      numCopied - done, SPLICE_F_MOVE);
+                    if (numMoved <= 0)
+                    {
+                        return 1;
+                    }
+                }
+            }
+        }
+
+        close(scratch[0]);
+        close(scratch[1]);
+
+        if (numCopied == 0)
+        {
+            return 0;
+        }
+        if (errno != EINVAL)
+        {
+            return 1;
+        }
+    }
+
+    // the input or output is not a pipe, so copy through a buffer
+    while ((numCopied = read(inFd, buffer, sizeof(buffer))) > 0)
+    {
+        for (i = -1; i < numFiles; i++)
+        {
+            fd = (i == -1) ? outFd : fileFds[i];
+
+            for (done = 0; done < numCopied; done += numMoved)
+            {
+                numMoved = write(fd, buffer + done, numCopied - done);
+                if (numMoved == -1)
+                {
+                    return 1;
+                }
+            }
+        }
+    }
+
+    return numCopied == 0 ? 0 : 1;
+}
+
+
+
+size_t hashIndex(int key, size_t numBuckets)
+{
+    return ((unsigned int) key * 2654435761u) & (numBuckets - 1);
+}
+
+
+
+void growJobTable()
+{
+    struct process **pidBuckets;
+    struct process *proc;
+    struct job **idBuckets;
+    struct job *job;
+    size_t numBuckets;
+    size_t index;
+    int i;
+
+    numBuckets = (jobs.numBuckets == 0) ? MIN_BUCKETS : jobs.numBuckets * 2;
+
+    pidBuckets = calloc(numBuckets, sizeof(struct process *));
+    idBuckets = calloc(numBuckets, sizeof(struct job *));
+    if (pidBuckets == NULL || idBuckets == NULL)
+    {
+        free(pidBuckets);
+        free(idBuckets);
+        return;
+    }
+
+    // every process belongs to a job, so walking the jobs finds them all
+    for (job = jobs.head; job != NULL; job = job->next)
+    {
+        index = hashIndex(job->id, numBuckets);
+        job->hashNext = idBuckets[index];
+        idBuckets[index] = job;
+
+        for (i = 0; i < job->numProcs; i++)
+        {
+            proc = &job->procs[i];
+            index = hashIndex(proc->pid, numBuckets);
+            proc->hashNext = pidBuckets[index];
+            pidBuckets[index] = proc;
+        }
+    }
+
+    free(jobs.pidBuckets);
+    free(jobs.idBuckets);
+    jobs.pidBuckets = pidBuckets;
+    jobs.idBuckets = idBuckets;
+    jobs.numBuckets = numBuckets;
+}
+
+
+
+char *pipelineText(struct pipeline *pl)
+{
+    struct command *stage;
+    size_t length = 0;
+    char *text;
+    char *p;
+    int i;
+    int j;
+
+    // measure first so the string is allocated once
+    for (i = 0; i < pl->numStages; i++)
+    {
+        stage = &pl->stages[i];
+        for (j = 0; j < stage->argc; j++)
+        {
+            length += strlen(stage->argv[j]) + 1;
+        }
+        if (stage->inputFile != NULL)
+        {
+            length += strlen(stage->inputFile) + 3;
+        }
+        if (stage->inputText != NULL)
+        {
+            length += 7;
+        }
+        if (stage->outputFile != NULL)
+        {
+            length += strlen(stage->outputFile) + 3;
+        }
+        length += 2;
+    }
+
+    text = malloc(length + 1);
+    if (text == NULL)
+    {
+        return NULL;
+    }
+
+    p = text;
+    for (i = 0; i < pl->numStages; i++)
+    {
+        stage = &pl->stages[i];
+        if (i > 0)
+        {
+            p += sprintf(p, "| ");
+        }
+        for (j = 0; j < stage->argc; j++)
+        {
+            p += sprintf(p, "%s ", stage->argv[j]);
+        }
+        if (stage->inputFile != NULL)
+        {
+            p += sprintf(p, "< %s ", stage->inputFile);
+        }
+        if (stage->inputText != NULL)
+        {
+            p += sprintf(p, "<< ... ");
+        }
+        if (stage->outputFile != NULL)
+        {
+            p += sprintf(p, "> %s ", stage->outputFile);
+        }
+    }
+
+    // drop the trailing space
+    if (p > text)
+    {
+        p--;
+    }
+    *p = '\0';
+
+    return text;
+}
+
+
+
+struct job *addJob(pid_t *pids, int numPids, struct pipeline *pl)
+{
+    struct job *job;
+    size_t index;
+
+    // keep about one job per bucket
+    if (jobs.numJobs + 1 > jobs.numBuckets)
+    {
+        growJobTable();
+    }
+    if (jobs.numBuckets == 0)
+    {
+        return NULL;
+    }
+
+    job = malloc(sizeof(struct job));
+    if (job == NULL)
+    {
+        return NULL;
+    }
+    job->command = pipelineText(pl);
+    if (job->command == NULL)
+    {
+        free(job);
+        return NULL;
+    }
+
+    job->procs = NULL;
+    job->numProcs = 0;
+    job->numLive = 0;
+    job->startNs = monotonicNs();
+    memset(&job->use, 0, sizeof(job->use));
+    memset(&job->limit, 0, sizeof(job->limit));
+    job->limit.job = job;
+    job->pgid = 0;
+    job->isStopped = false;
+    job->hasModes = false;
+    job->pending = NULL;
+    job->nice = 0;
+    job->queueIndex = 0;
+    job->timeoutNs = 0;
+    job->graceNs = 0;
+
+    if (numPids > 0 && watchProcesses(job, pids, numPids) == -1)
+    {
+        free(job->command);
+        free(job);
+        return NULL;
+    }
+
+    // number jobs from 1 again whenever the table has emptied
+    if (jobs.numJobs == 0)
+    {
+        jobs.nextId = 1;
+    }
+    job->id = jobs.nextId++;
+
+    index = hashIndex(job->id, jobs.numBuckets);
+    job->hashNext = jobs.idBuckets[index];
+    jobs.idBuckets[index] = job;
+
+    // append to the list of jobs in order of creation
+    job->next = NULL;
+    job->prev = jobs.tail;
+    if (jobs.tail != NULL)
+    {
+        jobs.tail->next = job;
+    }
+    else
+    {
+        jobs.head = job;
+    }
+    jobs.tail = job;
+    jobs.numJobs++;
+
+    return job;
+}
+
+
+
+int watchProcesses(struct job *job, pid_t *pids, int numPids)
+{
+    struct epoll_event event;
+    struct process *proc;
+    size_t index;
+    int i;
+
+    // keep about one process per bucket
+    if (jobs.numProcs + numPids > jobs.numBuckets)
+    {
+        growJobTable();
+    }
+
+    job->procs = malloc(numPids * sizeof(struct process));
+    if (job->procs == NULL)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < numPids; i++)
+    {
+        proc = &job->procs[i];
+        proc->pid = pids[i];
+        proc->pidfd = -1;
+        proc->cpu = -1;
+        proc->status = 0;
+        proc->isDone = false;
+        proc->job = job;
+    }
+
+    // watch each process through a pidfd; it becomes readable on exit
+    for (i = 0; i < numPids; i++)
+    {
+        proc = &job->procs[i];
+        proc->pidfd = pidfd_open(proc->pid, 0);
+
+        event.events = EPOLLIN;
+        event.data.ptr = proc;
+        if (proc->pidfd == -1 ||
+            epoll_ctl(jobs.epollFd, EPOLL_CTL_ADD, proc->pidfd, &event) == -1)
+        {
+            perror("smallsh: pidfd");
+            for (; i >= 0; i--)
+            {
+                if (job->procs[i].pidfd != -1)
+                {
+                    close(job->procs[i].pidfd);
+                }
+            }
+            free(job->procs);
+            job->procs = NULL;
+            return -1;
+        }
+    }
+
+    for (i = 0; i < numPids; i++)
+    {
+        proc = &job->procs[i];
+
+        index = hashIndex(proc->pid, jobs.numBuckets);
+        proc->hashNext = jobs.pidBuckets[index];
+        jobs.pidBuckets[index] = proc;
+    }
+    jobs.numProcs += numPids;
+    job->numProcs = numPids;
+    job->numLive = numPids;
+
+    return 0;
+}
+
+
+
+void holdJob(struct job *job, bool isHeld)
+{
+    struct epoll_event event;
+    int i;
+
+    for (i = 0; i < job->numProcs; i++)
+    {
+        if (job->procs[i].pidfd == -1)
+        {
+            continue;
+        }
+        event.events = EPOLLIN;
+        event.data.ptr = &job->procs[i];
+        epoll_ctl(jobs.epollFd, (isHeld == true) ? EPOLL_CTL_DEL : EPOLL_CTL_ADD,
+                  job->procs[i].pidfd, &event);
+    }
+}
+
+
+
+struct process *findProcess(pid_t pid)
+{
+    struct process *proc;
+
+    if (jobs.numBuckets == 0)
+    {
+        return NULL;
+    }
+
+    proc = jobs.pidBuckets[hashIndex(pid, jobs.numBuckets)];
+    while (proc != NULL && proc->pid != pid)
+    {
+        proc = proc->hashNext;
+    }
+
+    return proc;
+}
+
+
+
+struct job *findJob(int id)
+{
+    struct job *job;
+
+    if (jobs.numBuckets == 0)
+    {
+        return NULL;
+    }
+
+    job = jobs.idBuckets[hashIndex(id, jobs.numBuckets)];
+    while (job != NULL && job->id != id)
+    {
+        job = job->hashNext;
+    }
+
+    return job;
+}
+
+
+
+void removeJob(struct job *job)
+{
+    struct process **procLink;
+    struct job **jobLink;
+    int i;
+
+    // unlink each process from its PID bucket
+    for (i = 0; i < job->numProcs; i++)
+    {
+        if (job->procs[i].pidfd != -1)
+        {
+            close(job->procs[i].pidfd);
+        }
+
+        procLink = &jobs.pidBuckets[hashIndex(job->procs[i].pid, jobs.numBuckets)];
+        while (*procLink != NULL && *procLink != &job->procs[i])
+        {
+            procLink = &(*procLink)->hashNext;
+        }
+        if (*procLink != NULL)
+        {
+            *procLink = job->procs[i].hashNext;
+        }
+    }
+    jobs.numProcs -= job->numProcs;
+
+    // unlink the job from its job number bucket
+    jobLink = &jobs.idBuckets[hashIndex(job->id, jobs.numBuckets)];
+    while (*jobLink != NULL && *jobLink != job)
+    {
+        jobLink = &(*jobLink)->hashNext;
+    }
+    if (*jobLink != NULL)
+    {
+        *jobLink = job->hashNext;
+    }
+
+    // and from the list of jobs
+    if (job->prev != NULL)
+    {
+        job->prev->next = job->next;
+    }
+    else
+    {
+        jobs.head = job->next;
+    }
+    if (job->next != NULL)
+    {
+        job->next->prev = job->prev;
+    }
+    else
+    {
+        jobs.tail = job->prev;
+    }
+    jobs.numJobs--;
+
+    stopDeadline(&job->limit);
+
+    // a job that never started leaves the queue
+    if (job->pending != NULL)
+    {
+        unqueueJob(job);
+        free(job->pending);
+    }
+
+    free(job->procs);
+    free(job->command);
+    free(job);
+}
+
+
+
+void listJobs()
+{
+    struct job *job;
+    long long now = monotonicNs();
+    pid_t pid;
+    int i;
+
+    for (job = jobs.head; job != NULL; job = job->next)
+    {
+        // a queued job has no processes yet
+        if (job->pending != NULL)
+        {
+            printf("[%d] Queued %s &\n", job->id, job->command);
+            continue;
+        }
+
+        // show the last process that has not finished yet
+        pid = job->procs[job->numProcs - 1].pid;
+        for (i = job->numProcs - 1; i >= 0; i--)
+        {
+            if (job->procs[i].isDone == false)
+            {
+                pid = job->procs[i].pid;
+                break;
+            }
+        }
+
+        // a job with a time limit shows the time left, or that it is
+        // being stopped
+        if (job->isStopped == true)
+        {
+            printf("[%d] Stopped %d %s\n", job->id, pid, job->command);
+        }
+        else if (job->limit.step > 0)
+        {
+            printf("[%d] Terminating %d %s &\n", job->id, pid, job->command);
+        }
+        else if (job->limit.isQueued == true)
+        {
+            printf("[%d] Running %d %s & (timeout in %.1fs)\n", job->id, pid,
+                   job->command, (job->limit.whenNs - now) / 1e9);
+        }
+        else
+        {
+            printf("[%d] Running %d %s &\n", job->id, pid, job->command);
+        }
+    }
+}
+
+
+
+int parseTimeout(struct command *cmd, long long *timeoutNs, long long *graceNs)
+{
+    int i = 1;
+
+    *graceNs = KILL_GRACE * 1000000000LL;
+
+    if (i + 1 < cmd->argc && strcmp(cmd->argv[i], "-k") == 0)
+    {
+        if (parseDuration(cmd->argv[i + 1], graceNs) == -1)
+        {
+            i = cmd->argc;
+        }
+        i += 2;
+    }
+
+    if (i + 1 >= cmd->argc || parseDuration(cmd->argv[i], timeoutNs) == -1)
+    {
+        printf("smallsh: usage: timeout [-k grace] duration command\n");
+        fflush(stdout);
+        return -1;
+    }
+
+    return i + 1;
+}
+
+
+
+int parseDuration(const char *text, long long *ns)
+{
+    double seconds;
+    char *end;
+
+    errno = 0;
+    seconds = strtod(text, &end);
+    if (errno != 0 || end == text || seconds < 0)
+    {
+        return -1;
+    }
+
+    switch (*end)
+    {
+        case '\0':
+        case 's':
+            break;
+        case 'm':
+            seconds *= 60;
+            break;
+        case 'h':
+            seconds *= 60 * 60;
+            break;
+        case 'd':
+            seconds *= 24 * 60 * 60;
+            break;
+        default:
+            return -1;
+    }
+    if (*end != '\0' && end[1] != '\0')
+    {
+        return -1;
+    }
+
+    // a year is plenty, and keeps the sum with the clock from overflowing
+    if (seconds > 366 * 24 * 60 * 60)
+    {
+        seconds = 366 * 24 * 60 * 60;
+    }
+
+    *ns = (long long) (seconds * 1e9);
+    return 0;
+}
+
+
+
+void startDeadline(struct deadline *limit, long long timeoutNs, long long graceNs)
+{
+    struct deadline **newTimers;
+    size_t newSize;
+
+    limit->whenNs = monotonicNs() + timeoutNs;
+    limit->graceNs = graceNs;
+    limit->step = 0;
+    limit->isQueued = false;
+
+    if (jobs.numTimers == jobs.timersSize)
+    {
+        newSize = (jobs.timersSize == 0) ? MIN_BUCKETS : jobs.timersSize * 2;
+        newTimers = realloc(jobs.timers, newSize * sizeof(struct deadline *));
+        if (newTimers == NULL)
+        {
+            printf("smallsh: cannot set time limit\n");
+            fflush(stdout);
+            return;
+        }
+        jobs.timers = newTimers;
+        jobs.timersSize = newSize;
+    }
+
+    limit->heapIndex = jobs.numTimers++;
+    limit->isQueued = true;
+    jobs.timers[limit->heapIndex] = limit;
+    siftTimer(limit->heapIndex);
+
+    armTimer();
+}
+
+
+
+void stopDeadline(struct deadline *limit)
+{
+    size_t index;
+
+    if (limit->isQueued == false)
+    {
+        return;
+    }
+    limit->isQueued = false;
+
+    // the last limit takes the place of the one removed
+    index = limit->heapIndex;
+    jobs.numTimers--;
+    if (index < jobs.numTimers)
+    {
+        jobs.timers[index] = jobs.timers[jobs.numTimers];
+        jobs.timers[index]->heapIndex = index;
+        siftTimer(index);
+    }
+
+    armTimer();
+}
+
+
+
+void expireDeadlines()
+{
+    struct deadline *limit;
+    struct job *job;
+    unsigned long long expirations;
+    long long now;
+    int sig;
+    int i;
+
+    // empty the timerfd so it is not seen as ready again
+    read(jobs.timerFd, &expirations, sizeof(expirations));
+
+    now = monotonicNs();
+    while (jobs.numTimers > 0 && jobs.timers[0]->whenNs <= now)
+    {
+        limit = jobs.timers[0];
+        stopDeadline(limit);
+
+        // ask nicely first, then insist once the grace period is over
+        sig = (limit->step == 0) ? SIGTERM : SIGKILL;
+        limit->step++;
+
+        if (DEBUG)
+        {
+            printf("Time limit reached, sending signal %d\n", sig);
+        }
+
+        job = limit->job;
+        if (job != NULL)
+        {
+            // a stopped job has to run to see SIGTERM
+            signalJob(job, sig);
+            if (job->isStopped == true)
+            {
+                signalJob(job, SIGCONT);
+                job->isStopped = false;
+            }
+        }
+        else if (fgPgid > 0)
+        {
+            kill(-fgPgid, sig);
+        }
+        else
+        {
+            for (i = 0; i < numFgPids; i++)
+            {
+                pidfd_send_signal(fgPidfd[i], sig, NULL, 0);
+            }
+        }
+
+        if (sig == SIGTERM)
+        {
+            startDeadline(limit, limit->graceNs, limit->graceNs);
+            limit->step = 1;
+        }
+    }
+
+    armTimer();
+}
+
+
+
+void siftTimer(size_t index)
+{
+    struct deadline **timers = jobs.timers;
+    struct deadline *limit = timers[index];
+    size_t parent;
+    size_t child;
+
+    // move up past any later parents
+    while (index > 0)
+    {
+        parent = (index - 1) / 2;
+        if (timers[parent]->whenNs <= limit->whenNs)
+        {
+            break;
+        }
+        timers[index] = timers[parent];
+        timers[index]->heapIndex = index;
+        index = parent;
+    }
+
+    // then down past any earlier children
+    while ((child = 2 * index + 1) < jobs.numTimers)
+    {
+        if (child + 1 < jobs.numTimers && timers[child + 1]->whenNs < timers[child]->whenNs)
+        {
+            child++;
+        }
+        if (limit->whenNs <= timers[child]->whenNs)
+        {
+            break;
+        }
+        timers[index] = timers[child];
+        timers[index]->heapIndex = index;
+        index = child;
+    }
+
+    timers[index] = limit;
+    limit->heapIndex = index;
+}
+
+
+
+void armTimer()
+{
+    struct itimerspec when;
+
+    memset(&when, 0, sizeof(when));
+    if (jobs.numTimers > 0)
+    {
+        // an absolute time, so a late call never stretches a limit
+        when.it_value.tv_sec = jobs.timers[0]->whenNs / 1000000000LL;
+        when.it_value.tv_nsec = jobs.timers[0]->whenNs % 1000000000LL;
+        if (when.it_value.tv_sec == 0 && when.it_value.tv_nsec == 0)
+        {
+            when.it_value.tv_nsec = 1;
+        }
+    }
+
+    timerfd_settime(jobs.timerFd, TFD_TIMER_ABSTIME, &when, NULL);
+}
+
+
+
+void queueJob(struct pipeline *pl, long long timeoutNs, long long graceNs)
+{
+    struct command *cmd = &pl->stages[0];
+    struct job **newQueue;
+    struct job *job;
+    size_t newSize;
+
+    job = addJob(NULL, 0, pl);
+    if (job != NULL)
+    {
+        job->pending = copyPipeline(pl);
+    }
+    if (job == NULL || job->pending == NULL)
+    {
+        printf("smallsh: cannot track background job\n");
+        fflush(stdout);
+        if (job != NULL)
+        {
+            removeJob(job);
+        }
+        return;
+    }
+    job->timeoutNs = timeoutNs;
+    job->graceNs = graceNs;
+
+    // nice gives the job's place in the queue as well as its priority
+    // once it runs: nice alone means 10, as it does for the nice program
+    if (cmd->argc > 1 && strcmp(cmd->argv[0], "nice") == 0)
+    {
+        job->nice = 10;
+        if (strcmp(cmd->argv[1], "-n") == 0 && cmd->argc > 2)
+        {
+            job->nice = atoi(cmd->argv[2]);
+        }
+        else if (cmd->argv[1][0] == '-' && (isdigit(cmd->argv[1][1]) || cmd->argv[1][1] == '-'))
+        {
+            job->nice = atoi(cmd->argv[1] + 1);
+        }
+    }
+
+    if (jobs.numQueued == jobs.queueSize)
+    {
+        newSize = (jobs.queueSize == 0) ? MIN_BUCKETS : jobs.queueSize * 2;
+        newQueue = realloc(jobs.queue, newSize * sizeof(struct job *));
+        if (newQueue == NULL)
+        {
+            printf("smallsh: cannot track background job\n");
+            fflush(stdout);
+            free(job->pending);
+            job->pending = NULL;
+            removeJob(job);
+            return;
+        }
+        jobs.queue = newQueue;
+        jobs.queueSize = newSize;
+    }
+
+    job->queueIndex = jobs.numQueued++;
+    jobs.queue[job->queueIndex] = job;
+    siftQueue(job->queueIndex);
+
+    printf("background job %d is queued\n", job->id);
+    fflush(stdout);
+}
+
+
+
+void unqueueJob(struct job *job)
+{
+    size_t index = job->queueIndex;
+
+    // the last job takes the place of the one removed
+    jobs.numQueued--;
+    if (index < jobs.numQueued)
+    {
+        jobs.queue[index] = jobs.queue[jobs.numQueued];
+        jobs.queue[index]->queueIndex = index;
+        siftQueue(index);
+    }
+}
+
+
+
+bool isAhead(struct job *first, struct job *second)
+{
+    if (first->nice != second->nice)
+    {
+        return first->nice < second->nice;
+    }
+    return first->id < second->id;
+}
+
+
+
+void siftQueue(size_t index)
+{
+    struct job **queue = jobs.queue;
+    struct job *job = queue[index];
+    size_t parent;
+    size_t child;
+
+    // up while it is ahead of its parent
+    while (index > 0)
+    {
+        parent = (index - 1) / 2;
+        if (isAhead(job, queue[parent]) == false)
+        {
+            break;
+        }
+        queue[index] = queue[parent];
+        queue[index]->queueIndex = index;
+        index = parent;
+    }
+
+    // then down while a child is ahead of it
+    while ((child = 2 * index + 1) < jobs.numQueued)
+    {
+        if (child + 1 < jobs.numQueued && isAhead(queue[child + 1], queue[child]))
+        {
+            child++;
+        }
+        if (isAhead(queue[child], job) == false)
+        {
+            break;
+        }
+        queue[index] = queue[child];
+        queue[index]->queueIndex = index;
+        index = child;
+    }
+
+    queue[index] = job;
+    job->queueIndex = index;
+}
+
+
+
+void startQueuedJobs()
+{
+    int limit;
+
+    // every job in the table that is not queued counts as running
+    limit = jobLimit();
+    while (jobs.numQueued > 0 &&
+           (limit == 0 || jobs.numJobs - jobs.numQueued < (size_t) limit))
+    {
+        startJob(jobs.queue[0], true);
+    }
+}
+
+
+
+int startJob(struct job *job, bool isReported)
+{
+    struct pipeline *pl = job->pending;
+    pid_t pids[MAX_STAGES];
+    int cpus[MAX_STAGES];
+    int numStarted = 0;
+    pid_t pgid;
+    int i;
+
+    unqueueJob(job);
+    job->pending = NULL;
+
+    job->startNs = monotonicNs();
+    pgid = startPipeline(pl, pids, cpus, job->timeoutNs > 0);
+    for (i = 0; i < pl->numStages; i++)
+    {
+        if (pids[i] > 0)
+        {
+            cpus[numStarted] = cpus[i];
+            pids[numStarted++] = pids[i];
+        }
+    }
+    free(pl);
+
+    // a job that cannot be tracked is not left running
+    if (numStarted > 0 && watchProcesses(job, pids, numStarted) == -1)
+    {
+        printf("smallsh: cannot track background job\n");
+        kill(-pgid, SIGKILL);
+        for (i = 0; i < numStarted; i++)
+        {
+            waitpid(pids[i], NULL, 0);
+            releaseCpu(cpus[i]);
+        }
+        numStarted = 0;
+    }
+    if (numStarted == 0)
+    {
+        fflush(stdout);
+        removeJob(job);
+        return -1;
+    }
+
+    job->pgid = pgid;
+    for (i = 0; i < numStarted; i++)
+    {
+        job->procs[i].cpu = cpus[i];
+    }
+    if (job->timeoutNs > 0)
+    {
+        startDeadline(&job->limit, job->timeoutNs, job->graceNs);
+    }
+
+    if (isReported == true && cpus[numStarted - 1] >= 0)
+    {
+        printf("background pid is %d (cpu %d)\n", pids[numStarted - 1], cpus[numStarted - 1]);
+        fflush(stdout);
+    }
+    else if (isReported == true)
+    {
+        printf("background pid is %d\n", pids[numStarted - 1]);
+        fflush(stdout);
+    }
+
+    return 0;
+}
+
+
+
+int jobLimit()
+{
+    double load;
+    long numCpus;
+    long limit;
+
+    if (maxJobs >= 0)
+    {
+        return maxJobs;
+    }
+
+    // one job per CPU, less what the rest of the system is using
+    numCpus = sysconf(_SC_NPROCESSORS_ONLN);
+    limit = (numCpus > 0) ? numCpus : 1;
+    if (getloadavg(&load, 1) == 1)
+    {
+        load -= jobs.numJobs - jobs.numQueued;
+        if (load > 0)
+        {
+            limit -= (long) (load + 0.5);
+        }
+    }
+
+    return (limit > 1) ? limit : 1;
+}
+
+
+
+struct pipeline *copyPipeline(struct pipeline *pl)
+{
+    struct pipeline *copy;
+    struct command *stage;
+    struct command *stages;
+    size_t size;
+    char **args;
+    char *p;
+    int i;
+    int j;
+
+    // measure first so the copy is allocated once
+    size = sizeof(struct pipeline) + pl->numStages * sizeof(struct command);
+    for (i = 0; i < pl->numStages; i++)
+    {
+        stage = &pl->stages[i];
+        size += (stage->argc + 1) * sizeof(char *);
+        for (j = 0; j < stage->argc; j++)
+        {
+            size += strlen(stage->argv[j]) + 1;
+        }
+        size += (stage->inputFile != NULL) ? strlen(stage->inputFile) + 1 : 0;
+        size += (stage->inputText != NULL) ? strlen(stage->inputText) + 1 : 0;
+        size += (stage->outputFile != NULL) ? strlen(stage->outputFile) + 1 : 0;
+    }
+
+    copy = malloc(size);
+    if (copy == NULL)
+    {
+        return NULL;
+    }
+
+    // the pipeline, its stages, the argument arrays, then the strings
+    *copy = *pl;
+    stages = (struct command *) (copy + 1);
+    copy->stages = stages;
+    args = (char **) (stages + pl->numStages);
+    p = (char *) args;
+    for (i = 0; i < pl->numStages; i++)
+    {
+        p += (pl->stages[i].argc + 1) * sizeof(char *);
+    }
+
+    for (i = 0; i < pl->numStages; i++)
+    {
+        stage = &pl->stages[i];
+        stages[i] = *stage;
+        stages[i].argv = args;
+        for (j = 0; j < stage->argc; j++)
+        {
+            args[j] = strcpy(p, stage->argv[j]);
+            p += strlen(p) + 1;
+        }
+        args[j] = NULL;
+        args += stage->argc + 1;
+
+        if (stage->inputFile != NULL)
+        {
+            stages[i].inputFile = strcpy(p, stage->inputFile);
+            p += strlen(p) + 1;
+        }
+        if (stage->inputText != NULL)
+        {
+            stages[i].inputText = strcpy(p, stage->inputText);
+            p += strlen(p) + 1;
+        }
+        if (stage->outputFile != NULL)
+        {
+            stages[i].outputFile = strcpy(p, stage->outputFile);
+            p += strlen(p) + 1;
+        }
+    }
+
+    return copy;
+}
+
+
+
+int setJobLimit(const char *text)
+{
+    char *end;
+    long limit;
+
+    if (strcmp(text, "auto") == 0)
+    {
+        maxJobs = -1;
+        return 0;
+    }
+    if (strcmp(text, "off") == 0 || text[0] == '\0')
+    {
+        maxJobs = 0;
+        return 0;
+    }
+
+    limit = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || limit < 0 || limit > INT_MAX)
+    {
+        return -1;
+    }
+    maxJobs = limit;
+    return 0;
+}
+
+
+
+int maxjobsBuiltin(struct command *cmd)
+{
+    if (cmd->argc > 2 || (cmd->argc == 2 && setJobLimit(cmd->argv[1]) == -1))
+    {
+        printf("smallsh: usage: maxjobs [number | auto | off]\n");
+        fflush(stdout);
+        return 2;
+    }
+
+    // a higher limit may let queued jobs start
+    if (cmd->argc == 2)
+    {
+        startQueuedJobs();
+        return 0;
+    }
+
+    if (maxJobs == 0)
+    {
+        printf("no limit");
+    }
+    else
+    {
+        printf("limit %d%s", jobLimit(), (maxJobs == -1) ? " (auto)" : "");
+    }
+    printf(", %zu running, %zu queued\n", jobs.numJobs - jobs.numQueued, jobs.numQueued);
+    return 0;
+}
+
+
+
+pid_t waitProcess(pid_t pid, int *status, struct rusage *ru)
+{
+    struct sigaction childAct;
+    struct sigaction previousAct;
+    struct pollfd fds[1];
+    sigset_t blocked;
+    sigset_t previous;
+    sigset_t waitMask;
+    int options = (isJobControl == true) ? WUNTRACED : 0;
+    pid_t result;
+
+    // with no time limits pending and no jobs waiting to start, a plain
+    // wait will do
+    if (jobs.numTimers == 0 && jobs.numQueued == 0)
+    {
+        while ((result = wait4(pid, status, options, ru)) == -1 && errno == EINTR)
+        {
+        }
+        if (result == pid && !WIFSTOPPED(*status))
+        {
+            traceEvent(TRACE_REAP, pid, *status);
+        }
+        return result;
+    }
+
+    // otherwise sleep in ppoll on the timer, which lets SIGCHLD in only
+    // while it sleeps
+    sigemptyset(&blocked);
+    sigaddset(&blocked, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &blocked, &previous);
+
+    childAct.sa_handler = sigchldHandler;
+    childAct.sa_flags = SA_RESTART;
+    sigfillset(&(childAct.sa_mask));
+    sigaction(SIGCHLD, &childAct, &previousAct);
+
+    // queued jobs are started as background jobs finish, so then the
+    // whole epoll set is watched, which holds the timer too
+    fds[0].fd = (jobs.numQueued > 0) ? jobs.epollFd : jobs.timerFd;
+    fds[0].events = POLLIN;
+    waitMask = previous;
+    sigdelset(&waitMask, SIGCHLD);
+
+    while ((result = wait4(pid, status, options|WNOHANG, ru)) == 0)
+    {
+        if (ppoll(fds, 1, NULL, &waitMask) > 0)
+        {
+            if (fds[0].fd == jobs.epollFd)
+            {
+                reapChildren();
+                fds[0].fd = (jobs.numQueued > 0) ? jobs.epollFd : jobs.timerFd;
+            }
+            else
+            {
+                expireDeadlines();
+            }
+        }
+    }
+
+    sigaction(SIGCHLD, &previousAct, NULL);
+    sigprocmask(SIG_SETMASK, &previous, NULL);
+
+    if (result == pid && !WIFSTOPPED(*status))
+    {
+        traceEvent(TRACE_REAP, pid, *status);
+    }
+    return result;
+}
+
+
+
+void sigchldHandler()
+{
+    return;
+}
+
+
+
+size_t hashString(const char *text)
+{
+    size_t hash = 2166136261u;
+
+    while (*text != '\0')
+    {
+        hash ^= (unsigned char) *text++;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+
+
+const char *lookupCommand(const char *name, bool countHit)
+{
+    static char found[PATH_MAX];
+    struct pathEntry **link;
+    struct pathEntry *entry;
+    struct stat info;
+    const char *pathValue;
+    const char *dir;
+    const char *end;
+    size_t dirLength;
+    size_t index;
+
+    // a name with a slash is a path already
+    if (strchr(name, '/') != NULL)
+    {
+        return name;
+    }
+
+    // the same default search path execvp uses when PATH is unset
+    pathValue = getenv("PATH");
+    if (pathValue == NULL)
+    {
+        pathValue = "/bin:/usr/bin";
+    }
+
+    // entries found under another PATH no longer apply
+    if (pathCache.pathValue == NULL || strcmp(pathCache.pathValue, pathValue) != 0)
+    {
+        clearPathCache();
+        pathCache.pathValue = strdup(pathValue);
+    }
+
+    if (pathCache.numBuckets > 0)
+    {
+        entry = pathCache.buckets[hashString(name) & (pathCache.numBuckets - 1)];
+        while (entry != NULL && strcmp(entry->name, name) != 0)
+        {
+            entry = entry->next;
+        }
+
+        if (entry != NULL)
+        {
+            // a changed directory may have lost or replaced the program
+            if (stat(entry->dir, &info) == 0 &&
+                info.st_mtim.tv_sec == entry->dirTime.tv_sec &&
+                info.st_mtim.tv_nsec == entry->dirTime.tv_nsec)
+            {
+                if (countHit == true)
+                {
+                    entry->hits++;
+                }
+                return entry->path;
+            }
+
+            forgetCommand(name);
+        }
+    }
+
+    // search each directory in PATH; an empty entry means the current one
+    for (dir = pathValue; ; dir = end + 1)
+    {
+        end = strchr(dir, ':');
+        if (end == NULL)
+        {
+            end = dir + strlen(dir);
+        }
+
+        dirLength = end - dir;
+        if (dirLength == 0)
+        {
+            snprintf(found, sizeof(found), "./%s", name);
+        }
+        else
+        {
+            snprintf(found, sizeof(found), "%.*s/%s", (int) dirLength, dir, name);
+        }
+
+        if (stat(found, &info) == 0 && S_ISREG(info.st_mode) &&
+            access(found, X_OK) == 0)
+        {
+            break;
+        }
+
+        if (*end == '\0')
+        {
+            return NULL;
+        }
+    }
+
+    // relative directories depend on the working directory, so only
+    // programs found in absolute ones are remembered
+    if (dir[0] != '/')
+    {
+        return found;
+    }
+
+    // keep about one entry per bucket
+    if (pathCache.numEntries + 1 > pathCache.numBuckets)
+    {
+        size_t numBuckets = (pathCache.numBuckets == 0) ? MIN_BUCKETS : pathCache.numBuckets * 2;
+        struct pathEntry **buckets = calloc(numBuckets, sizeof(struct pathEntry *));
+        size_t i;
+
+        if (buckets == NULL)
+        {
+            return found;
+        }
+
+        for (i = 0; i < pathCache.numBuckets; i++)
+        {
+            while ((entry = pathCache.buckets[i]) != NULL)
+            {
+                pathCache.buckets[i] = entry->next;
+                index = hashString(entry->name) & (numBuckets - 1);
+                entry->next = buckets[index];
+                buckets[index] = entry;
+            }
+        }
+
+        free(pathCache.buckets);
+        pathCache.buckets = buckets;
+        pathCache.numBuckets = numBuckets;
+    }
+
+    entry = malloc(sizeof(struct pathEntry));
+    if (entry == NULL)
+    {
+        return found;
+    }
+    entry->name = strdup(name);
+    entry->path = strdup(found);
+    entry->dir = strndup(dir, dirLength);
+    if (entry->name == NULL || entry->path == NULL || entry->dir == NULL ||
+        stat(entry->dir, &info) == -1)
+    {
+        free(entry->name);
+        free(entry->path);
+        free(entry->dir);
+        free(entry);
+        return found;
+    }
+    entry->dirTime = info.st_mtim;
+    entry->hits = (countHit == true) ? 1 : 0;
+
+    link = &pathCache.buckets[hashString(name) & (pathCache.numBuckets - 1)];
+    entry->next = *link;
+    *link = entry;
+    pathCache.numEntries++;
+
+    return entry->path;
+}
+
+
+
+void forgetCommand(const char *name)
+{
+    struct pathEntry **link;
+    struct pathEntry *entry;
+
+    if (pathCache.numBuckets == 0)
+    {
+        return;
+    }
+
+    link = &pathCache.buckets[hashString(name) & (pathCache.numBuckets - 1)];
+    while (*link != NULL && strcmp((*link)->name, name) != 0)
+    {
+        link = &(*link)->next;
+    }
+
+    if (*link != NULL)
+    {
+        entry = *link;
+        *link = entry->next;
+        free(entry->name);
+        free(entry->path);
+        free(entry->dir);
+        free(entry);
+        pathCache.numEntries--;
+    }
+}
+
+
+
+void clearPathCache()
+{
+    struct pathEntry *entry;
+    size_t i;
+
+    for (i = 0; i < pathCache.numBuckets; i++)
+    {
+        while ((entry = pathCache.buckets[i]) != NULL)
+        {
+            pathCache.buckets[i] = entry->next;
+            free(entry->name);
+            free(entry->path);
+            free(entry->dir);
+            free(entry);
+        }
+    }
+
+    pathCache.numEntries = 0;
+    free(pathCache.pathValue);
+    pathCache.pathValue = NULL;
+}
+
+
+
+int hashBuiltin(struct command *cmd)
+{
+    struct pathEntry *entry;
+    int exitValue = 0;
+    size_t i;
+    int j;
+
+    if (cmd->argc == 1)
+    {
+        if (pathCache.numEntries == 0)
+        {
+            printf("hash: hash table empty\n");
+            return 0;
+        }
+
+        printf("hits\tcommand\n");
+        for (i = 0; i < pathCache.numBuckets; i++)
+        {
+            for (entry = pathCache.buckets[i]; entry != NULL; entry = entry->next)
+            {
+                printf("%4lu\t%s\n", entry->hits, entry->path);
+            }
+        }
+        return 0;
+    }
+
+    for (j = 1; j < cmd->argc; j++)
+    {
+        if (strcmp(cmd->argv[j], "-r") == 0)
+        {
+            clearPathCache();
+        }
+        else if (lookupCommand(cmd->argv[j], false) == NULL)
+        {
+            printf("smallsh: hash: %s: not found\n", cmd->argv[j]);
+            exitValue = 1;
+        }
+    }
+
+    return exitValue;
+}
+
+
+
+long long monotonicNs()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+
+
+void addUsage(struct usage *total, const struct rusage *ru)
+{
+    timeradd(&total->userTime, &ru->ru_utime, &total->userTime);
+    timeradd(&total->systemTime, &ru->ru_stime, &total->systemTime);
+    if (ru->ru_maxrss > total->maxRss)
+    {
+        total->maxRss = ru->ru_maxrss;
+    }
+    total->volSwitches += ru->ru_nvcsw;
+    total->involSwitches += ru->ru_nivcsw;
+    total->numProcs++;
+}
+
+
+
+void recordUsage(int id, pid_t pid, char *command, const struct usage *use)
+{
+    struct usageRecord *record;
+
+    record = &usageHistory.records[usageHistory.numRecords % USAGE_HISTORY];
+    free(record->command);
+    record->id = id;
+    record->pid = pid;
+    record->command = command;
+    record->use = *use;
+    usageHistory.numRecords++;
+
+    // the totals add wall times too, so they show time spent in jobs
+    timeradd(&usageHistory.total.userTime, &use->userTime, &usageHistory.total.userTime);
+    timeradd(&usageHistory.total.systemTime, &use->systemTime, &usageHistory.total.systemTime);
+    if (use->maxRss > usageHistory.total.maxRss)
+    {
+        usageHistory.total.maxRss = use->maxRss;
+    }
+    usageHistory.total.volSwitches += use->volSwitches;
+    usageHistory.total.involSwitches += use->involSwitches;
+    usageHistory.total.wallNs += use->wallNs;
+    usageHistory.total.numProcs += use->numProcs;
+}
+
+
+
+void printUsage(const struct usage *use)
+{
+    printf("user %ld.%03lds sys %ld.%03lds wall %lld.%03llds maxrss %ldkB switches %ld/%ld\n",
+           (long) use->userTime.tv_sec, (long) use->userTime.tv_usec / 1000,
+           (long) use->systemTime.tv_sec, (long) use->systemTime.tv_usec / 1000,
+           use->wallNs / 1000000000, (use->wallNs / 1000000) % 1000,
+           use->maxRss, use->volSwitches, use->involSwitches);
+}
+
+
+
+void timesBuiltin()
+{
+    struct usageRecord *record;
+    struct rusage self;
+    long first;
+    long i;
+
+    getrusage(RUSAGE_SELF, &self);
+    printf("shell: user %ld.%03lds sys %ld.%03lds\n",
+           (long) self.ru_utime.tv_sec, (long) self.ru_utime.tv_usec / 1000,
+           (long) self.ru_stime.tv_sec, (long) self.ru_stime.tv_usec / 1000);
+
+    // oldest kept job first
+    first = (usageHistory.numRecords > USAGE_HISTORY) ? usageHistory.numRecords - USAGE_HISTORY : 0;
+    for (i = first; i < usageHistory.numRecords; i++)
+    {
+        record = &usageHistory.records[i % USAGE_HISTORY];
+        if (record->id > 0)
+        {
+            printf("[%d] ", record->id);
+        }
+        else
+        {
+            printf("fg ");
+        }
+        printf("%d %s: ", record->pid, (record->command != NULL) ? record->command : "");
+        printUsage(&record->use);
+    }
+
+    printf("all %ld jobs, %d processes: ", usageHistory.numRecords, usageHistory.total.numProcs);
+    printUsage(&usageHistory.total);
+}
+
+
+
+int startTrace()
+{
+    void *events;
+
+    if (traceLog.events == NULL)
+    {
+        events = mmap(NULL, TRACE_EVENTS * sizeof(struct traceEvent), PROT_READ|PROT_WRITE,
+                      MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+        if (events == MAP_FAILED)
+        {
+            perror("smallsh: trace");
+            return -1;
+        }
+        traceLog.events = events;
+    }
+
+    traceLog.isOn = true;
+    return 0;
+}
+
+
+
+void traceEvent(int type, pid_t pid, long long value)
+{
+    struct traceEvent *event;
+
+    if (traceLog.isOn == false)
+    {
+        return;
+    }
+
+    event = &traceLog.events[traceLog.numEvents++ % TRACE_EVENTS];
+    event->timeNs = monotonicNs();
+    event->value = value;
+    event->type = type;
+    event->pid = pid;
+}
+
+
+
+long long traceStart()
+{
+    return (traceLog.isOn == true) ? monotonicNs() : 0;
+}
+
+
+
+int traceBuiltin(struct command *cmd)
+{
+    FILE *out = stdout;
+
+    if (cmd->argc == 1)
+    {
+        printf("tracing is %s, %ld events\n", (traceLog.isOn == true) ? "on" : "off",
+               (traceLog.numEvents > TRACE_EVENTS) ? (long) TRACE_EVENTS : traceLog.numEvents);
+        return 0;
+    }
+
+    if (cmd->argc == 2 && strcmp(cmd->argv[1], "on") == 0)
+    {
+        return (startTrace() == 0) ? 0 : 1;
+    }
+    if (cmd->argc == 2 && strcmp(cmd->argv[1], "off") == 0)
+    {
+        traceLog.isOn = false;
+        return 0;
+    }
+    if (cmd->argc == 2 && strcmp(cmd->argv[1], "clear") == 0)
+    {
+        traceLog.numEvents = 0;
+        return 0;
+    }
+    if (cmd->argc <= 3 && strcmp(cmd->argv[1], "dump") == 0)
+    {
+        if (cmd->argc == 3)
+        {
+            out = fopen(cmd->argv[2], "we");
+            if (out == NULL)
+            {
+                printf("smallsh: cannot open %s for output\n", cmd->argv[2]);
+                return 1;
+            }
+        }
+
+        dumpTrace(out);
+
+        if (out != stdout && fclose(out) == EOF)
+        {
+            perror("smallsh: trace");
+            return 1;
+        }
+        return 0;
+    }
+
+    printf("smallsh: usage: trace [on | off | clear | dump [file]]\n");
+    return 2;
+}
+
+
+
+void dumpTrace(FILE *out)
+{
+    struct traceEvent *event;
+    pid_t tracePid = getpid();
+    long first;
+    long i;
+
+    // oldest kept event first
+    first = (traceLog.numEvents > TRACE_EVENTS) ? traceLog.numEvents - TRACE_EVENTS : 0;
+
+    // times are in microseconds; the shell is one line and each child
+    // another, named by its pid
+    fprintf(out, "{\"traceEvents\":[\n");
+    for (i = first; i < traceLog.numEvents; i++)
+    {
+        event = &traceLog.events[i % TRACE_EVENTS];
+        switch (event->type)
+        {
+            case TRACE_READ:
+                fprintf(out, "{\"name\":\"line read\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,"
+                        "\"pid\":%d,\"tid\":%d,\"args\":{\"line\":%lld}},\n",
+                        event->timeNs / 1e3, tracePid, tracePid, event->value);
+                break;
+
+            case TRACE_PARSE:
+                fprintf(out, "{\"name\":\"parse done\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,"
+                        "\"pid\":%d,\"tid\":%d,\"args\":{\"lines\":%lld}},\n",
+                        event->timeNs / 1e3, tracePid, tracePid, event->value);
+                break;
+
+            case TRACE_SPAWN:
+            case TRACE_FORK:
+                fprintf(out, "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                        "\"pid\":%d,\"tid\":%d,\"args\":{\"child\":%d}},\n",
+                        (event->type == TRACE_SPAWN) ? "spawn" : "fork",
+                        event->value / 1e3, (event->timeNs - event->value) / 1e3,
+                        tracePid, tracePid, (int) event->pid);
+
+                // a forked copy stage runs the shell's own code from here
+                if (event->type == TRACE_FORK)
+                {
+                    fprintf(out, "{\"name\":\"copy\",\"ph\":\"B\",\"ts\":%.3f,"
+                            "\"pid\":%d,\"tid\":%d},\n",
+                            event->timeNs / 1e3, tracePid, (int) event->pid);
+                }
+                break;
+
+            case TRACE_EXEC:
+                fprintf(out, "{\"name\":\"exec\",\"ph\":\"B\",\"ts\":%.3f,"
+                        "\"pid\":%d,\"tid\":%d},\n",
+                        event->timeNs / 1e3, tracePid, (int) event->pid);
+                break;
+
+            case TRACE_CHILD:
+                fprintf(out, "{\"name\":\"SIGCHLD\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,"
+                        "\"pid\":%d,\"tid\":%d},\n",
+                        event->timeNs / 1e3, tracePid, (int) event->pid);
+                break;
+
+            case TRACE_REAP:
+                fprintf(out, "{\"name\":\"reap\",\"ph\":\"E\",\"ts\":%.3f,"
+                        "\"pid\":%d,\"tid\":%d,\"args\":{\"status\":%lld}},\n",
+                        event->timeNs / 1e3, tracePid, (int) event->pid, event->value);
+                break;
+        }
+    }
+
+    // name the shell's own line; this also saves a trailing comma
+    fprintf(out, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+            "\"args\":{\"name\":\"smallsh\"}}\n],\"displayTimeUnit\":\"ns\"}\n",
+            tracePid, tracePid);
+    fflush(out);
+}
+
+
+
+void closeReader(struct lineReader *reader)
+{
+    if (reader->isMapped == true)
+    {
+        munmap(reader->buffer, reader->size);
+    }
+    else
+    {
+        free(reader->buffer);
+    }
+    free(reader->line);
+    reader->buffer = NULL;
+    reader->line = NULL;
+    reader->lineSize = 0;
+}
+
+
+
+int parallelBuiltin(struct command *cmd)
+{
+    struct epoll_event events[MAX_EVENTS];
+    struct epoll_event event;
+    struct lineReader reader;
+    struct parallelTask *tasks;
+    struct parallelTask *task;
+    struct rusage taskUsage;
+    sigset_t intMask;
+    bool keepOrder = false;
+    bool inputDone = false;
+    char **args;
+    char *item;
+    long numSlots;
+    long window;
+    long nextItem = 0;
+    long nextFlush = 0;
+    long numFailed = 0;
+    int numRunning = 0;
+    int numEvents;
+    int epollFd;
+    int inFd = 0;
+    int nullFd;
+    int outFd = -1;
+    int first;
+    int slot;
+    int i;
+
+    // by default run one command per online CPU
+    numSlots = sysconf(_SC_NPROCESSORS_ONLN);
+
+    for (first = 1; first < cmd->argc && cmd->argv[first][0] == '-'; first++)
+    {
+        if (strcmp(cmd->argv[first], "-k") == 0)
+        {
+            keepOrder = true;
+        }
+        else if (strcmp(cmd->argv[first], "-j") == 0 && first + 1 < cmd->argc)
+        {
+            numSlots = atol(cmd->argv[++first]);
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    if (first == cmd->argc || numSlots < 1)
+    {
+        printf("usage: parallel [-j N] [-k] command [args] < inputs\n");
+        return W_EXITCODE(2, 0);
+    }
+
+    // the running commands share the slots of the foreground pipeline
+    if (numSlots > MAX_STAGES)
+    {
+        numSlots = MAX_STAGES;
+    }
+
+    // items come from the < file, or from stdin if commands do not
+    if (cmd->inputFile != NULL)
+    {
+        inFd = openRedirection(cmd->inputFile, false);
+        if (inFd == -1)
+        {
+            return W_EXITCODE(1, 0);
+        }
+    }
+    else if (inputReader.fd == 0)
+    {
+        printf("parallel: no input file\n");
+        return W_EXITCODE(2, 0);
+    }
+
+    if (cmd->outputFile != NULL)
+    {
+        outFd = openRedirection(cmd->outputFile, true);
+        if (outFd == -1)
+        {
+            if (inFd != 0)
+            {
+                close(inFd);
+            }
+            return W_EXITCODE(1, 0);
+        }
+    }
+
+    // finished outputs wait for earlier items in a window of tasks
+    window = numSlots * 16;
+    tasks = calloc(window, sizeof(struct parallelTask));
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    nullFd = openRedirection("/dev/null", false);
+    if (tasks == NULL || epollFd == -1 || nullFd == -1 ||
+        openReader(&reader, inFd, NULL) == -1)
+    {
+        perror("smallsh: parallel");
+        free(tasks);
+        if (epollFd != -1)
+        {
+            close(epollFd);
+        }
+        if (nullFd != -1)
+        {
+            close(nullFd);
+        }
+        if (inFd != 0)
+        {
+            close(inFd);
+        }
+        if (outFd != -1)
+        {
+            close(outFd);
+        }
+        return W_EXITCODE(1, 0);
+    }
+
+    // a mapped input file needs no descriptor
+    if (reader.isMapped == true && inFd != 0)
+    {
+        close(inFd);
+        inFd = 0;
+    }
+
+    // the slots are empty until a command starts in them
+    sigemptyset(&intMask);
+    sigaddset(&intMask, SIGINT);
+    for (slot = 0; slot < numSlots; slot++)
+    {
+        fgpid[slot] = 0;
+        fgPidfd[slot] = -1;
+    }
+    numFgPids = numSlots;
+
+    memset(&fgUsage, 0, sizeof(fgUsage));
+    fflush(stdout);
+
+    while (true)
+    {
+        // start items while a slot is free and the window has room
+        while (inputDone == false && signalNum == 0 && numRunning < numSlots &&
+               nextItem - nextFlush < window)
+        {
+            item = readLine(&reader, NULL);
+            if (item == NULL)
+            {
+                inputDone = true;
+                break;
+            }
+            if (item[0] == '\0')
+            {
+                continue;
+            }
+
+            task = &tasks[nextItem % window];
+            task->pid = -1;
+            task->pidfd = -1;
+            task->outFd = -1;
+            task->status = W_EXITCODE(1, 0);
+            task->isDone = true;
+
+            if (keepOrder == true)
+            {
+                task->outFd = memfd_create("parallel", MFD_CLOEXEC);
+            }
+
+            args = expandTemplate(cmd->argv + first, cmd->argc - first, item);
+            if (args != NULL && (keepOrder == false || task->outFd != -1))
+            {
+                task->pid = spawnProcess(args, nullFd, (keepOrder == true) ? task->outFd : outFd, -1, false);
+            }
+            freeArgs(args);
+
+            if (task->pid > 0)
+            {
+                task->pidfd = pidfd_open(task->pid, 0);
+                event.events = EPOLLIN;
+                event.data.u64 = nextItem;
+                if (task->pidfd == -1 ||
+                    epoll_ctl(epollFd, EPOLL_CTL_ADD, task->pidfd, &event) == -1)
+                {
+                    // cannot watch it, so wait for it here
+                    perror("smallsh: pidfd");
+                    if (wait4(task->pid, &task->status, 0, &taskUsage) == task->pid)
+                    {
+                        traceEvent(TRACE_REAP, task->pid, task->status);
+                        addUsage(&fgUsage, &taskUsage);
+                    }
+                    if (task->pidfd != -1)
+                    {
+                        close(task->pidfd);
+                        task->pidfd = -1;
+                    }
+                }
+                else
+                {
+                    // take a free slot so an interrupt reaches the command
+                    for (slot = 0; fgPidfd[slot] != -1; slot++)
+                    {
+                        ;
+                    }
+                    task->slot = slot;
+                    fgpid[slot] = task->pid;
+                    fgPidfd[slot] = task->pidfd;
+                    task->isDone = false;
+                    numRunning++;
+                }
+            }
+
+            nextItem++;
+        }
+
+        // copy out and count the finished items, in order
+        while (nextFlush < nextItem && tasks[nextFlush % window].isDone == true)
+        {
+            task = &tasks[nextFlush % window];
+            if (task->outFd != -1)
+            {
+                lseek(task->outFd, 0, SEEK_SET);
+                copyFd(task->outFd, (outFd == -1) ? 1 : outFd);
+                close(task->outFd);
+            }
+            if (!WIFEXITED(task->status) || WEXITSTATUS(task->status) != 0)
+            {
+                numFailed++;
+            }
+            nextFlush++;
+        }
+
+        if (numRunning == 0)
+        {
+            if (inputDone == true || signalNum != 0)
+            {
+                break;
+            }
+            continue;
+        }
+
+        // reap whichever commands have finished
+        numEvents = epoll_wait(epollFd, events, MAX_EVENTS, -1);
+        for (i = 0; i < numEvents; i++)
+        {
+            task = &tasks[events[i].data.u64 % window];
+            traceEvent(TRACE_CHILD, task->pid, 0);
+            if (wait4(task->pid, &task->status, WNOHANG, &taskUsage) != task->pid)
+            {
+                continue;
+            }
+            traceEvent(TRACE_REAP, task->pid, task->status);
+            addUsage(&fgUsage, &taskUsage);
+
+            // free the slot with interrupts held off so the handler never
+            // signals a closed pidfd
+            sigprocmask(SIG_BLOCK, &intMask, NULL);
+            fgPidfd[task->slot] = -1;
+            fgpid[task->slot] = 0;
+            sigprocmask(SIG_UNBLOCK, &intMask, NULL);
+
+            close(task->pidfd);
+            task->pidfd = -1;
+            task->isDone = true;
+            numRunning--;
+        }
+    }
+
+    numFgPids = 0;
+
+    closeReader(&reader);
+    free(tasks);
+    close(epollFd);
+    close(nullFd);
+    if (inFd != 0)
+    {
+        close(inFd);
+    }
+    if (outFd != -1)
+    {
+        close(outFd);
+    }
+
+    if (signalNum != 0)
+    {
+        return W_EXITCODE(0, SIGINT);
+    }
+    return W_EXITCODE((numFailed > 100) ? 101 : numFailed, 0);
+}
+
+
+
+char **expandTemplate(char **words, int numWords, const char *item)
+{
+    bool sawBraces = false;
+    size_t itemLength = strlen(item);
+    size_t length;
+    char **args;
+    char *from;
+    char *to;
+    char *mark;
+    int i;
+
+    args = calloc(numWords + 2, sizeof(char *));
+    if (args == NULL)
+    {
+        return NULL;
+    }
+
+    for (i = 0; i < numWords; i++)
+    {
+        // count the {} marks to size the word
+        length = strlen(words[i]);
+        for (mark = strstr(words[i], "{}"); mark != NULL; mark = strstr(mark + 2, "{}"))
+        {
+            length += itemLength - 2;
+            sawBraces = true;
+        }
+
+        args[i] = malloc(length + 1);
+        if (args[i] == NULL)
+        {
+            freeArgs(args);
+            return NULL;
+        }
+
+        from = words[i];
+        to = args[i];
+        while ((mark = strstr(from, "{}")) != NULL)
+        {
+            memcpy(to, from, mark - from);
+            to += mark - from;
+            memcpy(to, item, itemLength);
+            to += itemLength;
+            from = mark + 2;
+        }
+        strcpy(to, from);
+    }
+
+    // with no {} the item is the last argument
+    if (sawBraces == false)
+    {
+        args[numWords] = strdup(item);
+        if (args[numWords] == NULL)
+        {
+            freeArgs(args);
+            return NULL;
+        }
+    }
+
+    return args;
+}
+
+
+
+void freeArgs(char **args)
+{
+    int i;
+
+    if (args == NULL)
+    {
+        return;
+    }
+
+    for (i = 0; args[i] != NULL; i++)
+    {
+        free(args[i]);
+    }
+    free(args);
+}
+
+
+
+bool isSimpleCommand(struct command *cmd)
+{
+    struct stat info;
+    const char *name;
+    int i;
+
+    if (cmd->argc == 0)
+    {
+        return false;
+    }
+    name = cmd->argv[0];
+
+    if (strcmp(name, "echo") == 0)
+    {
+        // -e and -E change how the rest is printed, so leave them to echo
+        return cmd->argc == 1 || cmd->argv[1][0] != '-' ||
+               strcmp(cmd->argv[1], "-n") == 0;
+    }
+
+    if (strcmp(name, "pwd") == 0 || strcmp(name, "true") == 0 ||
+        strcmp(name, "false") == 0)
+    {
+        return cmd->argc == 1;
+    }
+
+    if (strcmp(name, "test") == 0)
+    {
+        return cmd->argc == 3 && cmd->argv[1][0] == '-' &&
+               cmd->argv[1][1] != '\0' && strchr("efdsrwx", cmd->argv[1][1]) != NULL &&
+               cmd->argv[1][2] == '\0';
+    }
+
+    if (strcmp(name, "cat") == 0)
+    {
+        // reading a terminal or pipe could block the shell where an
+        // interrupt cannot reach it, so only files that exist as regular
+        // files (or not at all) are copied here
+        if (cmd->argc == 1)
+        {
+            return cmd->inputText != NULL || (cmd->inputFile != NULL &&
+                   (stat(cmd->inputFile, &info) == -1 || S_ISREG(info.st_mode)));
+        }
+
+        for (i = 1; i < cmd->argc; i++)
+        {
+            if (cmd->argv[i][0] == '-' ||
+                (stat(cmd->argv[i], &info) == 0 && !S_ISREG(info.st_mode)))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    return false;
+}
+
+
+
+int runSimpleCommand(struct command *cmd)
+{
+    struct stat info;
+    char buffer[PATH_MAX + 1];
+    const char *name = cmd->argv[0];
+    size_t length;
+    char *text;
+    char *p;
+    int exitValue = 0;
+    int first;
+    int inFd = -1;
+    int outFd = 1;
+    int fd;
+    int i;
+
+    // open the redirections as a spawned command would get them
+    if (cmd->inputText != NULL || cmd->inputFile != NULL)
+    {
+        inFd = (cmd->inputText != NULL) ? openInputText(cmd->inputText) :
+                                          openRedirection(cmd->inputFile, false);
+        if (inFd == -1)
+        {
+            return W_EXITCODE(1, 0);
+        }
+    }
+    if (cmd->outputFile != NULL)
+    {
+        outFd = openRedirection(cmd->outputFile, true);
+        if (outFd == -1)
+        {
+            if (inFd != -1)
+            {
+                close(inFd);
+            }
+            return W_EXITCODE(1, 0);
+        }
+    }
+
+    if (strcmp(name, "echo") == 0)
+    {
+        // gather the words so they go out in one write
+        first = (cmd->argc > 1 && strcmp(cmd->argv[1], "-n") == 0) ? 2 : 1;
+        length = 0;
+        for (i = first; i < cmd->argc; i++)
+        {
+            length += strlen(cmd->argv[i]) + 1;
+        }
+
+        text = malloc(length + 1);
+        if (text == NULL)
+        {
+            perror("echo");
+            exitValue = 1;
+        }
+        else
+        {
+            p = text;
+            for (i = first; i < cmd->argc; i++)
+            {
+                if (i > first)
+                {
+                    *p++ = ' ';
+                }
+                p = stpcpy(p, cmd->argv[i]);
+            }
+            if (first == 1)
+            {
+                *p++ = '\n';
+            }
+
+            exitValue = writeOutput(outFd, text, p - text);
+            free(text);
+        }
+    }
+    else if (strcmp(name, "pwd") == 0)
+    {
+        if (getcwd(buffer, sizeof(buffer) - 1) == NULL)
+        {
+            perror("pwd");
+            exitValue = 1;
+        }
+        else
+        {
+            length = strlen(buffer);
+            buffer[length++] = '\n';
+            exitValue = writeOutput(outFd, buffer, length);
+        }
+    }
+    else if (strcmp(name, "false") == 0)
+    {
+        exitValue = 1;
+    }
+    else if (strcmp(name, "test") == 0)
+    {
+        switch (cmd->argv[1][1])
+        {
+        case 'e':
+            exitValue = (stat(cmd->argv[2], &info) == 0) ? 0 : 1;
+            break;
+        case 'f':
+            exitValue = (stat(cmd->argv[2], &info) == 0 && S_ISREG(info.st_mode)) ? 0 : 1;
+            break;
+        case 'd':
+            exitValue = (stat(cmd->argv[2], &info) == 0 && S_ISDIR(info.st_mode)) ? 0 : 1;
+            break;
+        case 's':
+            exitValue = (stat(cmd->argv[2], &info) == 0 && info.st_size > 0) ? 0 : 1;
+            break;
+        case 'r':
+            exitValue = (faccessat(AT_FDCWD, cmd->argv[2], R_OK, AT_EACCESS) == 0) ? 0 : 1;
+            break;
+        case 'w':
+            exitValue = (faccessat(AT_FDCWD, cmd->argv[2], W_OK, AT_EACCESS) == 0) ? 0 : 1;
+            break;
+        case 'x':
+            exitValue = (faccessat(AT_FDCWD, cmd->argv[2], X_OK, AT_EACCESS) == 0) ? 0 : 1;
+            break;
+        }
+    }
+    else if (strcmp(name, "cat") == 0)
+    {
+        // cat copies straight to the descriptor, so the shell's own
+        // pending output has to go ahead of it
+        fflush(stdout);
+
+        if (cmd->argc == 1)
+        {
+            exitValue = copyFile(inFd, outFd);
+        }
+
+        for (i = 1; i < cmd->argc; i++)
+        {
+            fd = open(cmd->argv[i], O_RDONLY|O_CLOEXEC);
+            if (fd == -1)
+            {
+                fprintf(stderr, "cat: %s: %s\n", cmd->argv[i], strerror(errno));
+                exitValue = 1;
+                continue;
+            }
+
+            if (copyFile(fd, outFd) != 0)
+            {
+                exitValue = 1;
+            }
+            close(fd);
+        }
+    }
+
+    if (inFd != -1)
+    {
+        close(inFd);
+    }
+    if (outFd != 1)
+    {
+        close(outFd);
+    }
+
+    return W_EXITCODE(exitValue, 0);
+}
+
+
+
+int copyFile(int inFd, int outFd)
+{
+    ssize_t numCopied;
+
+    // file to file, possibly by sharing blocks
+    while ((numCopied = copy_file_range(inFd, NULL, outFd, NULL, COPY_CHUNK * 16, 0)) > 0)
+    {
+        // keep going until end of file
+    }
+    if (numCopied == 0)
+    {
+        return 0;
+    }
+
+    // file to a pipe, socket or terminal
+    if (errno == EXDEV || errno == EINVAL || errno == EBADF || errno == EOPNOTSUPP)
+    {
+        while ((numCopied = sendfile(outFd, inFd, NULL, COPY_CHUNK * 16)) > 0)
+        {
+            // keep going until end of file
+        }
+        if (numCopied == 0)
+        {
+            return 0;
+        }
+    }
+
+    if (errno != EINVAL && errno != ENOSYS)
+    {
+        return 1;
+    }
+
+    return copyFd(inFd, outFd);
+}
+
+
+
+int writeOutput(int fd, const char *data, size_t length)
+{
+    if (fd != 1)
+    {
+        return writeAll(fd, data, length);
+    }
+
+    return (fwrite(data, 1, length, stdout) == length) ? 0 : 1;
+}
+
+
+
+int writeAll(int fd, const char *data, size_t length)
+{
+    ssize_t numWritten;
+    size_t done;
+
+    for (done = 0; done < length; done += numWritten)
+    {
+        numWritten = write(fd, data + done, length - done);
+        if (numWritten == -1)
+        {
+            if (errno == EINTR)
+            {
+                numWritten = 0;
+                continue;
+            }
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+
+void startLauncher()
+{
+    int fds[2];
+    pid_t pid;
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC, 0, fds) == -1)
+    {
+        perror("smallsh: launcher");
+        return;
+    }
+
+    fflush(stdout);
+    pid = fork();
+    if (pid == 0)
+    {
+        close(fds[0]);
+        runLauncher(fds[1]);
+        _exit(0);
+    }
+
+    close(fds[1]);
+    if (pid == -1)
+    {
+        perror("smallsh: launcher");
+        close(fds[0]);
+        return;
+    }
+
+    launcherFd = fds[0];
+}
+
 
-    // initialize arrays for bg processes
-    for (i = 0; i < MAX_PIDS; i++)
+
+void runLauncher(int fd)
+{
+    union
     {
-        completed_pid[i] = bgpid[i] = INT_MAX;
-    }   
+        struct cmsghdr align;
+        char space[CMSG_SPACE(2 * sizeof(int))];
+    } control;
+    char currentDir[PATH_MAX] = "";
+    struct clone_args cloneArgs;
+    struct launchRequest *request;
+    struct launchReply reply;
+    struct msghdr msg;
+    struct iovec iov;
+    sigset_t emptyMask;
+    char *message;
+    char **args;
+    char *path;
+    char *dir;
+    char *p;
+    ssize_t length;
+    pid_t pid;
+    int errorPipe[2];
+    int fds[2];
+    int numFds;
+    int inFd;
+    int outFd;
+    int i;
+
+    // started programs ignore interrupts just like the shell's own
+    signal(SIGINT, SIG_IGN);
+    sigemptyset(&emptyMask);
 
-    // allocate memory for arg array
-    for (i = 0; i <= MAX_ARGS; i++)
+    message = malloc(LAUNCH_MESSAGE);
+    args = malloc((LAUNCH_MESSAGE / 2 + 1) * sizeof(char *));
+    if (message == NULL || args == NULL)
     {
-        args[i] = (char *) malloc((MAX_LENGTH + 1) * sizeof(char)); 
-    }  
+        return;
+    }
 
-    do
+    while (true)
     {
-        // create array of pointers to the strings in the arg array
-        char **next = args;
+        iov.iov_base = message;
+        iov.iov_len = LAUNCH_MESSAGE;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.space;
+        msg.msg_controllen = sizeof(control.space);
 
-        // (re)initialize the argument array
-        for (i = 0; i <= MAX_ARGS; i++)
+        length = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+        if (length == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (length <= 0)
         {
-            strcpy(args[i], "\n");
+            // the shell has exited
+            return;
         }
 
-        // clear input buffer each iteration
-        strcpy(input, "\0");
- 
-        i = 0;
+        // take the attached descriptors in the order they were sent; a
+        // request with more than stdin and stdout is refused
+        numFds = receiveFds(&msg, fds, 2);
+        if (numFds == -1)
+        {
+            reply.pid = -1;
+            reply.error = EBADMSG;
+            send(fd, &reply, sizeof(reply), 0);
+            continue;
+        }
 
-        // this loop cleans up zombies, waiting for all ps in completed array
-        while (i < MAX_PIDS && completed_pid[i] != INT_MAX)
+        request = (struct launchRequest *) message;
+        inFd = (request->hasInput && numFds > 0) ? fds[0] : -1;
+        outFd = (request->hasOutput && numFds > request->hasInput) ? fds[request->hasInput] : -1;
+
+        // the strings follow the header: path, directory, then arguments
+        message[length - 1] = '\0';
+        path = message + sizeof(struct launchRequest);
+        dir = path + strlen(path) + 1;
+        p = dir + strlen(dir) + 1;
+        for (i = 0; i < request->numArgs; i++)
+        {
+            args[i] = p;
+            p += strlen(p) + 1;
+        }
+        args[i] = NULL;
+
+        // follow the shell's cd commands
+        if (strcmp(dir, currentDir) != 0 && chdir(dir) == 0)
+        {
+            strcpy(currentDir, dir);
+        }
+
+        reply.pid = -1;
+        reply.error = 0;
+
+        if (pipe2(errorPipe, O_CLOEXEC) == -1)
         {
-            if (DEBUG) 
+            reply.error = errno;
+        }
+        else
+        {
+            // the new process is the shell's child, so its exit goes to the
+            // shell's pidfds and wait4 calls
+            memset(&cloneArgs, 0, sizeof(cloneArgs));
+            cloneArgs.flags = CLONE_PARENT;
+            pid = syscall(SYS_clone3, &cloneArgs, sizeof(cloneArgs));
+
+            if (pid == 0) // child process
             {
-                printf("Now cleaning up process %d\n", completed_pid[i]);
-            }
+                if (inFd != -1)
+                {
+                    dup2(inFd, 0);
+                }
+                if (outFd != -1)
+                {
+                    dup2(outFd, 1);
+                }
+                if (request->pgid != -1)
+                {
+                    setpgid(0, request->pgid);
+                }
+                signal(SIGPIPE, SIG_DFL);
+                if (request->hasJobSignals)
+                {
+                    signal(SIGINT, SIG_DFL);
+                    signal(SIGTSTP, SIG_DFL);
+                    signal(SIGTTIN, SIG_DFL);
+                    signal(SIGTTOU, SIG_DFL);
+                }
+                sigprocmask(SIG_SETMASK, &emptyMask, NULL);
+
+                execve(path, args, environ);
 
-            // wait on current process
-            completed_pid[i] = waitpid(completed_pid[i], &bgStatus, 0);
+                // tell the helper why exec failed
+                reply.error = errno;
+                write(errorPipe[1], &reply.error, sizeof(reply.error));
+                _exit(127);
+            }
 
-            // print process id and exit status
-            if (WIFEXITED(bgStatus)) 
+            close(errorPipe[1]);
+            if (pid == -1)
             {
-                bgExitStatus = WEXITSTATUS(bgStatus);
-                printf("background pid %d is done: exit value %d.\n", completed_pid[i], bgExitStatus);
+                reply.error = errno;
             }
             else
             {
-                bgExitStatus = WTERMSIG(bgStatus);
-                printf("background pid %d is done: terminated by signal %d\n", completed_pid[i], bgExitStatus);
- 
-            }
-
-            // remove current ps from open background process array
-            j = 0;
-            while (j < MAX_PIDS && bgpid[j] != INT_MAX)
-            { // cycle through array of bg processes
-                // and look for match 
-                if (bgpid[j] == completed_pid[i])
+                // end of file on the pipe means exec succeeded
+                reply.pid = pid;
+                if (read(errorPipe[0], &reply.error, sizeof(reply.error)) != sizeof(reply.error))
                 {
-                    if (DEBUG)
-                    {
-                        printf("Now removing process %d from array.\n", bgpid[j]);
-                    }                   
-
-                    // replace value of current bg process 
-                    bgpid[j] = INT_MAX;
- 
-                    // shift all subsequent PIDs down to fill `gap`
-                    int k = j;                       
-                    while (k + 1 < MAX_PIDS && bgpid[k+1] != INT_MAX)
-                    {
-                        bgpid[k] = bgpid[k+1];
-                        bgpid[k+1] = INT_MAX;
-                        k++;
-                    }    
-                    // adjust cur index value & make room for new PID  
-                    cur--; 
-                }
-                // increment counter
-                j++;
+                    reply.error = 0;
+                }
             }
-
-            // replace value of current completed process
-            completed_pid[i] = INT_MAX;
-
-            // increment counter
-            i++; 
+            close(errorPipe[0]);
         }
 
-        // reset completed bg process array index tracker
-        completed_cur = 0;
+        for (i = 0; i < numFds; i++)
+        {
+            close(fds[i]);
+        }
 
-        // flush out prompt each time it is printed
-        fflush(stdin);
-        fflush(stdout);
+        send(fd, &reply, sizeof(reply), 0);
+    }
+}
 
-        // prompt user for input
-        printf(": ");
 
-        // get user input
-        fgets(input, MAX_LENGTH, stdin);
 
-        // flush out prompt
-        fflush(stdin);
+int receiveFds(struct msghdr *msg, int *fds, int maxFds)
+{
+    struct cmsghdr *cm;
+    bool isRefused = ((msg->msg_flags & MSG_CTRUNC) != 0);
+    int numFds = 0;
+    int numAttached;
+    int fd;
+    int i;
 
-        // check for blank lines, and NULL
-        if (input[0] == '\n' || input[0] == '\0')
+    for (cm = CMSG_FIRSTHDR(msg); cm != NULL; cm = CMSG_NXTHDR(msg, cm))
+    {
+        if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS)
         {
             continue;
         }
- 
-        // process and parse input
-        numArgs = 0;
-        token = strtok(input, " "); // check for multiple args
 
-        if (DEBUG)
+        numAttached = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (i = 0; i < numAttached; i++)
         {
-            printf("token is %s\n", token); 
+            memcpy(&fd, CMSG_DATA(cm) + i * sizeof(int), sizeof(int));
+            if (numFds < maxFds)
+            {
+                fds[numFds++] = fd;
+            }
+            else
+            {
+                isRefused = true;
+                close(fd);
+            }
         }
+    }
 
-        // loop to process args (up to 512)
-        while (token != NULL && numArgs < MAX_ARGS)  
+    if (isRefused == true)
+    {
+        for (i = 0; i < numFds; i++)
         {
- 
-            // this serves to ignore leading / duplicate / trailing spaces 
-            if (strlen(token) == 0)
-            {
-                continue;
-            }   
+            close(fds[i]);
+        }
+        return -1;
+    }
 
-            if (DEBUG)
-            {
-                printf("overwriting %s with %s\n", *next, token);
-            }
+    return numFds;
+}
 
-            // copy current arg to arg array
-            strcpy(*next, token);
 
-            if (DEBUG)
-            {
-                printf("args[%d] is: %s\n", numArgs, args[numArgs]); 
-            }
 
-            // increment argument  counter
-            numArgs++;
- 
-            // get next arg, if any
-            token = strtok(NULL, " ");
+int launchProcess(pid_t *cpid, const char *path, char **argv, int inFd, int outFd, pid_t pgid)
+{
+    union
+    {
+        struct cmsghdr align;
+        char space[CMSG_SPACE(2 * sizeof(int))];
+    } control;
+    char message[LAUNCH_MESSAGE];
+    struct launchRequest *request = (struct launchRequest *) message;
+    struct launchReply reply;
+    struct cmsghdr *cm;
+    struct msghdr msg;
+    struct iovec iov;
+    size_t length;
+    ssize_t numRead;
+    char *end = message + sizeof(message);
+    char *p;
+    int fds[2];
+    int numFds = 0;
+    int i;
 
-            // increment pointer unless last iteration
-            if (token != NULL)
-            {
-                *next++;
-            } 
-        }
+    // the helper has the environment the shell started with, so once a
+    // for loop has changed it the shell spawns commands itself
+    if (launcherFd == -1 || isEnvironChanged == true)
+    {
+        return -1;
+    }
 
-        if (DEBUG)
-        {
-            printf("overwriting %s", *next);
-        }
+    // pack the path, working directory and arguments after the header;
+    // a request that does not fit is spawned by the shell instead
+    p = message + sizeof(struct launchRequest);
+    length = strlen(path) + 1;
+    if (p + length > end)
+    {
+        return -1;
+    }
+    memcpy(p, path, length);
+    p += length;
 
-        // remove newline char from last arg, if any
-        token = strtok(*next, "\n"); 
-        if (token != NULL)
-        {
-            strcpy(*next, token);
-        }
+    if (getcwd(p, end - p) == NULL)
+    {
+        return -1;
+    }
+    p += strlen(p) + 1;
 
-        if (DEBUG)
+    for (i = 0; argv[i] != NULL; i++)
+    {
+        length = strlen(argv[i]) + 1;
+        if (p + length > end)
         {
-            printf(" with %s\n", *next);
-            printf("args[%d] is: %s\n", numArgs - 1, args[numArgs - 1]); 
+            return -1;
         }
+        memcpy(p, argv[i], length);
+        p += length;
+    }
 
-        // if command is bg process
-        if (strcmp(args[numArgs - 1], "&") == 0)
-        {
-            // set variable appropriately for later 
-            isBackgroundProcess = true;
+    request->numArgs = i;
+    request->hasInput = (inFd != -1);
+    request->hasOutput = (outFd != -1);
+    request->pgid = pgid;
+    request->hasJobSignals = isJobControl;
+    if (inFd != -1)
+    {
+        fds[numFds++] = inFd;
+    }
+    if (outFd != -1)
+    {
+        fds[numFds++] = outFd;
+    }
 
-            // decrement number of args since ampersand will be removed
-            numArgs--; 
+    iov.iov_base = message;
+    iov.iov_len = p - message;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (numFds > 0)
+    {
+        msg.msg_control = control.space;
+        msg.msg_controllen = CMSG_SPACE(numFds * sizeof(int));
+        cm = CMSG_FIRSTHDR(&msg);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(numFds * sizeof(int));
+        memcpy(CMSG_DATA(cm), fds, numFds * sizeof(int));
+    }
 
-            // do not increment pointer so that ampersand is removed  
-        }
-        else
+    if (sendmsg(launcherFd, &msg, 0) == -1)
+    {
+        if (errno == EMSGSIZE)
         {
-            // increment pointer
-            *next++;
+            return -1;
         }
 
-        if (DEBUG)
-        {
-            printf("overwriting %s with NULL\n", *next);
-        }
+        // the helper is gone; spawn everything directly from now on
+        perror("smallsh: launcher");
+        close(launcherFd);
+        launcherFd = -1;
+        return -1;
+    }
+
+    do
+    {
+        numRead = recv(launcherFd, &reply, sizeof(reply), 0);
+    }
+    while (numRead == -1 && errno == EINTR);
+
+    if (numRead != sizeof(reply))
+    {
+        printf("smallsh: launcher stopped\n");
+        close(launcherFd);
+        launcherFd = -1;
+        return -1;
+    }
 
-        if (strncmp(args[0], "#", 1) == 0)
+    // a child whose exec failed is still ours to reap
+    if (reply.error != 0)
+    {
+        if (reply.pid > 0)
         {
-            // do nothing for comments
+            waitpid(reply.pid, NULL, 0);
         }
-        else if (strcmp(args[0], "exit") == 0)
-        {
+        return reply.error;
+    }
 
-            // kill any processes or jobs that shell has started
-            i = 0;
-            while (i < MAX_PIDS && bgpid[i] != INT_MAX)
-            {
-                if (DEBUG)
-                {
-                    printf("Now killing process %d\n", bgpid[i]);
-                }
- 
-                kill(bgpid[i], SIGKILL);
-                i++;
-            }
+    *cpid = reply.pid;
+    return 0;
+}
 
-            // free allocated memory
-            for (i = 0; i <= MAX_ARGS; i++)
-            {
-                if (DEBUG)
-                {
-                    printf("Now freeing memory for args[%d], which has a value of %s\n",i, args[i]);
-                } 
-                free(args[i]); 
-            }  
 
-            // exit the shell
-            repeat = false;
 
-        }
-        else if (strcmp(args[0], "cd") == 0)
-        { // change working directories
+const char *serveClients(const char *path)
+{
+    union
+    {
+        struct cmsghdr align;
+        char space[CMSG_SPACE(3 * sizeof(int))];
+    } control;
+    struct epoll_event events[MAX_EVENTS];
+    struct epoll_event event;
+    struct sockaddr_un address;
+    struct client *clients = NULL;
+    struct client *client;
+    struct msghdr msg;
+    struct iovec iov;
+    char *message;
+    char *dir;
+    ssize_t length;
+    pid_t pid;
+    int fds[3];
+    int numFds;
+    int listenFd;
+    int epollFd;
+    int numEvents;
+    int status;
+    int fd;
+    int i;
+    int j;
 
-            // if no args, change to directory specified in HOME env var
-            if (numArgs == 1)
-            {
-                chdir(getenv("HOME"));
-            }
-            // if one arg, change to dir provided
-            else
-            {
-                chdir(args[1]);
-            }
-            // support absolute and relative paths
-        }
-        else if (strcmp(args[0], "status") == 0)
-        { // print exit status or terminating signal of last fg command
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, "smallsh: socket path is too long\n");
+        exit(2);
+    }
+    strcpy(address.sun_path, path);
+
+    // a socket left by a server that has gone is replaced
+    unlink(path);
 
-            if (WIFEXITED(status))
+    message = malloc(CLIENT_REQUEST);
+    listenFd = socket(AF_UNIX, SOCK_SEQPACKET|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    if (message == NULL || listenFd == -1 || epollFd == -1 ||
+        bind(listenFd, (struct sockaddr *) &address, sizeof(address)) == -1 ||
+        listen(listenFd, SOMAXCONN) == -1 ||
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &event) == -1)
+    {
+        perror("smallsh: listen");
+        exit(1);
+    }
+
+    // a client that goes away should not take the server with it
+    signal(SIGPIPE, SIG_IGN);
+
+    while (true)
+    {
+        numEvents = epoll_wait(epollFd, events, MAX_EVENTS, -1);
+        if (numEvents == -1)
+        {
+            if (errno == EINTR)
             {
-                exitStatus = WEXITSTATUS(status);
-                printf("exit value %d\n", exitStatus);
+                continue;
             }
-            else if (signalNum != 0)
-            {
-                printf("terminated by signal %d\n", signalNum);
-            } 
-
+            perror("smallsh: epoll_wait");
+            exit(1);
         }
-        else // pass through to BASH to interpret command there
+
+        for (i = 0; i < numEvents; i++)
         {
-            // need fork and exec
-            cpid = fork();
+            client = events[i].data.ptr;
 
-            if (cpid == 0) // child process
+            // new connections: take every one that is waiting
+            if (client == NULL)
             {
-                bool checkStatus = false; 
-                bool redirectInput = false;
-                bool redirectOutput = false;
-                int inputOffset = 0;
-                int outputOffset = 0;
-
-                if (numArgs > 4 && strcmp(args[numArgs-4], "<") == 0)
+                while ((fd = accept4(listenFd, NULL, NULL, SOCK_CLOEXEC)) != -1)
                 {
-                    if (DEBUG)
+                    client = malloc(sizeof(struct client));
+                    event.events = EPOLLIN;
+                    event.data.ptr = client;
+                    if (client == NULL || epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) == -1)
                     {
-                        printf("1) input redirected to %s\n", args[numArgs-3]);     
+                        free(client);
+                        close(fd);
+                        continue;
                     }
 
-                    // set flag to redirect input
-                    redirectInput = true;
-
-                    // set target for input path
-                    inputOffset = 3; 
-                }
-                else if (numArgs > 2 && strcmp(args[numArgs-2], "<") == 0)
-                {
-                    if (DEBUG)
+                    client->fd = fd;
+                    client->pid = 0;
+                    client->pidfd = -1;
+                    client->prev = NULL;
+                    client->next = clients;
+                    if (clients != NULL)
                     {
-                        printf("2) input redirected to %s\n", args[numArgs-1]);     
+                        clients->prev = client;
                     }
+                    clients = client;
+                }
+                continue;
+            }
 
-                    // set flag to redirect input
-                    redirectInput = true;
+            // a request: the client's directory and commands, with its
+            // stdin, stdout and stderr attached
+            if (client->pid == 0)
+            {
+                iov.iov_base = message;
+                iov.iov_len = CLIENT_REQUEST;
+                memset(&msg, 0, sizeof(msg));
+                msg.msg_iov = &iov;
+                msg.msg_iovlen = 1;
+                msg.msg_control = control.space;
+                msg.msg_controllen = sizeof(control.space);
 
-                    // set target for input path
-                    inputOffset = 1; 
-                }
-                if (numArgs > 4 && strcmp(args[numArgs-4], ">") == 0)
+                length = recvmsg(client->fd, &msg, MSG_CMSG_CLOEXEC|MSG_DONTWAIT);
+                if (length == -1 && (errno == EAGAIN || errno == EINTR))
                 {
-                    if (DEBUG)
-                    {
-                        printf("3) output redirected to %s\n", args[numArgs-3]);     
-                    }
- 
-                    // set flag to redirect output
-                    redirectOutput = true;
-
-                    // set target for output path
-                    outputOffset = 3; 
+                    continue;
                 }
-                else if (numArgs > 2 && strcmp(args[numArgs-2], ">") == 0)
-                {
-                    if (DEBUG)
-                    {
-                        printf("4) output redirected to %s\n", args[numArgs-1]);     
-                    }
- 
-                    // set flag to redirect output
-                    redirectOutput = true;
 
-                    // set target for output path
-                    outputOffset = 1; 
-                }
+                // exactly stdin, stdout and stderr, or the request fails
+                numFds = receiveFds(&msg, fds, 3);
 
-                // redirect stdin for bg process to dev/null if no path provided
-                if (isBackgroundProcess == true && redirectInput == false)
+                // the directory and the commands are both ended by a null
+                pid = -1;
+                if (length > 0 && numFds == 3 && message[length - 1] == '\0' &&
+                    memchr(message, '\0', length - 1) != NULL)
                 {
-                    fd = open("/dev/null", O_RDONLY);
-
-                    checkStatus = true;      
+                    pid = fork();
                 }
-                else if (redirectInput == true)
+                if (pid == 0)
                 {
-                    fd = open(args[numArgs - inputOffset], O_RDONLY);
-
-                    checkStatus = true;  
+                    dir = message;
+                    startSession(dir, fds, clients, listenFd, epollFd);
+                    message += strlen(dir) + 1;
+                    return (message[0] != '\0') ? message : NULL;
                 }
-
-                if (checkStatus == true)
+                for (j = 0; j < numFds; j++)
                 {
-                    if (fd == -1)
-                    {
-                        printf("smallsh: cannot open %s for input\n", args[numArgs - inputOffset]);
-                        exit(1); 
-                    }
-
-                    fd2 = dup2(fd, 0);
-                    if (fd2 == -1)
-                    {
-                        printf("smallsh: cannot open %s for input\n", args[numArgs - inputOffset]);
-                        exit(1);
-                    }   
+                    close(fds[j]);
                 }
 
-                if (redirectOutput == true)
+                // the connection is watched again once the session ends
+                epoll_ctl(epollFd, EPOLL_CTL_DEL, client->fd, NULL);
+                if (pid > 0)
                 {
-                    fd = open(args[numArgs - outputOffset], O_WRONLY|O_CREAT|O_TRUNC, 0644);
-
-                    if (fd == -1)
+                    client->pid = pid;
+                    client->pidfd = pidfd_open(pid, 0);
+                    event.events = EPOLLIN;
+                    event.data.ptr = client;
+                    if (client->pidfd != -1 &&
+                        epoll_ctl(epollFd, EPOLL_CTL_ADD, client->pidfd, &event) == 0)
                     {
-                        printf("smallsh: cannot open %s for output\n", args[numArgs - outputOffset]);
-                        exit(1); 
+                        continue;
                     }
 
-                    fd2 = dup2(fd, 1);
-                    if (fd2 == -1)
-                    {
-                        printf("smallsh: cannot open %s for output\n", args[numArgs - outputOffset]);
-                        exit(1);
-                    }   
-                }
-
-                // get the greater of the offsets, if any
-                i = 0;
-                if (inputOffset > outputOffset)
-                {
-                    i = inputOffset + 1;
+                    // a session that cannot be watched is waited for now
+                    waitpid(pid, &status, 0);
                 }
-                else if (outputOffset > inputOffset)
+                else if (length > 0)
                 {
-                    i = outputOffset + 1;
+                    status = W_EXITCODE(2, 0);
                 }
-
-                // move the pointer to omit the input redirection from array
-                for (j = i; j > 0; j--)
+                else
                 {
-                    *next--;
+                    // the client went away without a request
+                    status = -1;
                 }
-
-                // add NULL pointer to last array index (only in child)
-                *next = NULL;
-
-                // exec using path version in order to use Linux built-ins
-                execvp(args[0], args);
-
-                // this will never run unless error (i.e.- bad filename)
-                printf("%s", args[0]);
-                fflush(NULL);
-                perror(" ");  
- 
-                exit(1); // end child process
-            }
-            else if (cpid == -1) // parent process
-            {   
-                // if unable to fork print error
-                printf("%s", args[0]);
-                fflush(NULL);                 
-                perror(" ");
-            } 
+            }
             else
             {
-                // parent process continues here
-
-                // if command is bg process
-                if (isBackgroundProcess == true)
-                {
-                    // then print process id when begins
-                    printf("background pid is %d\n", cpid);
-
-                    // reset boolean value for next iteration
-                    isBackgroundProcess = false;
-
-                    // add process id to array of background processes
-                    if (cur < MAX_PIDS)
-                    {  
-                        bgpid[cur++] = cpid;
-                    }
-                } 
-                else
-                {
-                    // reset value of signal number
-                    signalNum = 0;                     
-
-                    // assign cpid to global variable
-                    // for access in signal handlers  
-                    fgpid = cpid;
-
-                    // set interrupt handler for fg process 
-                    sigaction(SIGINT, &foreground_act, NULL);
-
-                    // wait for fg child process
-                    fgpid = waitpid(fgpid, &status, 0);
+                // the session has ended
+                waitpid(client->pid, &status, 0);
+                close(client->pidfd);
+            }
 
-                    // restore to ignore interrupts
-                    sigaction(SIGINT, &restOfTheTime_act, NULL);
+            // send back the session's exit status, as a shell's would be
+            if (status != -1)
+            {
+                status = WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+                send(client->fd, &status, sizeof(status), MSG_DONTWAIT);
+            }
 
-                    // reset global variable so signal handlers know
-                    // there is no active fg process
-                    fgpid = INT_MAX;
+            if (DEBUG)
+            {
+                printf("Client of session %d is done: %d\n", client->pid, status);
+            }
 
-                    // if process was terminated by signal, print message
-                    if (signalNum != 0)
-                    {
-                        printf("terminated by signal %d\n", signalNum);
-                    }   
-                }
+            close(client->fd);
+            if (client->prev != NULL)
+            {
+                client->prev->next = client->next;
+            }
+            else
+            {
+                clients = client->next;
+            }
+            if (client->next != NULL)
+            {
+                client->next->prev = client->prev;
             }
+            free(client);
         }
-
-    } // repeat until user exits shell
-    while(repeat == true);
-
-    return 0;
+    }
 }
 
 
 
-void bgHandler(int sig, siginfo_t* info, void* vp)
+void startSession(const char *dir, int *fds, struct client *clients, int listenFd, int epollFd)
 {
-    if (DEBUG)
+    struct client *client;
+    int i;
+
+    // none of the server's descriptors are the session's business
+    close(listenFd);
+    close(epollFd);
+    for (client = clients; client != NULL; client = client->next)
     {
-        printf("In bgHandler.\n");
+        close(client->fd);
+        if (client->pidfd != -1)
+        {
+            close(client->pidfd);
+        }
     }
 
-    pid_t ref_pid = info->si_pid; 
-
-    // if signal is not from fg process, process it here
-    if (ref_pid != fgpid && completed_cur < MAX_PIDS)
+    for (i = 0; i < 3; i++)
     {
-        // add to completed bg process array so message can
-        // be displayed in main loop
-        completed_pid[completed_cur++] = ref_pid;
-    } 
-
-    return;
-}
-
+        if (fds[i] != i)
+        {
+            dup2(fds[i], i);
+        }
+    }
+    for (i = 0; i < 3; i++)
+    {
+        if (fds[i] > 2)
+        {
+            close(fds[i]);
+        }
+    }
 
+    // the session's jobs are its own, away from the server's terminal
+    setsid();
 
-void sigintHandler()
-{
-    // if interrupt signal occurs while fg process is running, kill it
-    if (fgpid != INT_MAX)
+    if (chdir(dir) == -1)
     {
-        // kill the foreground process
-        kill(fgpid, SIGKILL);
- 
-        // set global variable for status messages
-        signalNum = 2;  
-    }  
-
-    // ignore interrupt signal for all other processes
-    // and simply return
-    return;
+        fprintf(stderr, "smallsh: cannot change to %s\n", dir);
+    }
 }